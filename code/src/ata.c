@@ -0,0 +1,296 @@
+#include "ata.h"
+#include "irq.h"
+
+extern void write_port(unsigned short port, unsigned char data);
+extern unsigned char read_port(unsigned short port);
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+/* Primary channel registers */
+#define ATA_IO         0x1F0
+#define ATA_DATA       (ATA_IO + 0)
+#define ATA_COUNT      (ATA_IO + 2)
+#define ATA_LBA_LO     (ATA_IO + 3)
+#define ATA_LBA_MID    (ATA_IO + 4)
+#define ATA_LBA_HI     (ATA_IO + 5)
+#define ATA_DRIVE      (ATA_IO + 6)
+#define ATA_STATUS     (ATA_IO + 7)   // read (acknowledges INTRQ)
+#define ATA_COMMAND    (ATA_IO + 7)   // write
+#define ATA_CTRL       0x3F6          // write: device control, read: alt status
+
+#define ATA_SR_ERR     0x01
+#define ATA_SR_DRQ     0x08
+#define ATA_SR_DF      0x20
+#define ATA_SR_BSY     0x80
+
+#define ATA_CMD_READ     0x20
+#define ATA_CMD_WRITE    0x30
+#define ATA_CMD_IDENTIFY 0xEC
+
+#define ATA_CTRL_NIEN  0x02           // mask INTRQ
+
+#define ATA_SPIN_LIMIT 10000000       // status polls before giving up
+
+static int      ata_found = 0;
+static uint32_t ata_total_sectors = 0;
+
+/* The write in flight */
+static struct {
+    int            active;
+    uint32_t       sectors;
+    uint32_t       sent;              // sectors handed to the drive
+    const uint8_t *pages[ATA_MAX_REQ_PAGES];
+    ata_done_fn    done;
+} ata_req;
+
+/* Counters */
+static uint32_t ata_reads         = 0;
+static uint32_t ata_read_sectors  = 0;
+static uint32_t ata_writes        = 0;
+static uint32_t ata_write_sectors = 0;
+static uint32_t ata_irqs          = 0;
+static uint32_t ata_polls         = 0;
+static uint32_t ata_errors        = 0;
+
+/* ~400ns: four reads of the alternate status register */
+static inline void ata_delay(void)
+{
+    for (int i = 0; i < 4; i++) {
+        read_port(ATA_CTRL);
+    }
+}
+
+static void ata_put_sector(const uint8_t *buf)
+{
+    uint32_t words = ATA_SECTOR_SIZE / 2;
+    asm volatile("rep outsw" : "+S"(buf), "+c"(words) : "d"(ATA_DATA) : "memory");
+}
+
+static void ata_get_sector(uint8_t *buf)
+{
+    uint32_t words = ATA_SECTOR_SIZE / 2;
+    asm volatile("rep insw" : "+D"(buf), "+c"(words) : "d"(ATA_DATA) : "memory");
+}
+
+/* Wait until the drive is not busy and either wants data or failed.
+   Returns 0 when DRQ is set, -1 on error or timeout. */
+static int ata_wait_drq(void)
+{
+    for (uint32_t spin = 0; spin < ATA_SPIN_LIMIT; spin++) {
+        uint8_t st = read_port(ATA_STATUS);
+        if (st & ATA_SR_BSY) continue;
+        if (st & (ATA_SR_ERR | ATA_SR_DF)) return -1;
+        if (st & ATA_SR_DRQ) return 0;
+    }
+    return -1;
+}
+
+/* Master drive, 28-bit LBA. A count of 256 is written as 0. */
+static void ata_command(uint32_t lba, uint32_t count, uint8_t cmd)
+{
+    write_port(ATA_DRIVE, 0xE0 | ((lba >> 24) & 0x0F));
+    write_port(ATA_COUNT, (uint8_t)count);
+    write_port(ATA_LBA_LO, (uint8_t)lba);
+    write_port(ATA_LBA_MID, (uint8_t)(lba >> 8));
+    write_port(ATA_LBA_HI, (uint8_t)(lba >> 16));
+    write_port(ATA_COMMAND, cmd);
+    ata_delay();
+}
+
+int ata_init(void)
+{
+    // Floating bus: no controller
+    if (read_port(ATA_STATUS) == 0xFF) {
+        return 0;
+    }
+
+    write_port(ATA_CTRL, ATA_CTRL_NIEN);
+    write_port(ATA_DRIVE, 0xA0);
+    ata_delay();
+    write_port(ATA_COUNT, 0);
+    write_port(ATA_LBA_LO, 0);
+    write_port(ATA_LBA_MID, 0);
+    write_port(ATA_LBA_HI, 0);
+    write_port(ATA_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay();
+
+    if (read_port(ATA_STATUS) == 0) {
+        return 0; // No drive
+    }
+    uint32_t spin = 0;
+    while ((read_port(ATA_STATUS) & ATA_SR_BSY) && spin++ < ATA_SPIN_LIMIT);
+
+    // ATAPI (the CD-ROM) and SATA signatures: not a disk we can use
+    if (read_port(ATA_LBA_MID) || read_port(ATA_LBA_HI)) {
+        return 0;
+    }
+    if (ata_wait_drq() != 0) {
+        return 0;
+    }
+
+    uint16_t id[ATA_SECTOR_SIZE / 2];
+    ata_get_sector((uint8_t *)id);
+    ata_total_sectors = id[60] | ((uint32_t)id[61] << 16);  // LBA28 sectors
+    if (ata_total_sectors == 0) {
+        return 0;
+    }
+
+    ata_found = 1;
+    write_port(ATA_CTRL, 0); // Interrupts on
+    return 1;
+}
+
+uint32_t ata_sectors(void)
+{
+    return ata_found ? ata_total_sectors : 0;
+}
+
+int ata_busy(void)
+{
+    return ata_req.active;
+}
+
+static void ata_complete(int status)
+{
+    ata_req.active = 0;
+    if (status != 0) {
+        ata_errors++;
+    }
+    if (ata_req.done) {
+        ata_req.done(status);
+    }
+}
+
+/* Advance the write in flight: send the next sector when the drive asks
+   for it, finish once the last one has been taken. Shared by the IRQ
+   handler and polling. */
+static void ata_service(void)
+{
+    if (!ata_req.active) {
+        return;
+    }
+
+    uint8_t st = read_port(ATA_STATUS);
+    if (st & ATA_SR_BSY) {
+        return;
+    }
+    if (st & (ATA_SR_ERR | ATA_SR_DF)) {
+        ata_complete(-1);
+        return;
+    }
+
+    if (ata_req.sent < ata_req.sectors) {
+        if (st & ATA_SR_DRQ) {
+            uint32_t s = ata_req.sent++;
+            ata_put_sector(ata_req.pages[s / 8] + (s % 8) * ATA_SECTOR_SIZE);
+            ata_delay();
+        }
+        return;
+    }
+
+    if (!(st & ATA_SR_DRQ)) {
+        ata_complete(0);
+    }
+}
+
+int ata_write_async(uint32_t lba, const uint8_t **pages, uint32_t npages, ata_done_fn done)
+{
+    if (!ata_found || ata_req.active || npages == 0 || npages > ATA_MAX_REQ_PAGES) {
+        return -1;
+    }
+
+    uint32_t flags = irq_save();
+    for (uint32_t i = 0; i < npages; i++) {
+        ata_req.pages[i] = pages[i];
+    }
+    ata_req.sectors = npages * (PAGE_SIZE / ATA_SECTOR_SIZE);
+    ata_req.sent = 0;
+    ata_req.done = done;
+
+    ata_command(lba, ata_req.sectors, ATA_CMD_WRITE);
+
+    // The first sector goes out without an interrupt
+    if (ata_wait_drq() != 0) {
+        ata_errors++;
+        irq_restore(flags);
+        return -1;
+    }
+    ata_put_sector(ata_req.pages[0]);
+    ata_req.sent = 1;
+    ata_req.active = 1;
+    ata_writes++;
+    ata_write_sectors += ata_req.sectors;
+    irq_restore(flags);
+    return 0;
+}
+
+void ata_wait(void)
+{
+    uint32_t flags = irq_save();
+    uint32_t spin = 0;
+    while (ata_req.active) {
+        ata_polls++;
+        ata_service();
+        if (++spin == ATA_SPIN_LIMIT) {
+            ata_complete(-1); // Drive stopped responding
+        }
+    }
+    irq_restore(flags);
+}
+
+int ata_read(uint32_t lba, uint32_t count, void *buf)
+{
+    if (!ata_found || count == 0 || count > 256) {
+        return -1;
+    }
+    ata_wait();
+
+    // Polled transfer: keep the drive from raising IRQ14 meanwhile
+    uint32_t flags = irq_save();
+    int ret = 0;
+    write_port(ATA_CTRL, ATA_CTRL_NIEN);
+    ata_command(lba, count, ATA_CMD_READ);
+    uint8_t *dst = (uint8_t *)buf;
+    for (uint32_t i = 0; i < count; i++) {
+        if (ata_wait_drq() != 0) {
+            ata_errors++;
+            ret = -1;
+            break;
+        }
+        ata_get_sector(dst + i * ATA_SECTOR_SIZE);
+    }
+    write_port(ATA_CTRL, 0);
+    irq_restore(flags);
+
+    ata_reads++;
+    ata_read_sectors += count;
+    return ret;
+}
+
+void ata_irq_handler(void)
+{
+    ata_irqs++;
+    ata_service();
+
+    write_port(0xA0, 0x20); // EOI to Slave PIC
+    write_port(0x20, 0x20); // EOI to Master PIC
+}
+
+void ata_print_stats(void)
+{
+    kprint("  ata: ");
+    kprint_dec(ata_writes);
+    kprint(" writes (");
+    kprint_dec(ata_write_sectors);
+    kprint(" sectors), ");
+    kprint_dec(ata_reads);
+    kprint(" reads (");
+    kprint_dec(ata_read_sectors);
+    kprint(" sectors), ");
+    kprint_dec(ata_irqs);
+    kprint(" irqs, ");
+    kprint_dec(ata_polls);
+    kprint(" polls, ");
+    kprint_dec(ata_errors);
+    kprint(" errors\n");
+}
@@ -0,0 +1,46 @@
+#ifndef ATA_H
+#define ATA_H
+
+#include "paging.h" // For types
+
+/*
+   ATA PIO driver for the primary master (ports 0x1F0-0x1F7, IRQ14).
+   Reads are polled. Writes are started with ata_write_async() and then
+   driven one sector per IRQ14; ata_wait() finishes a request by polling
+   when the caller runs with interrupts off.
+*/
+
+#define ATA_SECTOR_SIZE   512
+#define ATA_MAX_REQ_PAGES 32    // 256 sectors, the most one command can move
+
+/* Called when an asynchronous write finishes: status 0 or -1 */
+typedef void (*ata_done_fn)(int status);
+
+/* Probe the primary master. Returns 1 if an ATA disk is attached. */
+int ata_init(void);
+
+/* Disk size in sectors (0 when no disk) */
+uint32_t ata_sectors(void);
+
+/* Read `count` sectors (1-256) into buf. Waits for any write in flight.
+   Returns 0 or -1. */
+int ata_read(uint32_t lba, uint32_t count, void *buf);
+
+/* Start writing `npages` 4KB buffers to consecutive sectors from lba.
+   The buffers must stay untouched until done() runs.
+   Returns 0, or -1 if the disk is busy or refused the command. */
+int ata_write_async(uint32_t lba, const uint8_t **pages, uint32_t npages, ata_done_fn done);
+
+/* 1 while a write is in flight */
+int ata_busy(void);
+
+/* Complete the write in flight by polling */
+void ata_wait(void);
+
+/* IRQ14 handler (called from ata_irq_stub) */
+void ata_irq_handler(void);
+
+/* Print request / IRQ counters */
+void ata_print_stats(void);
+
+#endif
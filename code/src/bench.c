@@ -0,0 +1,80 @@
+#include "bench.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+extern void write_port(unsigned short port, unsigned char data);
+extern unsigned char read_port(unsigned short port);
+
+#define PIT_FREQ_HZ     1193182
+#define PIT_CH2_PORT    0x42
+#define PIT_CMD_PORT    0x43
+#define PIT_GATE_PORT   0x61
+#define BENCH_CAL_MS    50
+
+static uint32_t tsc_khz = 0;
+
+uint64_t bench_div64(uint64_t n, uint32_t d)
+{
+    uint32_t hi = (uint32_t)(n >> 32);
+    uint32_t lo = (uint32_t)n;
+    uint32_t q_hi = hi / d;
+    uint32_t r = hi % d;
+    uint32_t q_lo;
+
+    /* r < d, so the 64/32 divl below cannot overflow */
+    asm("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(r), "rm"(d));
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+void bench_init(void)
+{
+    uint8_t gate = read_port(PIT_GATE_PORT);
+    uint32_t latch = PIT_FREQ_HZ * BENCH_CAL_MS / 1000;
+    uint32_t spins = 0;
+
+    /* Gate channel 2 on, speaker off, one-shot (mode 0) countdown */
+    write_port(PIT_GATE_PORT, (gate & ~0x02) | 0x01);
+    write_port(PIT_CMD_PORT, 0xB0);
+    write_port(PIT_CH2_PORT, (unsigned char)(latch & 0xFF));
+    write_port(PIT_CH2_PORT, (unsigned char)(latch >> 8));
+
+    uint64_t start = bench_now();
+    while (!(read_port(PIT_GATE_PORT) & 0x20) && spins < 100000000) {
+        spins++;
+    }
+    uint64_t cycles = bench_now() - start;
+
+    write_port(PIT_GATE_PORT, gate);
+
+    tsc_khz = (uint32_t)bench_div64(cycles, BENCH_CAL_MS);
+    if (tsc_khz < 1000) {
+        tsc_khz = 1000000; // No usable PIT: assume 1 GHz
+    }
+
+    kprint("[BENCH] TSC: ");
+    kprint_dec(tsc_khz / 1000);
+    kprint(" MHz\n");
+}
+
+uint32_t bench_tsc_khz(void)
+{
+    return tsc_khz;
+}
+
+uint32_t bench_cycles_to_us(uint64_t cycles)
+{
+    return (uint32_t)bench_div64(cycles * 1000, tsc_khz);
+}
+
+void bench_print_rate(const char *label, uint32_t ops, uint64_t cycles)
+{
+    uint32_t us = bench_cycles_to_us(cycles);
+    if (us == 0) us = 1;
+
+    kprint(label);
+    kprint(": ");
+    kprint_dec((uint32_t)bench_div64((uint64_t)ops * 1000000, us));
+    kprint("/sec (");
+    kprint_dec(ops ? (uint32_t)bench_div64(cycles, ops) : 0);
+    kprint(" cycles/op)\n");
+}
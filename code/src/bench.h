@@ -0,0 +1,35 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "paging.h" // For types
+
+/* 
+   Benchmark helpers.
+   Cycle counting with the TSC, calibrated once at boot against PIT channel 2
+   (channel 0 drives the 100 Hz tick, which does not advance while shell commands run).
+*/
+
+/* Calibrate the TSC. Call once during boot. */
+void bench_init(void);
+
+/* Read the time stamp counter */
+static inline uint64_t bench_now(void)
+{
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* 64-by-32 bit division (no libgcc in the kernel) */
+uint64_t bench_div64(uint64_t n, uint32_t d);
+
+/* Calibrated TSC frequency in kHz */
+uint32_t bench_tsc_khz(void);
+
+/* Convert a cycle count to microseconds */
+uint32_t bench_cycles_to_us(uint64_t cycles);
+
+/* Print "<label>: <ops/sec>/sec (<cycles/op> cycles/op)" */
+void bench_print_rate(const char *label, uint32_t ops, uint64_t cycles);
+
+#endif
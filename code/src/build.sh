@@ -19,11 +19,27 @@ gcc -m32 -ffreestanding -fno-stack-protector -g -c pmm.c -o pmm.o
 gcc -m32 -ffreestanding -fno-stack-protector -g -c swap.c -o swap.o
 gcc -m32 -ffreestanding -fno-stack-protector -g -c fs.c  -o fs.o
 gcc -m32 -ffreestanding -fno-stack-protector -g -c net.c -o net.o
-ld -m elf_i386 -T link.ld -o $OUT_DIR/kernel.bin start.o kernel.o paging.o pmm.o swap.o fs.o net.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c bench.c -o bench.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c slab.c -o slab.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c evict.c -o evict.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c lz.c -o lz.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c dedup.c -o dedup.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c ata.c -o ata.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c kstring.c -o kstring.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c vmalloc.c -o vmalloc.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c shrink.c -o shrink.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c wss.c -o wss.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c config.c -o config.o
+gcc -m32 -ffreestanding -fno-stack-protector -g -c initramfs.c -o initramfs.o
+ld -m elf_i386 -T link.ld -o $OUT_DIR/kernel.bin start.o kernel.o paging.o pmm.o swap.o fs.o net.o bench.o slab.o evict.o lz.o dedup.o ata.o kstring.o vmalloc.o shrink.o wss.o config.o initramfs.o
 
 # Copy to ISO structure
 cp $OUT_DIR/kernel.bin $BOOT_DIR/kernel.bin
 
+# Initramfs: the contents of ../initramfs as a ustar archive (grub.cfg loads it as a module)
+mkdir -p $OUT_DIR/initramfs
+tar --format=ustar -cf $BOOT_DIR/initramfs.tar -C $OUT_DIR/initramfs .
+
 # Create ISO
 # Create ISO (Optional)
 if command -v grub-mkrescue &> /dev/null && command -v mformat &> /dev/null; then
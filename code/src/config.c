@@ -0,0 +1,46 @@
+#include "config.h"
+
+static char config_line[CONFIG_CMDLINE_MAX];
+
+void config_init(uint32_t magic, multiboot_info_t *mbi)
+{
+    config_line[0] = '\0';
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_CMDLINE)) {
+        return;
+    }
+    const char *src = (const char *)mbi->cmdline;
+    int i = 0;
+    while (src[i] && i < CONFIG_CMDLINE_MAX - 1) {
+        config_line[i] = src[i];
+        i++;
+    }
+    config_line[i] = '\0';
+}
+
+uint32_t config_get(const char *key, uint32_t def)
+{
+    const char *p = config_line;
+    while (*p) {
+        while (*p == ' ') p++;
+
+        // Compare this word's key
+        int k = 0;
+        while (key[k] && p[k] == key[k]) k++;
+        if (!key[k] && p[k] == '=' && p[k + 1] >= '0' && p[k + 1] <= '9') {
+            uint32_t val = 0;
+            for (p += k + 1; *p >= '0' && *p <= '9'; p++) {
+                val = val * 10 + (uint32_t)(*p - '0');
+            }
+            if (*p == ' ' || *p == '\0') {
+                return val;
+            }
+        }
+        while (*p && *p != ' ') p++;
+    }
+    return def;
+}
+
+const char *config_cmdline(void)
+{
+    return config_line;
+}
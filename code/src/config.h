@@ -0,0 +1,26 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "multiboot.h"
+
+/*
+   Boot-time configuration.
+   Options come from the Multiboot command line as space separated
+   key=value words with decimal values, e.g. in grub.cfg:
+       multiboot /boot/kernel.bin swap_slots=2048 history=32
+   Unknown keys are ignored; missing or malformed ones take the default.
+*/
+
+#define CONFIG_CMDLINE_MAX 256
+
+/* Copy the command line out of the boot information. Call first thing
+   in kmain(), before the PMM can hand its memory out. */
+void config_init(uint32_t magic, multiboot_info_t *mbi);
+
+/* Value of `key`, or def if it is absent */
+uint32_t config_get(const char *key, uint32_t def);
+
+/* The command line as passed by the loader ("" if there was none) */
+const char *config_cmdline(void);
+
+#endif
@@ -0,0 +1,236 @@
+#include "dedup.h"
+#include "evict.h"
+#include "pmm.h"
+#include "kstring.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+typedef struct {
+    uint32_t pfn;
+    uint32_t refs;      // mappings of this frame
+} dedup_frame_t;
+
+/* Merged frames. Kept small and searched linearly: only evictions and
+   copy-on-write faults look here. */
+static dedup_frame_t dedup_frames[DEDUP_MAX_SHARED];
+static uint32_t dedup_frame_count = 0;
+
+/* Scan candidates, bucketed by content hash */
+#define DEDUP_HASH_BITS 11
+#define DEDUP_HASH_SIZE (1 << DEDUP_HASH_BITS)
+#define DEDUP_NONE      -1
+static int      cand_head[DEDUP_HASH_SIZE];
+static int      cand_next[EVICT_MAX_RESIDENT];
+static uint32_t cand_virt[EVICT_MAX_RESIDENT];
+static uint32_t cand_hash[EVICT_MAX_RESIDENT];
+
+/* Counters */
+static uint32_t dedup_saved_pages = 0;   // mappings sharing another's frame
+static uint32_t dedup_merges      = 0;
+static uint32_t dedup_cow_copies  = 0;   // write faults that copied the frame
+static uint32_t dedup_cow_reuses  = 0;   // write faults on the last mapping
+static uint32_t dedup_scans       = 0;
+
+uint32_t dedup_page_hash(const uint8_t *page)
+{
+    // FNV-1a over 32-bit words
+    const uint32_t *w = (const uint32_t *)page;
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < PAGE_SIZE / 4; i++) {
+        h = (h ^ w[i]) * 16777619u;
+    }
+    return h;
+}
+
+/* Pages are compared through their mappings, since frames in high
+   memory have no direct-mapped address */
+static int pages_equal(uint32_t virt_a, uint32_t virt_b)
+{
+    return memcmp((const void *)virt_a, (const void *)virt_b, PAGE_SIZE) == 0;
+}
+
+static int dedup_find(uint32_t pfn)
+{
+    for (uint32_t i = 0; i < dedup_frame_count; i++) {
+        if (dedup_frames[i].pfn == pfn) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void dedup_remove(int idx)
+{
+    dedup_frames[idx] = dedup_frames[--dedup_frame_count];
+}
+
+/* Point virt (currently on its own frame) at target_virt's frame,
+   read-only on both sides. Returns 0 or -1. */
+static int dedup_merge(uint32_t virt, uint32_t target_virt)
+{
+    uint32_t *pte  = paging_get_pte(virt);
+    uint32_t *tpte = paging_get_pte(target_virt);
+    uint32_t own    = paging_pte_pfn(pte);
+    uint32_t target = paging_pte_pfn(tpte);
+
+    // Frames already shared stay where they are
+    if (dedup_find(own) >= 0) {
+        return -1;
+    }
+
+    int idx = dedup_find(target);
+    if (idx < 0) {
+        if (dedup_frame_count == DEDUP_MAX_SHARED) {
+            return -1;
+        }
+        idx = (int)dedup_frame_count++;
+        dedup_frames[idx].pfn  = target;
+        dedup_frames[idx].refs = 1;
+        paging_test_and_clear(target_virt, PAGE_RW);
+    }
+
+    // Keep accessed/dirty: a dirty page still differs from its swap copy
+    if (map_frame(target, virt, (*pte & 0xFFF) & ~PAGE_RW) != 0) {
+        return -1;
+    }
+    dedup_frames[idx].refs++;
+    pmm_free_frame(own);
+    dedup_saved_pages++;
+    dedup_merges++;
+    return 0;
+}
+
+void dedup_scan(void)
+{
+    uint32_t n = evict_resident_count();
+    uint32_t cands = 0, merged = 0;
+
+    for (int i = 0; i < DEDUP_HASH_SIZE; i++) {
+        cand_head[i] = DEDUP_NONE;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t virt = evict_resident_page(i);
+        uint32_t *pte = paging_get_pte(virt);
+        if (!pte || !(*pte & PAGE_PRESENT)) {
+            continue;
+        }
+        uint32_t pfn = paging_pte_pfn(pte);
+        uint32_t h = dedup_page_hash((const uint8_t *)virt);
+        uint32_t bucket = h & (DEDUP_HASH_SIZE - 1);
+
+        int c = cand_head[bucket];
+        while (c != DEDUP_NONE) {
+            uint32_t cpfn = paging_pte_pfn(paging_get_pte(cand_virt[c]));
+            if (cand_hash[c] == h && cpfn != pfn && pages_equal(cand_virt[c], virt)) {
+                break;
+            }
+            c = cand_next[c];
+        }
+        if (c != DEDUP_NONE && dedup_merge(virt, cand_virt[c]) == 0) {
+            merged++;
+            continue;
+        }
+
+        cand_virt[cands] = virt;
+        cand_hash[cands] = h;
+        cand_next[cands] = cand_head[bucket];
+        cand_head[bucket] = (int)cands;
+        cands++;
+    }
+    dedup_scans++;
+
+    kprint("Scanned ");
+    kprint_dec(n);
+    kprint(" resident pages, merged ");
+    kprint_dec(merged);
+    kprint("\n");
+    dedup_print_stats();
+}
+
+int dedup_frame_put(uint32_t pfn)
+{
+    int idx = dedup_find(pfn);
+    if (idx < 0) {
+        return 1;
+    }
+    if (--dedup_frames[idx].refs == 0) {
+        dedup_remove(idx);
+        return 1;
+    }
+    dedup_saved_pages--;
+    return 0;
+}
+
+int dedup_cow_fault(uint32_t virt_addr)
+{
+    uint32_t page = virt_addr & ~0xFFF;
+    uint32_t *pte = paging_get_pte(page);
+    if (!pte || !(*pte & PAGE_PRESENT) || (*pte & PAGE_RW)) {
+        return -1;
+    }
+    int idx = dedup_find(paging_pte_pfn(pte));
+    if (idx < 0) {
+        return -1;
+    }
+
+    // Last mapping: take the frame back
+    if (dedup_frames[idx].refs == 1) {
+        uint32_t pfn = dedup_frames[idx].pfn;
+        dedup_remove(idx);
+        map_frame(pfn, page, (*pte & 0xFFF) | PAGE_RW);
+        dedup_cow_reuses++;
+        return 0;
+    }
+
+    // Keep the clock off this page while we allocate
+    *pte |= PAGE_ACCESSED;
+    uint32_t copy = evict_alloc_frame();
+    if (!copy) {
+        return -1;
+    }
+    pte = paging_get_pte(page);
+    if (!pte || !(*pte & PAGE_PRESENT)) {
+        // Evicted after all; the retried write faults it back in
+        pmm_free_page(copy);
+        return 0;
+    }
+
+    uint32_t shared = paging_pte_pfn(pte);
+    memcpy((void *)copy, (const void *)page, PAGE_SIZE);
+    if (map_page(copy, page, (*pte & 0xFFF) | PAGE_RW) != 0) {
+        pmm_free_page(copy);
+        return -1;
+    }
+    if (dedup_frame_put(shared)) {
+        pmm_free_frame(shared);
+    }
+    dedup_cow_copies++;
+    return 0;
+}
+
+void dedup_print_stats(void)
+{
+    kprint("Merged frames:  ");
+    kprint_dec(dedup_frame_count);
+    kprint(" shared by ");
+    kprint_dec(dedup_saved_pages + dedup_frame_count);
+    kprint(" pages\n");
+
+    kprint("Pages merged:   ");
+    kprint_dec(dedup_saved_pages);
+    kprint(" (");
+    kprint_dec(dedup_saved_pages * (PAGE_SIZE / 1024));
+    kprint(" KB saved), ");
+    kprint_dec(dedup_merges);
+    kprint(" merges in ");
+    kprint_dec(dedup_scans);
+    kprint(" scans\n");
+
+    kprint("Copy-on-write:  ");
+    kprint_dec(dedup_cow_copies);
+    kprint(" copies, ");
+    kprint_dec(dedup_cow_reuses);
+    kprint(" reuses\n");
+}
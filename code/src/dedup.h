@@ -0,0 +1,35 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "paging.h" // For types
+
+/*
+   Same-page merging
+   dedup_scan() hashes every resident demand-paged page; pages with the
+   same contents are remapped read-only onto one frame and their own
+   frames freed. A write to a merged page faults (CR0.WP is set) and
+   dedup_cow_fault() gives the writer a private copy again. Swap slots
+   are deduplicated separately, at store time, in swap.c.
+*/
+
+/* Most merged frames tracked at once */
+#define DEDUP_MAX_SHARED 256
+
+/* Content hash of a 4KB page, used to find merge candidates */
+uint32_t dedup_page_hash(const uint8_t *page);
+
+/* Merge identical resident pages (shell: dedup) */
+void dedup_scan(void);
+
+/* Drop one mapping's reference to frame `pfn`. Returns 1 if the frame is
+   no longer mapped anywhere and may be freed (always, for unmerged frames). */
+int dedup_frame_put(uint32_t pfn);
+
+/* Resolve a write fault on a merged page. Returns 0, or -1 if virt_addr is
+   not a merged page (a genuine protection fault). */
+int dedup_cow_fault(uint32_t virt_addr);
+
+/* Print merge counters */
+void dedup_print_stats(void);
+
+#endif
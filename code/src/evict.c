@@ -0,0 +1,345 @@
+#include "evict.h"
+#include "pmm.h"
+#include "swap.h"
+#include "bench.h"
+#include "dedup.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+extern void kprint_hex(unsigned int val);
+
+/* Clock ring of demand-paged pages, by virtual address (the frame is read
+   from the PTE, so merging or copy-on-write can move it). Order only
+   matters to the hand, so an entry is removed by moving the last one
+   into its place. */
+static uint32_t resident[EVICT_MAX_RESIDENT];
+static uint32_t resident_count = 0;
+static uint32_t clock_hand     = 0;
+static uint32_t resident_limit = 0;
+
+/* Counters */
+static uint32_t evict_evictions  = 0;
+static uint32_t evict_writebacks = 0;   // dirty pages copied to swap
+static uint32_t evict_clean      = 0;   // dropped without a write
+static uint32_t evict_refaults   = 0;   // evicted pages faulted back in
+static uint32_t evict_scanned    = 0;   // pages visited by the hand
+static uint32_t evict_failures   = 0;
+
+/* Readahead state: the last window issued stays open until the next
+   fault, which checks the accessed bits of its pages */
+static uint32_t ra_last_fault = 0;
+static uint32_t ra_start      = 0;
+static uint32_t ra_count      = 0;
+static uint32_t ra_window     = 0;
+
+static uint32_t ra_windows    = 0;   // windows issued
+static uint32_t ra_pages      = 0;   // pages read ahead
+static uint32_t ra_hits       = 0;   // preloaded pages used (faults avoided)
+static uint32_t ra_misses     = 0;   // preloaded pages never touched
+
+static void resident_remove(uint32_t idx)
+{
+    resident_count--;
+    resident[idx] = resident[resident_count];
+    if (clock_hand >= resident_count) {
+        clock_hand = 0;
+    }
+}
+
+void evict_track(uint32_t virt_addr)
+{
+    swap_prepare();
+    if (swap_take_evicted(virt_addr)) {
+        evict_refaults++;
+    }
+    if (resident_count == EVICT_MAX_RESIDENT && evict_one() != 0) {
+        return; // Untracked: stays resident until unmapped
+    }
+    resident[resident_count++] = virt_addr;
+}
+
+int evict_one(void)
+{
+    /* Two sweeps are enough: the first clears every accessed bit */
+    uint32_t budget = resident_count * 2;
+
+    while (resident_count > 0 && budget-- > 0) {
+        uint32_t virt = resident[clock_hand];
+        uint32_t *pte = paging_get_pte(virt);
+        evict_scanned++;
+
+        // Unmapped behind our back: forget it
+        if (!pte || !(*pte & PAGE_PRESENT)) {
+            resident_remove(clock_hand);
+            continue;
+        }
+
+        // Second chance
+        if (paging_test_and_clear(virt, PAGE_ACCESSED)) {
+            clock_hand = (clock_hand + 1) % resident_count;
+            continue;
+        }
+
+        // Victim. Clean pages still match their swap copy. The page is
+        // read through its own mapping: the frame may be in high memory.
+        uint32_t pfn = paging_pte_pfn(pte);
+        if ((*pte & PAGE_DIRTY) || !swap_exists(virt)) {
+            if (swap_write(virt, virt) != 0) {
+                clock_hand = (clock_hand + 1) % resident_count;
+                continue; // No room in swap for this one
+            }
+            evict_writebacks++;
+        } else {
+            evict_clean++;
+        }
+
+        resident_remove(clock_hand);
+        unmap_page(virt);
+        // A merged frame stays until its last mapping goes
+        if (dedup_frame_put(pfn)) {
+            pmm_free_frame(pfn);
+        }
+        swap_mark_evicted(virt);
+        evict_evictions++;
+        return 0;
+    }
+
+    evict_failures++;
+    return -1;
+}
+
+/* Close the open window: every preloaded page that was touched is a
+   fault we did not take. Grow while the whole window gets used. */
+static void ra_retire(void)
+{
+    if (ra_count == 0) {
+        return;
+    }
+
+    uint32_t used = 0;
+    for (uint32_t i = 0; i < ra_count; i++) {
+        uint32_t *pte = paging_get_pte(ra_start + i * PAGE_SIZE);
+        if (pte && (*pte & PAGE_PRESENT) && (*pte & (PAGE_ACCESSED | PAGE_SOFT_ACCESSED))) {
+            used++;
+        }
+    }
+    ra_hits   += used;
+    ra_misses += ra_count - used;
+
+    if (used == ra_count) {
+        ra_window = ra_window * 2 > RA_MAX_PAGES ? RA_MAX_PAGES : ra_window * 2;
+    } else {
+        ra_window /= 2;
+    }
+    ra_count = 0;
+}
+
+void evict_readahead(uint32_t virt_addr)
+{
+    /* Sequential: right after the last fault, or right after the window
+       we preloaded for it */
+    int sequential = virt_addr == ra_last_fault + PAGE_SIZE ||
+                     (ra_count && virt_addr == ra_start + ra_count * PAGE_SIZE);
+
+    ra_retire();
+    ra_last_fault = virt_addr;
+
+    if (!sequential) {
+        ra_window /= 2;
+        return;
+    }
+    if (ra_window < RA_MIN_PAGES) {
+        ra_window = RA_MIN_PAGES;
+    }
+
+    // Read ahead until a page is not in swap or memory gets tight
+    uint32_t start = virt_addr + PAGE_SIZE;
+    uint32_t n = 0;
+    while (n < ra_window) {
+        uint32_t va = start + n * PAGE_SIZE;
+        uint32_t *pte = paging_get_pte(va);
+        if (va < start || (pte && (*pte & PAGE_PRESENT)) || !swap_exists(va)) {
+            break;
+        }
+        if (resident_count >= EVICT_MAX_RESIDENT ||
+            (resident_limit && resident_count >= resident_limit)) {
+            break;
+        }
+        int zero = swap_is_zero(va);
+        uint32_t phys = zero ? pmm_alloc_zeroed_page() : pmm_alloc_page();
+        if (!phys) {
+            break;
+        }
+        if (!zero) {
+            swap_read(va, phys);
+        }
+        if (map_page(phys, va, PAGE_PRESENT | PAGE_RW | PAGE_USER) != 0) {
+            pmm_free_page(phys);
+            break;
+        }
+        evict_track(va);
+        n++;
+    }
+
+    if (n) {
+        ra_start = start;
+        ra_count = n;
+        ra_windows++;
+        ra_pages += n;
+    }
+}
+
+uint32_t evict_resident_count(void)
+{
+    return resident_count;
+}
+
+uint32_t evict_resident_page(uint32_t i)
+{
+    return resident[i];
+}
+
+static uint32_t evict_alloc(uint32_t (*alloc)(void))
+{
+    if (resident_limit && resident_count >= resident_limit) {
+        evict_one();
+    }
+
+    uint32_t phys = alloc();
+    while (phys == 0 && evict_one() == 0) {
+        phys = alloc();
+    }
+    return phys;
+}
+
+uint32_t evict_alloc_frame(void)
+{
+    return evict_alloc(pmm_alloc_page);
+}
+
+uint32_t evict_alloc_zeroed_frame(void)
+{
+    return evict_alloc(pmm_alloc_zeroed_page);
+}
+
+uint32_t evict_alloc_high_frame(void)
+{
+    if (resident_limit && resident_count >= resident_limit) {
+        evict_one();
+    }
+    return pmm_alloc_high_frame();
+}
+
+void evict_set_limit(uint32_t pages)
+{
+    resident_limit = pages > EVICT_MAX_RESIDENT ? EVICT_MAX_RESIDENT : pages;
+    while (resident_limit && resident_count > resident_limit) {
+        if (evict_one() != 0) {
+            break;
+        }
+    }
+}
+
+void evict_print_stats(void)
+{
+    kprint("Resident pages: ");
+    kprint_dec(resident_count);
+    kprint(" (limit ");
+    if (resident_limit) {
+        kprint_dec(resident_limit);
+    } else {
+        kprint("none");
+    }
+    kprint(")\n");
+
+    kprint("Evictions:      ");
+    kprint_dec(evict_evictions);
+    kprint(" (");
+    kprint_dec(evict_clean);
+    kprint(" clean, ");
+    kprint_dec(evict_writebacks);
+    kprint(" dirty writebacks)\n");
+
+    kprint("Refaults:       ");
+    kprint_dec(evict_refaults);
+    kprint("\n");
+
+    kprint("Clock scanned:  ");
+    kprint_dec(evict_scanned);
+    kprint(" pages, ");
+    kprint_dec(evict_failures);
+    kprint(" failed scans\n");
+
+    kprint("Readahead:      ");
+    kprint_dec(ra_windows);
+    kprint(" windows, ");
+    kprint_dec(ra_pages);
+    kprint(" pages, window ");
+    kprint_dec(ra_window);
+    kprint("\n");
+
+    kprint("Faults avoided: ");
+    kprint_dec(ra_hits);
+    kprint(" (");
+    kprint_dec(ra_misses);
+    kprint(" unused, ");
+    if (ra_windows) {
+        uint32_t per10 = ra_hits * 10 / ra_windows;
+        kprint_dec(per10 / 10);
+        kprint(".");
+        kprint_dec(per10 % 10);
+    } else {
+        kprint("0");
+    }
+    kprint(" per window)\n");
+}
+
+void evict_selftest(uint32_t pages)
+{
+    uint32_t errors = 0;
+
+    for (uint32_t i = 0; i < pages; i++) {
+        uint32_t va = EVICT_TEST_BASE + i * PAGE_SIZE;
+        if (!swap_exists(va)) {
+            swap_test_store(va, "swaptest");
+            if (!swap_exists(va)) {
+                pages = i; // Swap full
+                break;
+            }
+        }
+    }
+
+    uint32_t refaults_before = evict_refaults;
+    uint32_t avoided_before  = ra_hits;
+    uint64_t start = bench_now();
+
+    // Pass 1: touch every page, dirty the even ones
+    for (uint32_t i = 0; i < pages; i++) {
+        volatile uint8_t *p = (volatile uint8_t *)(EVICT_TEST_BASE + i * PAGE_SIZE);
+        if (p[0] != 's') errors++;
+        if ((i & 1) == 0) p[100] = (uint8_t)i;
+    }
+
+    // Pass 2: verify, refaulting anything evicted in between
+    for (uint32_t i = 0; i < pages; i++) {
+        volatile uint8_t *p = (volatile uint8_t *)(EVICT_TEST_BASE + i * PAGE_SIZE);
+        if (p[0] != 's') errors++;
+        if ((i & 1) == 0 && p[100] != (uint8_t)i) errors++;
+    }
+
+    uint64_t cycles = bench_now() - start;
+    ra_retire();
+
+    kprint("swaptest: ");
+    kprint_dec(pages);
+    kprint(" pages at ");
+    kprint_hex(EVICT_TEST_BASE);
+    kprint(", ");
+    kprint_dec(errors);
+    kprint(" errors, ");
+    kprint_dec(evict_refaults - refaults_before);
+    kprint(" refaults, ");
+    kprint_dec(ra_hits - avoided_before);
+    kprint(" faults avoided\n");
+    bench_print_rate("Touches", pages * 2, cycles);
+}
@@ -0,0 +1,64 @@
+#ifndef EVICT_H
+#define EVICT_H
+
+#include "paging.h" // For types
+
+/*
+   Page Replacement (CLOCK / second chance)
+   Tracks frames that were demand-paged in from swap. When the PMM runs
+   dry, or the resident limit is reached, the clock hand sweeps the
+   tracked pages: a page with PAGE_ACCESSED set gets its bit cleared and
+   a second chance, the first page found with the bit clear is evicted.
+   Dirty pages (or pages with no swap copy) are written back first;
+   clean pages are simply dropped.
+*/
+
+/* Most demand-paged frames tracked at once */
+#define EVICT_MAX_RESIDENT 1024
+
+/* Base of the address range used by the swaptest command. It lies above
+   the direct map and below the vmalloc / bench windows. */
+#define EVICT_TEST_BASE    0xC0000000
+
+/* Allocate a frame for a page-in: evicts when the resident limit is hit
+   or the PMM is empty. Returns the physical address or 0. */
+uint32_t evict_alloc_frame(void);
+
+/* Same, for a frame that must start out zeroed (pre-zeroed pool first) */
+uint32_t evict_alloc_zeroed_frame(void);
+
+/* A high memory frame for a page-in, after applying the resident limit.
+   Returns the frame number, or 0 once high memory is used up (callers
+   then fall back to evict_alloc_frame()). */
+uint32_t evict_alloc_high_frame(void);
+
+/* Record a page that was just mapped from swap */
+void evict_track(uint32_t virt_addr);
+
+/* Number of tracked resident pages, and the virtual address of the i-th */
+uint32_t evict_resident_count(void);
+uint32_t evict_resident_page(uint32_t i);
+
+/* Evict one resident page. Returns 0, or -1 if nothing could be evicted. */
+int evict_one(void);
+
+/* Readahead window limits (pages). The window doubles while every
+   preloaded page gets used and halves on a miss or a non-sequential fault. */
+#define RA_MIN_PAGES       2
+#define RA_MAX_PAGES       32
+
+/* Called after a page-in at virt_addr: if faults look sequential, read and
+   map the following swapped pages in the same trap */
+void evict_readahead(uint32_t virt_addr);
+
+/* Cap the number of resident demand-paged pages (0 = only when the PMM is empty) */
+void evict_set_limit(uint32_t pages);
+
+/* Print eviction and readahead counters (shell: vmstat) */
+void evict_print_stats(void);
+
+/* Fault in `pages` swap-backed pages twice, dirtying every other page
+   (shell: swaptest) */
+void evict_selftest(uint32_t pages);
+
+#endif
@@ -2,14 +2,52 @@
 // MOKernel In-Memory Filesystem Implementation
 // ============================================================
 #include "fs.h"
+#include "slab.h"
+#include "kstring.h"
+#include "config.h"
+#include "bench.h"
+#include "pmm.h"
+#include "evict.h"
 
 extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
 extern int  strcmp (const char *s1, const char *s2);
 extern int  strncmp(const char *s1, const char *s2, int n);
 
 // --------------- Globals -------------------------------------
-fs_entry_t fs_table[FS_MAX_ENTRIES];
-int        fs_cwd = FS_ROOT_IDX;
+fs_entry_t **fs_table      = 0;
+int          fs_table_size = 0;
+int          fs_cwd        = FS_ROOT_IDX;
+
+static kmem_cache_t *fs_inode_cache = 0;
+static int           fs_free_hint   = 0;   // no free slot below this index
+static int           fs_inode_count = 0;   // slots in use
+
+// Open files: inode FS_NULL_IDX marks a free slot
+typedef struct {
+    int          inode;
+    unsigned int offset;
+    int          flags;
+} fs_fd_t;
+
+static fs_fd_t fs_fds[FS_MAX_FDS];
+
+// File mappings: start 0 marks a free slot
+typedef struct {
+    unsigned int start;
+    unsigned int pages;
+    int          inode;
+    int          flags;
+} fs_map_t;
+
+static fs_map_t fs_maps[FS_MAX_MAPS];
+static uint32_t fs_map_faults     = 0;
+static uint32_t fs_map_copies     = 0;   // pages copied for writable maps
+static uint32_t fs_map_writebacks = 0;
+
+// Files with borrowed contents, and how many got copied by a write
+static uint32_t fs_ro_files  = 0;
+static uint32_t fs_ro_copies = 0;
 
 // --------------- Local helpers -------------------------------
 
@@ -19,157 +57,615 @@ static void fs_strncpy(char *dst, const char *src, int max) {
     dst[i] = '\0';
 }
 
-// Find an inode by name inside a given parent directory.
-// If parent == FS_NULL_IDX, searches only the root entry.
-static int fs_find_in(const char *name, int parent_idx) {
-    for (int i = 0; i < FS_MAX_ENTRIES; i++) {
-        if (fs_table[i].type   == FS_TYPE_NONE) continue;
-        if (fs_table[i].parent != parent_idx)   continue;
-        if (strcmp(fs_table[i].name, name) == 0) return i;
+// Slab constructor: inodes start out (and are freed) empty. Names are
+// always NUL terminated, so only the first byte needs clearing; extents
+// past ext_count are never looked at.
+static void fs_inode_ctor(void *obj) {
+    fs_entry_t *e = (fs_entry_t *)obj;
+    e->type   = FS_TYPE_NONE;
+    e->size   = 0;
+    e->parent = FS_NULL_IDX;
+    e->name[0] = '\0';
+
+    e->hash         = 0;
+    e->hash_next    = FS_NULL_IDX;
+    e->next_sibling = FS_NULL_IDX;
+    e->prev_sibling = FS_NULL_IDX;
+    e->first_child  = FS_NULL_IDX;
+    e->last_child   = FS_NULL_IDX;
+    e->child_count  = 0;
+    e->hash_buckets = 0;
+    e->child_hash   = 0;
+
+    e->ext_more     = 0;
+    e->ext_count    = 0;
+    e->ext_more_cap = 0;
+    e->capacity     = 0;
+    e->open_count   = 0;
+    e->map_count    = 0;
+    e->ro_data      = 0;
+}
+
+// FNV-1a over the (already truncated) name.
+static unsigned int fs_hash(const char *name) {
+    unsigned int h = 2166136261u;
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Find an inode by name (hashing to `h`) inside a given parent
+// directory: one bucket of the directory's hash index. A directory whose
+// index could not be allocated falls back to walking its children list.
+static int fs_find_hashed(const char *name, unsigned int h, int parent_idx) {
+    if (parent_idx == FS_NULL_IDX || !fs_table[parent_idx]) return FS_NULL_IDX;
+
+    fs_entry_t *dir = fs_table[parent_idx];
+    int i = dir->hash_buckets ? dir->child_hash[h & (dir->hash_buckets - 1)]
+                              : dir->first_child;
+    while (i != FS_NULL_IDX) {
+        fs_entry_t *e = fs_table[i];
+        if (e->hash == h && strcmp(e->name, name) == 0) return i;
+        i = dir->hash_buckets ? e->hash_next : e->next_sibling;
     }
     return FS_NULL_IDX;
 }
 
-// Allocate a free inode slot.
+static int fs_find_in(const char *name, int parent_idx) {
+    return fs_find_hashed(name, fs_hash(name), parent_idx);
+}
+
+// ---- Dentry cache -------------------------------------------
+// Recently resolved path components: (directory, name) -> inode, or
+// FS_NULL_IDX for a name known to be absent (negative entry). Direct
+// mapped. fs_link() and fs_unlink() drop the slot of the name they
+// change, so a cached answer is never stale.
+typedef struct {
+    int          parent;                     // FS_NULL_IDX: empty slot
+    int          inode;                      // FS_NULL_IDX: negative entry
+    unsigned int hash;
+    char         name[FS_MAX_NAME_LEN + 1];
+} fs_dentry_t;
+
+static fs_dentry_t *fs_dcache = 0;           // FS_DCACHE_SIZE slots, allocated by fs_init()
+static uint32_t     fs_dcache_hits      = 0;
+static uint32_t     fs_dcache_neg_hits  = 0;
+static uint32_t     fs_dcache_misses    = 0;
+static uint32_t     fs_dcache_drops     = 0;
+
+static fs_dentry_t *fs_dcache_slot(int parent, unsigned int h) {
+    unsigned int k = (h ^ (unsigned int)parent * 0x9E3779B1u) * 0x9E3779B1u;
+    return &fs_dcache[k >> (32 - FS_DCACHE_BITS)];
+}
+
+static int fs_dentry_match(fs_dentry_t *d, int parent, const char *name, unsigned int h) {
+    return d->parent == parent && d->hash == h && strcmp(d->name, name) == 0;
+}
+
+// Forget whatever is cached for `name` in `parent`.
+static void fs_dcache_drop(int parent, const char *name, unsigned int h) {
+    if (!fs_dcache) return;
+    fs_dentry_t *d = fs_dcache_slot(parent, h);
+    if (fs_dentry_match(d, parent, name, h)) {
+        d->parent = FS_NULL_IDX;
+        fs_dcache_drops++;
+    }
+}
+
+// Child `name` of directory `parent` through the dentry cache.
+static int fs_lookup_child(int parent, const char *name) {
+    unsigned int h = fs_hash(name);
+    fs_dentry_t *d = fs_dcache ? fs_dcache_slot(parent, h) : 0;
+    if (d && fs_dentry_match(d, parent, name, h)) {
+        if (d->inode == FS_NULL_IDX) fs_dcache_neg_hits++;
+        else                         fs_dcache_hits++;
+        return d->inode;
+    }
+
+    int idx = fs_find_hashed(name, h, parent);
+    fs_dcache_misses++;
+    if (d) {
+        d->parent = parent;
+        d->inode  = idx;
+        d->hash   = h;
+        fs_strncpy(d->name, name, FS_MAX_NAME_LEN);
+    }
+    return idx;
+}
+
+// Rebuild a directory's hash index with `buckets` buckets from its
+// children list. On allocation failure the old index stays (lookups get
+// slower, never wrong).
+static void fs_rehash(fs_entry_t *dir, int buckets) {
+    int *t = (int *)kmalloc(buckets * sizeof(int));
+    if (!t) return;
+
+    for (int b = 0; b < buckets; b++) t[b] = FS_NULL_IDX;
+    for (int i = dir->first_child; i != FS_NULL_IDX; i = fs_table[i]->next_sibling) {
+        fs_entry_t *e = fs_table[i];
+        int b = e->hash & (buckets - 1);
+        e->hash_next = t[b];
+        t[b] = i;
+    }
+    kfree(dir->child_hash);
+    dir->child_hash   = t;
+    dir->hash_buckets = buckets;
+}
+
+// Add inode `idx` to directory `parent`: append to the children list,
+// then index it (doubling the index past one child per bucket).
+static void fs_link(int idx, int parent) {
+    fs_entry_t *dir = fs_table[parent];
+    fs_entry_t *e   = fs_table[idx];
+
+    e->parent       = parent;
+    e->hash         = fs_hash(e->name);
+    fs_dcache_drop(parent, e->name, e->hash);   // may be cached as absent
+    e->next_sibling = FS_NULL_IDX;
+    e->prev_sibling = dir->last_child;
+    if (dir->last_child != FS_NULL_IDX) fs_table[dir->last_child]->next_sibling = idx;
+    else                                dir->first_child = idx;
+    dir->last_child = idx;
+    dir->child_count++;
+
+    if (dir->child_count > dir->hash_buckets) {
+        int buckets = dir->hash_buckets ? dir->hash_buckets * 2 : FS_HASH_MIN_BUCKETS;
+        fs_rehash(dir, buckets);   // indexes every child, `idx` included
+        if (dir->hash_buckets >= buckets) return;
+    }
+    if (dir->hash_buckets) {
+        int b = e->hash & (dir->hash_buckets - 1);
+        e->hash_next = dir->child_hash[b];
+        dir->child_hash[b] = idx;
+    }
+}
+
+// Remove inode `idx` from its parent's children list and index.
+static void fs_unlink(int idx) {
+    fs_entry_t *e = fs_table[idx];
+    if (e->parent == FS_NULL_IDX) return;
+    fs_entry_t *dir = fs_table[e->parent];
+    fs_dcache_drop(e->parent, e->name, e->hash);
+
+    if (e->prev_sibling != FS_NULL_IDX) fs_table[e->prev_sibling]->next_sibling = e->next_sibling;
+    else                                dir->first_child = e->next_sibling;
+    if (e->next_sibling != FS_NULL_IDX) fs_table[e->next_sibling]->prev_sibling = e->prev_sibling;
+    else                                dir->last_child = e->prev_sibling;
+    dir->child_count--;
+
+    if (dir->hash_buckets) {
+        int *link = &dir->child_hash[e->hash & (dir->hash_buckets - 1)];
+        while (*link != idx) link = &fs_table[*link]->hash_next;
+        *link = e->hash_next;
+    }
+    e->parent = FS_NULL_IDX;
+}
+
+// Double the inode table. Returns 0 on success.
+static int fs_grow(void) {
+    int new_size = fs_table_size ? fs_table_size * 2
+                                 : (int)config_get("fs_entries", FS_INITIAL_ENTRIES);
+    if (new_size < 1) new_size = 1;
+    fs_entry_t **t = (fs_entry_t **)kmalloc(new_size * sizeof(fs_entry_t *));
+    if (!t) return -1;
+
+    memcpy(t, fs_table, fs_table_size * sizeof(fs_entry_t *));
+    memset(t + fs_table_size, 0, (new_size - fs_table_size) * sizeof(fs_entry_t *));
+    kfree(fs_table);
+    fs_table      = t;
+    fs_table_size = new_size;
+    return 0;
+}
+
+// Allocate a free inode slot, growing the table if it is full.
 static int fs_alloc(void) {
-    for (int i = 0; i < FS_MAX_ENTRIES; i++) {
-        if (fs_table[i].type == FS_TYPE_NONE) return i;
+    if (!fs_inode_cache) return FS_NULL_IDX;
+
+    int i = fs_free_hint;
+    while (i < fs_table_size && fs_table[i]) i++;
+    if (i == fs_table_size && fs_grow() != 0) return FS_NULL_IDX;
+
+    fs_entry_t *e = (fs_entry_t *)kmem_cache_alloc(fs_inode_cache);
+    if (!e) return FS_NULL_IDX;
+
+    fs_table[i]  = e;
+    fs_free_hint = i + 1;
+    fs_inode_count++;
+    return i;
+}
+
+// ---- Extents ------------------------------------------------
+
+static fs_extent_t *fs_extent(fs_entry_t *e, int i) {
+    return i < FS_INLINE_EXTENTS ? &e->ext[i] : &e->ext_more[i - FS_INLINE_EXTENTS];
+}
+
+// Add extents until the file can hold `need` bytes. Each new extent is
+// sized to what is missing but at least doubles the capacity, up to
+// FS_EXTENT_MAX_ORDER, and falls back to smaller blocks when the PMM is
+// fragmented.
+// Returns 0, or -1 when memory runs out. A failed call gives back the
+// extents it added, so a write far past the end cannot pin all memory.
+static int fs_extend(fs_entry_t *e, unsigned int need) {
+    int old_count = e->ext_count;
+    while (e->capacity < need) {
+        if (e->ext_count >= FS_INLINE_EXTENTS + e->ext_more_cap) {
+            int cap = e->ext_more_cap ? e->ext_more_cap * 2 : FS_INLINE_EXTENTS;
+            fs_extent_t *t = (fs_extent_t *)kmalloc(cap * sizeof(fs_extent_t));
+            if (!t) break;
+            memcpy(t, e->ext_more, e->ext_more_cap * sizeof(fs_extent_t));
+            kfree(e->ext_more);
+            e->ext_more     = t;
+            e->ext_more_cap = cap;
+        }
+
+        unsigned int pages = (need - e->capacity + PAGE_SIZE - 1) / PAGE_SIZE;
+        unsigned int grow  = e->capacity / PAGE_SIZE;
+        if (pages < grow) pages = grow;
+        unsigned int order = 0;
+        while (order < FS_EXTENT_MAX_ORDER && (1u << order) < pages) order++;
+
+        unsigned int phys = pmm_alloc_pages(order);
+        while (!phys && order > 0) phys = pmm_alloc_pages(--order);
+        if (!phys) break;
+
+        fs_extent_t *x = fs_extent(e, e->ext_count++);
+        x->phys  = phys;
+        x->order = order;
+        e->capacity += PAGE_SIZE << order;
     }
-    return FS_NULL_IDX;
+    if (e->capacity >= need) return 0;
+
+    while (e->ext_count > old_count) {
+        fs_extent_t *x = fs_extent(e, --e->ext_count);
+        pmm_free_pages(x->phys, x->order);
+        e->capacity -= PAGE_SIZE << x->order;
+    }
+    return -1;
+}
+
+// Drop all data. A mapped file keeps its extents (the mappings point
+// into them) and only loses its size.
+static void fs_truncate(fs_entry_t *e) {
+    e->ro_data = 0;
+    if (e->map_count) {
+        e->size = 0;
+        return;
+    }
+    for (int i = 0; i < e->ext_count; i++) {
+        fs_extent_t *x = fs_extent(e, i);
+        pmm_free_pages(x->phys, x->order);
+    }
+    kfree(e->ext_more);
+    e->ext_more     = 0;
+    e->ext_more_cap = 0;
+    e->ext_count    = 0;
+    e->capacity     = 0;
+    e->size         = 0;
+}
+
+// Copy `len` bytes at offset `off` of the file's extents to `out` (if
+// set) or from `in` (if set, else zeros). The range must be within
+// capacity.
+static void fs_extent_copy(fs_entry_t *e, unsigned int off, void *out,
+                           const void *in, unsigned int len) {
+    int i = 0;
+    unsigned int base = 0;
+    while (len) {
+        fs_extent_t *x = fs_extent(e, i);
+        unsigned int ext_len = PAGE_SIZE << x->order;
+        if (off >= base + ext_len) {
+            base += ext_len;
+            i++;
+            continue;
+        }
+        unsigned int n = base + ext_len - off;
+        if (n > len) n = len;
+        char *data = (char *)x->phys + (off - base);
+        if (out)     memcpy(out, data, n), out = (char *)out + n;
+        else if (in) memcpy(data, in, n),  in  = (const char *)in + n;
+        else         memset(data, 0, n);
+        off += n;
+        len -= n;
+    }
+}
+
+// Give a file with borrowed contents its own extents. Returns 0, or -1
+// when memory runs out (the file keeps its borrowed contents).
+static int fs_unshare(fs_entry_t *e) {
+    if (!e->ro_data) return 0;
+    if (fs_extend(e, e->size) != 0) return -1;
+    fs_extent_copy(e, 0, 0, e->ro_data, e->size);
+    e->ro_data = 0;
+    fs_ro_copies++;
+    return 0;
+}
+
+// Write `len` bytes at `off`, extending the file (a gap past the old end
+// reads as zeros). Returns bytes written: short when memory runs out.
+static unsigned int fs_file_write(fs_entry_t *e, unsigned int off,
+                                  const void *buf, unsigned int len) {
+    if (fs_unshare(e) != 0) return 0;
+    if (fs_extend(e, off + len) != 0) {
+        if (e->capacity <= off) return 0;
+        len = e->capacity - off;
+    }
+    if (off > (unsigned int)e->size) {
+        fs_extent_copy(e, e->size, 0, 0, off - e->size);
+    }
+    fs_extent_copy(e, off, 0, buf, len);
+    if (off + len > (unsigned int)e->size) e->size = off + len;
+    return len;
+}
+
+// Read up to `len` bytes at `off`. Returns bytes read (0 at end of file).
+static unsigned int fs_file_read(fs_entry_t *e, unsigned int off,
+                                 void *buf, unsigned int len) {
+    if (off >= (unsigned int)e->size) return 0;
+    if (len > e->size - off) len = e->size - off;
+    if (e->ro_data) memcpy(buf, e->ro_data + off, len);
+    else            fs_extent_copy(e, off, buf, 0, len);
+    return len;
+}
+
+// Return an inode to the slab. Contents are cleared so the object goes
+// back in its constructed state.
+static void fs_free(int idx) {
+    fs_entry_t *e = fs_table[idx];
+    fs_unlink(idx);
+    fs_truncate(e);
+    kfree(e->child_hash);
+    fs_inode_ctor(e);
+
+    kmem_cache_free(fs_inode_cache, e);
+    fs_table[idx] = 0;
+    fs_inode_count--;
+    if (idx < fs_free_hint) fs_free_hint = idx;
 }
 
 // Print the full path of an inode recursively.
 static void fs_print_path(int idx) {
-    if (idx == FS_ROOT_IDX) {
+    if (idx == FS_ROOT_IDX || idx == FS_NULL_IDX) {
         kprint("/");
         return;
     }
-    // Walk up to root, collect indices
-    int stack[FS_MAX_ENTRIES];
-    int depth = 0;
-    int cur   = idx;
-    while (cur != FS_ROOT_IDX && cur != FS_NULL_IDX) {
-        stack[depth++] = cur;
-        cur = fs_table[cur].parent;
-    }
-    // Print from root down
-    for (int i = depth - 1; i >= 0; i--) {
-        kprint("/");
-        kprint(fs_table[stack[i]].name);
+    int parent = fs_table[idx]->parent;
+    if (parent != FS_ROOT_IDX && parent != FS_NULL_IDX) {
+        fs_print_path(parent);
     }
+    kprint("/");
+    kprint(fs_table[idx]->name);
 }
 
 // Does `dir_idx` have any children?
 static int fs_dir_empty(int dir_idx) {
-    for (int i = 0; i < FS_MAX_ENTRIES; i++) {
-        if (fs_table[i].type != FS_TYPE_NONE &&
-            fs_table[i].parent == dir_idx) return 0;
-    }
-    return 1;
+    return fs_table[dir_idx]->child_count == 0;
+}
+
+// Create an empty inode of `type` called `name` in directory `parent`.
+// Callers have checked the name is free. Returns FS_NULL_IDX when full.
+static int fs_create_in(const char *name, int parent, int type) {
+    int slot = fs_alloc();
+    if (slot == FS_NULL_IDX) return FS_NULL_IDX;
+
+    fs_table[slot]->type = type;
+    fs_table[slot]->size = 0;
+    fs_strncpy(fs_table[slot]->name, name, FS_MAX_NAME_LEN);
+    fs_link(slot, parent);
+    return slot;
 }
 
-// ---- Resolve a name relative to cwd:
-//   ".."  -> parent of cwd
-//   "."   -> cwd
-//   else  -> child named `name` in cwd
-// Returns inode index or FS_NULL_IDX.
-static int fs_resolve_dir(const char *name) {
-    if (strcmp(name, ".") == 0) return fs_cwd;
+// ---- Paths ------------------------------------------------
+// Absolute ("/a/b") or relative to cwd ("../c/file"). Repeated slashes
+// are ignored, "." stays put and ".." at root stays at root. Every
+// component costs one dentry cache probe when it hits.
+
+// Cached "/..." path of cwd for pwd; empty when it does not fit
+static char fs_cwd_path[FS_MAX_PATH] = "/";
+
+// Step from directory `dir` through one component.
+static int fs_step(int dir, const char *name) {
+    if (fs_table[dir]->type != FS_TYPE_DIR) return FS_NULL_IDX;
+    if (strcmp(name, ".") == 0) return dir;
     if (strcmp(name, "..") == 0) {
-        if (fs_table[fs_cwd].parent == FS_NULL_IDX) return FS_ROOT_IDX;
-        return fs_table[fs_cwd].parent;
+        return fs_table[dir]->parent == FS_NULL_IDX ? FS_ROOT_IDX : fs_table[dir]->parent;
     }
-    return fs_find_in(name, fs_cwd);
+    return fs_lookup_child(dir, name);
 }
 
-// ============================================================
-// Public API
-// ============================================================
+// Resolve the components in [p, end) starting from `dir`. With `create`
+// missing components become directories.
+static int fs_walk(int dir, const char *p, const char *end, int create) {
+    char name[FS_MAX_NAME_LEN + 1];
+    while (p < end) {
+        if (*p == '/') { p++; continue; }
+        int len = 0;
+        while (p + len < end && p[len] != '/') len++;
+        if (len > FS_MAX_NAME_LEN) return FS_NULL_IDX;   // no such name can exist
+        memcpy(name, p, len);
+        name[len] = '\0';
+        p += len;
 
-void fs_init(void) {
-    for (int i = 0; i < FS_MAX_ENTRIES; i++) {
-        fs_table[i].type    = FS_TYPE_NONE;
-        fs_table[i].size    = 0;
-        fs_table[i].parent  = FS_NULL_IDX;
-        for (int j = 0; j <= FS_MAX_NAME_LEN; j++) fs_table[i].name[j] = 0;
-        for (int j = 0; j <  FS_MAX_FILE_SIZE; j++) fs_table[i].content[j] = 0;
+        int next = fs_step(dir, name);
+        if (next == FS_NULL_IDX && create && fs_table[dir]->type == FS_TYPE_DIR) {
+            next = fs_create_in(name, dir, FS_TYPE_DIR);
+        }
+        if (next == FS_NULL_IDX) return FS_NULL_IDX;
+        dir = next;
     }
+    return dir;
+}
 
-    // Create root directory at index 0
-    fs_table[FS_ROOT_IDX].type   = FS_TYPE_DIR;
-    fs_table[FS_ROOT_IDX].parent = FS_NULL_IDX;
-    fs_table[FS_ROOT_IDX].name[0] = '\0'; // root has empty name — printed as "/"
-    fs_cwd = FS_ROOT_IDX;
+static int fs_walk_start(const char *path) {
+    return path[0] == '/' ? FS_ROOT_IDX : fs_cwd;
 }
 
-// ---- mkdir --------------------------------------------------
-int fs_mkdir(const char *name) {
-    // Validate name
-    if (!name || name[0] == '\0') { kprint("mkdir: invalid name\n"); return -1; }
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
-        kprint("mkdir: cannot use '.' or '..'\n"); return -1;
+// Resolve a whole path. Returns inode index or FS_NULL_IDX.
+static int fs_lookup(const char *path) {
+    const char *end = path;
+    while (*end) end++;
+    return fs_walk(fs_walk_start(path), path, end, 0);
+}
+
+// Resolve all but the last component, which is copied to `leaf`
+// (truncated to FS_MAX_NAME_LEN, as names are at creation; empty for
+// "/"). Returns the directory to create it in, or FS_NULL_IDX. With
+// `create` missing parents are made.
+static int fs_lookup_parent(const char *path, char *leaf, int create) {
+    const char *end = path;
+    while (*end) end++;
+    while (end > path && end[-1] == '/') end--;
+    const char *start = end;
+    while (start > path && start[-1] != '/') start--;
+
+    int len = end - start;
+    if (len > FS_MAX_NAME_LEN) len = FS_MAX_NAME_LEN;
+    memcpy(leaf, start, len);
+    leaf[len] = '\0';
+
+    int dir = fs_walk(fs_walk_start(path), path, start, create);
+    if (dir == FS_NULL_IDX || fs_table[dir]->type != FS_TYPE_DIR) return FS_NULL_IDX;
+    return dir;
+}
+
+// Write the path of `idx` to buf. Returns -1 if it needs more than `size` bytes.
+static int fs_build_path(int idx, char *buf, int size) {
+    int pos = size - 1;
+    buf[pos] = '\0';
+    for (; idx != FS_ROOT_IDX && idx != FS_NULL_IDX; idx = fs_table[idx]->parent) {
+        int len = 0;
+        while (fs_table[idx]->name[len]) len++;
+        pos -= len + 1;
+        if (pos < 0) return -1;
+        buf[pos] = '/';
+        memcpy(buf + pos + 1, fs_table[idx]->name, len);
     }
+    if (pos == size - 1) buf[--pos] = '/';
+    for (int i = 0; pos + i < size; i++) buf[i] = buf[pos + i];   // may overlap
+    return 0;
+}
+
+// Make `dir` the cwd.
+static void fs_set_cwd(int dir) {
+    fs_cwd = dir;
+    if (fs_build_path(dir, fs_cwd_path, FS_MAX_PATH) != 0) fs_cwd_path[0] = '\0';
+}
 
-    // Duplicate check in cwd
-    if (fs_find_in(name, fs_cwd) != FS_NULL_IDX) {
-        kprint("mkdir: '"); kprint(name); kprint("' already exists\n");
+// Validate the last component of a path for mkdir/touch.
+static int fs_check_leaf(const char *cmd, const char *leaf) {
+    if (leaf[0] == '\0') {
+        kprint(cmd); kprint(": invalid name\n");
+        return -1;
+    }
+    if (strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
+        kprint(cmd); kprint(": cannot use '.' or '..'\n");
         return -1;
     }
+    return 0;
+}
 
-    int slot = fs_alloc();
-    if (slot == FS_NULL_IDX) { kprint("mkdir: filesystem full\n"); return -1; }
+static void fs_no_such(const char *cmd, const char *path, const char *what) {
+    kprint(cmd); kprint(": '"); kprint(path); kprint("': no such "); kprint(what); kprint("\n");
+}
+
+// Create `path` as a `type` inode for mkdir/touch.
+static int fs_create_path(const char *cmd, const char *path, int type) {
+    char leaf[FS_MAX_NAME_LEN + 1];
+    if (!path) path = "";
+    int dir = fs_lookup_parent(path, leaf, 0);
+    if (fs_check_leaf(cmd, leaf) != 0) return -1;
+    if (dir == FS_NULL_IDX) {
+        fs_no_such(cmd, path, "directory");
+        return -1;
+    }
+    if (fs_lookup_child(dir, leaf) != FS_NULL_IDX) {
+        kprint(cmd); kprint(": '"); kprint(path); kprint("' already exists\n");
+        return -1;
+    }
 
-    fs_table[slot].type   = FS_TYPE_DIR;
-    fs_table[slot].parent = fs_cwd;
-    fs_table[slot].size   = 0;
-    fs_strncpy(fs_table[slot].name, name, FS_MAX_NAME_LEN);
+    int slot = fs_create_in(leaf, dir, type);
+    if (slot == FS_NULL_IDX) { kprint(cmd); kprint(": filesystem full\n"); return -1; }
     return slot;
 }
 
-// ---- cd -----------------------------------------------------
-int fs_cd(const char *name) {
-    if (!name || name[0] == '\0') { kprint("cd: missing argument\n"); return -1; }
+// ============================================================
+// Public API
+// ============================================================
 
-    // "/" always goes to root
-    if (name[0] == '/' && name[1] == '\0') { fs_cwd = FS_ROOT_IDX; return 0; }
+void fs_init(void) {
+    for (int fd = 0; fd < FS_MAX_FDS; fd++) fs_fds[fd].inode = FS_NULL_IDX;
+    if (!fs_inode_cache) {
+        fs_inode_cache = kmem_cache_create("fs_inode", sizeof(fs_entry_t), fs_inode_ctor);
+    }
+    if (!fs_table && fs_grow() != 0) {
+        kprint("[FS] out of memory\n");
+        return;
+    }
 
-    int target = fs_resolve_dir(name);
+    // Create root directory at index 0
+    int root = fs_alloc();
+    if (root != FS_ROOT_IDX) {
+        kprint("[FS] cannot allocate root inode\n");
+        return;
+    }
+    fs_table[FS_ROOT_IDX]->type   = FS_TYPE_DIR;
+    fs_table[FS_ROOT_IDX]->parent = FS_NULL_IDX;
+    fs_table[FS_ROOT_IDX]->name[0] = '\0'; // root has empty name — printed as "/"
+    fs_set_cwd(FS_ROOT_IDX);
 
-    // Handle ".." at root — stay at root
-    if (strcmp(name, "..") == 0 && fs_table[fs_cwd].parent == FS_NULL_IDX) {
-        fs_cwd = FS_ROOT_IDX;
-        return 0;
+    if (!fs_dcache) {
+        fs_dcache = (fs_dentry_t *)kmalloc(FS_DCACHE_SIZE * sizeof(fs_dentry_t));
+    }
+    for (int i = 0; fs_dcache && i < FS_DCACHE_SIZE; i++) {
+        fs_dcache[i].parent = FS_NULL_IDX;
     }
+}
+
+// ---- mkdir --------------------------------------------------
+int fs_mkdir(const char *path) {
+    return fs_create_path("mkdir", path, FS_TYPE_DIR);
+}
+
+// ---- cd -----------------------------------------------------
+int fs_cd(const char *path) {
+    if (!path || path[0] == '\0') { kprint("cd: missing argument\n"); return -1; }
 
+    int target = fs_lookup(path);
     if (target == FS_NULL_IDX) {
-        kprint("cd: '"); kprint(name); kprint("': no such directory\n");
+        fs_no_such("cd", path, "directory");
         return -1;
     }
-    if (fs_table[target].type != FS_TYPE_DIR) {
-        kprint("cd: '"); kprint(name); kprint("': not a directory\n");
+    if (fs_table[target]->type != FS_TYPE_DIR) {
+        kprint("cd: '"); kprint(path); kprint("': not a directory\n");
         return -1;
     }
-    fs_cwd = target;
+    fs_set_cwd(target);
     return 0;
 }
 
 // ---- pwd ----------------------------------------------------
 void fs_pwd(void) {
-    fs_print_path(fs_cwd);
+    if (fs_cwd_path[0]) kprint(fs_cwd_path);
+    else                fs_print_path(fs_cwd);
     kprint("\n");
 }
 
 // ---- ls -----------------------------------------------------
-void fs_list_files(void) {
+void fs_list_files(const char *path) {
+    int dir = (path && path[0]) ? fs_lookup(path) : fs_cwd;
+    if (dir == FS_NULL_IDX || fs_table[dir]->type != FS_TYPE_DIR) {
+        fs_no_such("ls", path, "directory");
+        return;
+    }
+
     int count = 0;
-    for (int i = 0; i < FS_MAX_ENTRIES; i++) {
-        if (fs_table[i].type == FS_TYPE_NONE) continue;
-        if (fs_table[i].parent != fs_cwd)     continue;
-        // skip root's self-reference
-        if (fs_table[i].type == FS_TYPE_DIR) {
-            kprint("[DIR]  "); kprint(fs_table[i].name); kprint("\n");
+    for (int i = fs_table[dir]->first_child; i != FS_NULL_IDX; i = fs_table[i]->next_sibling) {
+        if (fs_table[i]->type == FS_TYPE_DIR) {
+            kprint("[DIR]  "); kprint(fs_table[i]->name); kprint("\n");
         } else {
-            kprint("[FILE] "); kprint(fs_table[i].name); kprint("\n");
+            kprint("[FILE] "); kprint(fs_table[i]->name); kprint("\n");
         }
         count++;
     }
@@ -177,75 +673,695 @@ void fs_list_files(void) {
 }
 
 // ---- touch --------------------------------------------------
-int fs_create_file(const char *name) {
-    if (!name || name[0] == '\0') { kprint("touch: invalid name\n"); return -1; }
-
-    if (fs_find_in(name, fs_cwd) != FS_NULL_IDX) {
-        kprint("touch: '"); kprint(name); kprint("' already exists\n");
-        return -1;
-    }
-
-    int slot = fs_alloc();
-    if (slot == FS_NULL_IDX) { kprint("touch: filesystem full\n"); return -1; }
-
-    fs_table[slot].type   = FS_TYPE_FILE;
-    fs_table[slot].parent = fs_cwd;
-    fs_table[slot].size   = 0;
-    fs_strncpy(fs_table[slot].name, name, FS_MAX_NAME_LEN);
-    return slot;
+int fs_create_file(const char *path) {
+    return fs_create_path("touch", path, FS_TYPE_FILE);
 }
 
-// ---- write --------------------------------------------------
-void fs_write_file(const char *name, const char *data) {
-    int idx = fs_find_in(name, fs_cwd);
-    if (idx == FS_NULL_IDX || fs_table[idx].type != FS_TYPE_FILE) {
-        kprint("write: '"); kprint(name); kprint("': no such file\n");
+// ---- write / append ----------------------------------------
+static void fs_put_file(const char *cmd, const char *name, const char *data, int flags) {
+    int fd = fs_open(name, FS_O_WRONLY | flags);
+    if (fd < 0) {
+        kprint(cmd); kprint(": '"); kprint(name); kprint("': no such file\n");
         return;
     }
-    int j = 0;
-    while (data[j] != '\0' && j < FS_MAX_FILE_SIZE - 1) {
-        fs_table[idx].content[j] = data[j]; j++;
+    unsigned int len = 0;
+    while (data[len] != '\0') len++;
+    if (fs_write(fd, data, len) != (int)len) {
+        kprint(cmd); kprint(": out of memory\n");
     }
-    fs_table[idx].content[j] = '\0';
-    fs_table[idx].size = j;
+    fs_close(fd);
+}
+
+void fs_write_file(const char *name, const char *data) {
+    fs_put_file("write", name, data, FS_O_TRUNC);
+}
+
+void fs_append_file(const char *name, const char *data) {
+    fs_put_file("append", name, data, FS_O_APPEND);
 }
 
 // ---- cat ----------------------------------------------------
 void fs_read_file(const char *name) {
-    int idx = fs_find_in(name, fs_cwd);
-    if (idx == FS_NULL_IDX || fs_table[idx].type != FS_TYPE_FILE) {
+    int fd = fs_open(name, FS_O_RDONLY);
+    if (fd < 0) {
         kprint("cat: '"); kprint(name); kprint("': no such file\n");
         return;
     }
-    kprint(fs_table[idx].content);
+    char buf[64];
+    int  n;
+    while ((n = fs_read(fd, buf, sizeof(buf) - 1)) > 0) {
+        buf[n] = '\0';
+        kprint(buf);
+    }
     kprint("\n");
+    fs_close(fd);
+}
+
+// ---- file descriptors ---------------------------------------
+static fs_fd_t *fs_fd_get(int fd) {
+    if (fd < 0 || fd >= FS_MAX_FDS || fs_fds[fd].inode == FS_NULL_IDX) return 0;
+    return &fs_fds[fd];
+}
+
+int fs_open(const char *name, int flags) {
+    if (!name || !(flags & FS_O_RDWR)) return -1;
+
+    int fd = 0;
+    while (fd < FS_MAX_FDS && fs_fds[fd].inode != FS_NULL_IDX) fd++;
+    if (fd == FS_MAX_FDS) return -1;
+
+    int idx = fs_lookup(name);
+    if (idx == FS_NULL_IDX && (flags & FS_O_CREAT)) {
+        char leaf[FS_MAX_NAME_LEN + 1];
+        int dir = fs_lookup_parent(name, leaf, 0);
+        if (dir != FS_NULL_IDX && leaf[0] != '\0' &&
+            strcmp(leaf, ".") != 0 && strcmp(leaf, "..") != 0) {
+            idx = fs_lookup_child(dir, leaf);   // a long name may match once truncated
+            if (idx == FS_NULL_IDX) idx = fs_create_in(leaf, dir, FS_TYPE_FILE);
+        }
+    }
+    if (idx == FS_NULL_IDX || fs_table[idx]->type != FS_TYPE_FILE) return -1;
+
+    if ((flags & FS_O_TRUNC) && (flags & FS_O_WRONLY)) fs_truncate(fs_table[idx]);
+    fs_table[idx]->open_count++;
+    fs_fds[fd].inode  = idx;
+    fs_fds[fd].offset = 0;
+    fs_fds[fd].flags  = flags;
+    return fd;
+}
+
+int fs_close(int fd) {
+    fs_fd_t *f = fs_fd_get(fd);
+    if (!f) return -1;
+    fs_table[f->inode]->open_count--;
+    f->inode = FS_NULL_IDX;
+    return 0;
+}
+
+int fs_read(int fd, void *buf, unsigned int len) {
+    fs_fd_t *f = fs_fd_get(fd);
+    if (!f || !(f->flags & FS_O_RDONLY)) return -1;
+    unsigned int n = fs_file_read(fs_table[f->inode], f->offset, buf, len);
+    f->offset += n;
+    return (int)n;
+}
+
+int fs_write(int fd, const void *buf, unsigned int len) {
+    fs_fd_t *f = fs_fd_get(fd);
+    if (!f || !(f->flags & FS_O_WRONLY)) return -1;
+    fs_entry_t *e = fs_table[f->inode];
+    if (f->flags & FS_O_APPEND) f->offset = e->size;
+    unsigned int n = fs_file_write(e, f->offset, buf, len);
+    f->offset += n;
+    return (int)n;
+}
+
+int fs_lseek(int fd, int offset, int whence) {
+    fs_fd_t *f = fs_fd_get(fd);
+    if (!f) return -1;
+    int base;
+    switch (whence) {
+    case FS_SEEK_SET: base = 0;                           break;
+    case FS_SEEK_CUR: base = (int)f->offset;              break;
+    case FS_SEEK_END: base = fs_table[f->inode]->size;    break;
+    default:          return -1;
+    }
+    if (base + offset < 0) return -1;
+    f->offset = base + offset;
+    return (int)f->offset;
 }
 
 // ---- rm -----------------------------------------------------
-int fs_rm(const char *name) {
-    int idx = fs_find_in(name, fs_cwd);
-    if (idx == FS_NULL_IDX || fs_table[idx].type != FS_TYPE_FILE) {
-        kprint("rm: '"); kprint(name); kprint("': no such file\n");
+int fs_rm(const char *path) {
+    int idx = fs_lookup(path);
+    if (idx == FS_NULL_IDX || fs_table[idx]->type != FS_TYPE_FILE) {
+        fs_no_such("rm", path, "file");
         return -1;
     }
-    fs_table[idx].type = FS_TYPE_NONE;
+    if (fs_table[idx]->open_count || fs_table[idx]->map_count) {
+        kprint("rm: '"); kprint(path); kprint("': file is open or mapped\n");
+        return -1;
+    }
+    fs_free(idx);
     return 0;
 }
 
 // ---- rmdir --------------------------------------------------
-int fs_rmdir(const char *name) {
-    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+int fs_rmdir(const char *path) {
+    char leaf[FS_MAX_NAME_LEN + 1];
+    fs_lookup_parent(path, leaf, 0);
+    if (strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
         kprint("rmdir: cannot remove '.' or '..'\n"); return -1;
     }
-    int idx = fs_find_in(name, fs_cwd);
-    if (idx == FS_NULL_IDX || fs_table[idx].type != FS_TYPE_DIR) {
-        kprint("rmdir: '"); kprint(name); kprint("': no such directory\n");
+    int idx = fs_lookup(path);
+    if (idx == FS_NULL_IDX || fs_table[idx]->type != FS_TYPE_DIR) {
+        fs_no_such("rmdir", path, "directory");
+        return -1;
+    }
+    // Ancestors of cwd are never empty: only cwd itself needs checking
+    if (idx == FS_ROOT_IDX || idx == fs_cwd) {
+        kprint("rmdir: '"); kprint(path); kprint("': is the root or current directory\n");
         return -1;
     }
     if (!fs_dir_empty(idx)) {
-        kprint("rmdir: '"); kprint(name); kprint("': directory not empty\n");
+        kprint("rmdir: '"); kprint(path); kprint("': directory not empty\n");
+        return -1;
+    }
+    fs_free(idx);
+    return 0;
+}
+
+// ---- mmap ---------------------------------------------------
+static fs_map_t *fs_map_find(unsigned int virt) {
+    for (int m = 0; m < FS_MAX_MAPS; m++) {
+        fs_map_t *map = &fs_maps[m];
+        if (map->start && virt >= map->start && virt - map->start < map->pages * PAGE_SIZE) {
+            return map;
+        }
+    }
+    return 0;
+}
+
+// Frame holding byte `off` of the file (off < capacity)
+static unsigned int fs_extent_phys(fs_entry_t *e, unsigned int off) {
+    unsigned int base = 0;
+    for (int i = 0;; i++) {
+        fs_extent_t *x = fs_extent(e, i);
+        unsigned int ext_len = PAGE_SIZE << x->order;
+        if (off < base + ext_len) return x->phys + (off - base);
+        base += ext_len;
+    }
+}
+
+int fs_mmap(const char *path, unsigned int vaddr, int flags) {
+    int idx = fs_lookup(path);
+    if (idx == FS_NULL_IDX || fs_table[idx]->type != FS_TYPE_FILE) return -1;
+    fs_entry_t *e = fs_table[idx];
+    // Initramfs data is not page aligned: map a copy
+    if (fs_unshare(e) != 0) return -1;
+
+    unsigned int pages = (e->size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0 || (vaddr & (PAGE_SIZE - 1)) ||
+        vaddr < FS_MMAP_START || vaddr >= FS_MMAP_END ||
+        pages > (FS_MMAP_END - vaddr) / PAGE_SIZE) {
         return -1;
     }
-    fs_table[idx].type = FS_TYPE_NONE;
+
+    fs_map_t *slot = 0;
+    for (int m = 0; m < FS_MAX_MAPS; m++) {
+        fs_map_t *map = &fs_maps[m];
+        if (!map->start) {
+            if (!slot) slot = map;
+        } else if (vaddr < map->start + map->pages * PAGE_SIZE &&
+                   map->start < vaddr + pages * PAGE_SIZE) {
+            return -1;   // overlaps
+        }
+    }
+    if (!slot) return -1;
+
+    slot->start = vaddr;
+    slot->pages = pages;
+    slot->inode = idx;
+    slot->flags = flags;
+    e->map_count++;
+    return 0;
+}
+
+int fs_mmap_fault(unsigned int virt_addr) {
+    fs_map_t *map = fs_map_find(virt_addr);
+    if (!map) return -1;
+
+    fs_entry_t  *e    = fs_table[map->inode];
+    unsigned int page = virt_addr & ~(PAGE_SIZE - 1);
+    unsigned int off  = page - map->start;
+    unsigned int phys;
+    unsigned int flags = PAGE_PRESENT | PAGE_USER;
+
+    if (map->flags & FS_MAP_WRITE) {
+        // Private copy; the PTE dirty bit then tells msync what changed
+        phys = evict_alloc_frame();
+        if (!phys) return -1;
+        unsigned int n = fs_file_read(e, off, (void *)phys, PAGE_SIZE);
+        memset((char *)phys + n, 0, PAGE_SIZE - n);
+        flags |= PAGE_RW;
+        fs_map_copies++;
+    } else {
+        // The file's own frame: nothing to copy, shared by every reader
+        phys = fs_extent_phys(e, off);
+    }
+
+    while (map_page(phys, page, flags) != 0) {
+        if (evict_one() != 0) {
+            if (map->flags & FS_MAP_WRITE) pmm_free_page(phys);
+            return -1;
+        }
+    }
+    fs_map_faults++;
     return 0;
 }
+
+int fs_msync(unsigned int vaddr) {
+    fs_map_t *map = fs_map_find(vaddr);
+    if (!map || map->start != vaddr) return -1;
+    if (!(map->flags & FS_MAP_WRITE)) return 0;   // writes are faults there
+
+    // Bytes past the end of the file stay in the mapping only
+    fs_entry_t *e = fs_table[map->inode];
+    int written = 0;
+    for (unsigned int i = 0; i < map->pages; i++) {
+        unsigned int page = map->start + i * PAGE_SIZE;
+        unsigned int off  = i * PAGE_SIZE;
+        if (!paging_test_and_clear(page, PAGE_DIRTY) || off >= (unsigned int)e->size) continue;
+
+        unsigned int len = e->size - off;
+        if (len > PAGE_SIZE) len = PAGE_SIZE;
+        fs_extent_copy(e, off, 0, (const void *)page, len);
+        written++;
+    }
+    fs_map_writebacks += written;
+    return written;
+}
+
+int fs_munmap(unsigned int vaddr) {
+    if (fs_msync(vaddr) < 0) return -1;
+    fs_map_t *map = fs_map_find(vaddr);
+
+    for (unsigned int i = 0; i < map->pages; i++) {
+        unsigned int page = map->start + i * PAGE_SIZE;
+        uint32_t *pte = paging_get_pte(page);
+        if (!pte || !(*pte & PAGE_PRESENT)) continue;
+        uint32_t pfn = paging_pte_pfn(pte);
+        unmap_page(page);
+        if (map->flags & FS_MAP_WRITE) pmm_free_page(pfn << 12);
+    }
+    fs_table[map->inode]->map_count--;
+    map->start = 0;
+    return 0;
+}
+
+// ---- initramfs ----------------------------------------------
+int fs_make_dirs(const char *path) {
+    const char *end = path;
+    while (*end) end++;
+    int dir = fs_walk(fs_walk_start(path), path, end, 1);
+    if (dir == FS_NULL_IDX || fs_table[dir]->type != FS_TYPE_DIR) return -1;
+    return dir;
+}
+
+int fs_attach_file(const char *path, const void *data, unsigned int size) {
+    char leaf[FS_MAX_NAME_LEN + 1];
+    int dir = fs_lookup_parent(path, leaf, 1);
+    if (dir == FS_NULL_IDX || leaf[0] == '\0' ||
+        strcmp(leaf, ".") == 0 || strcmp(leaf, "..") == 0) {
+        return -1;
+    }
+
+    int idx = fs_lookup_child(dir, leaf);
+    if (idx == FS_NULL_IDX) {
+        idx = fs_create_in(leaf, dir, FS_TYPE_FILE);
+        if (idx == FS_NULL_IDX) return -1;
+    } else if (fs_table[idx]->type != FS_TYPE_FILE || fs_table[idx]->map_count) {
+        return -1;
+    } else {
+        fs_truncate(fs_table[idx]);   // a later archive entry wins
+    }
+    fs_table[idx]->ro_data = (const char *)data;
+    fs_table[idx]->size    = size;
+    fs_ro_files++;
+    return idx;
+}
+
+// ---- fsinfo -------------------------------------------------
+void fs_print_stats(void) {
+    kprint("Inodes:       ");
+    kprint_dec(fs_inode_count);
+    kprint(" of ");
+    kprint_dec(fs_table_size);
+    kprint(" table slots (");
+    kprint_dec(fs_inode_count * sizeof(fs_entry_t) / 1024);
+    kprint(" KB)\n");
+
+    kprint("Dentry cache: ");
+    kprint_dec(fs_dcache ? FS_DCACHE_SIZE : 0);
+    kprint(" slots, ");
+    kprint_dec(fs_dcache_hits);
+    kprint(" hits, ");
+    kprint_dec(fs_dcache_neg_hits);
+    kprint(" negative hits, ");
+    kprint_dec(fs_dcache_misses);
+    kprint(" misses, ");
+    kprint_dec(fs_dcache_drops);
+    kprint(" invalidated\n");
+
+    int maps = 0;
+    for (int m = 0; m < FS_MAX_MAPS; m++) {
+        if (fs_maps[m].start) maps++;
+    }
+    kprint("Mappings:     ");
+    kprint_dec(maps);
+    kprint(" of ");
+    kprint_dec(FS_MAX_MAPS);
+    kprint(", ");
+    kprint_dec(fs_map_faults);
+    kprint(" faults (");
+    kprint_dec(fs_map_copies);
+    kprint(" private copies), ");
+    kprint_dec(fs_map_writebacks);
+    kprint(" pages written back\n");
+
+    kprint("In place:     ");
+    kprint_dec(fs_ro_files);
+    kprint(" initramfs files, ");
+    kprint_dec(fs_ro_copies);
+    kprint(" copied on first write\n");
+}
+
+// ---- fsbench ------------------------------------------------
+// Grow a scratch directory through sizes 16, 128, 1024, ... and time
+// lookups of names that are there (hits, in scattered order) and names
+// that are not (misses) at each size. Then time full path resolution of
+// a deep directory.
+#define FS_BENCH_QUERIES 64
+#define FS_BENCH_ROUNDS  1024
+#define FS_BENCH_DEPTH   8
+
+static char fs_bench_names[FS_BENCH_QUERIES][FS_MAX_NAME_LEN + 1];
+
+// "<prefix><n>"
+static void fs_bench_name(char *buf, char prefix, unsigned int n) {
+    char digits[10];
+    int  len = 0;
+    do { digits[len++] = '0' + n % 10; n /= 10; } while (n);
+    *buf++ = prefix;
+    while (len) *buf++ = digits[--len];
+    *buf = '\0';
+}
+
+static uint32_t fs_bench_lookups(int dir) {
+    uint32_t found = 0;
+    for (int r = 0; r < FS_BENCH_ROUNDS; r++) {
+        for (int q = 0; q < FS_BENCH_QUERIES; q++) {
+            if (fs_find_in(fs_bench_names[q], dir) != FS_NULL_IDX) found++;
+        }
+    }
+    return found;
+}
+
+void fs_bench(int max_entries) {
+    if (max_entries <= 0) max_entries = FS_BENCH_DEFAULT;
+    if (fs_find_in("fsbench", FS_ROOT_IDX) != FS_NULL_IDX) {
+        kprint("fsbench: '/fsbench' already exists\n");
+        return;
+    }
+    int dir = fs_create_in("fsbench", FS_ROOT_IDX, FS_TYPE_DIR);
+    if (dir == FS_NULL_IDX) { kprint("fsbench: filesystem full\n"); return; }
+
+    const uint32_t ops = FS_BENCH_QUERIES * FS_BENCH_ROUNDS;
+    char name[FS_MAX_NAME_LEN + 1];
+    int  filled = 0;
+    int  size   = 16;
+    for (;;) {
+        if (size > max_entries) size = max_entries;
+
+        uint64_t start = bench_now();
+        int first = filled;
+        while (filled < size) {
+            fs_bench_name(name, 'f', filled);
+            if (fs_create_in(name, dir, FS_TYPE_FILE) == FS_NULL_IDX) break;
+            filled++;
+        }
+        uint64_t create = bench_now() - start;
+        if (filled < size) {
+            kprint("fsbench: out of memory at ");
+            kprint_dec(filled);
+            kprint(" entries\n");
+            break;
+        }
+
+        kprint_dec(size);
+        kprint(" entries (table ");
+        kprint_dec(fs_table_size);
+        kprint(" slots, ");
+        kprint_dec(fs_table[dir]->hash_buckets);
+        kprint(" buckets)\n");
+        bench_print_rate("  create", size - first, create);
+
+        // Hits: spread over the whole directory
+        for (int q = 0; q < FS_BENCH_QUERIES; q++) {
+            fs_bench_name(fs_bench_names[q], 'f', (uint32_t)q * 2654435761u % (uint32_t)size);
+        }
+        start = bench_now();
+        uint32_t hits = fs_bench_lookups(dir);
+        bench_print_rate("  hit   ", ops, bench_now() - start);
+
+        // Misses
+        for (int q = 0; q < FS_BENCH_QUERIES; q++) {
+            fs_bench_name(fs_bench_names[q], 'm', q);
+        }
+        start = bench_now();
+        hits += fs_bench_lookups(dir);
+        bench_print_rate("  miss  ", ops, bench_now() - start);
+
+        if (hits != ops) kprint("fsbench: lookup returned a wrong result\n");
+        if (size == max_entries) break;
+        size *= 8;
+    }
+
+    // "/fsbench/d/d/...": one dentry cache probe per component once warm
+    char path[FS_MAX_PATH] = "/fsbench";
+    int  chain[FS_BENCH_DEPTH];
+    int  depth = 0, len = 8;
+    while (depth < FS_BENCH_DEPTH) {
+        int d = fs_create_in("d", depth ? chain[depth - 1] : dir, FS_TYPE_DIR);
+        if (d == FS_NULL_IDX) break;
+        chain[depth++] = d;
+        path[len++] = '/';
+        path[len++] = 'd';
+        path[len]   = '\0';
+    }
+    if (depth) {
+        uint32_t found = 0;
+        uint64_t start = bench_now();
+        for (uint32_t i = 0; i < ops; i++) {
+            if (fs_lookup(path) == chain[depth - 1]) found++;
+        }
+        uint64_t cycles = bench_now() - start;
+        kprint_dec(depth + 1);
+        kprint(" component path\n");
+        bench_print_rate("  lookup", ops, cycles);
+        if (found != ops) kprint("fsbench: lookup returned a wrong result\n");
+    }
+    while (depth) fs_free(chain[--depth]);
+
+    while (fs_table[dir]->first_child != FS_NULL_IDX) {
+        fs_free(fs_table[dir]->first_child);
+    }
+    fs_free(dir);
+}
+
+// ---- fsiobench ----------------------------------------------
+// Sequential 4KB writes (from an empty file each round, so extent
+// allocation is included) and reads, moving FS_IOBENCH_BYTES per size.
+#define FS_IOBENCH_BYTES (16u << 20)
+#define FS_IOBENCH_CHUNK PAGE_SIZE
+
+static const unsigned int fs_iobench_sizes[] = {
+    4096, 16384, 65536, 262144, 1048576, 4194304
+};
+#define FS_IOBENCH_SIZES (sizeof(fs_iobench_sizes) / sizeof(fs_iobench_sizes[0]))
+
+// Right-align `val` in `width` columns
+static void fs_print_padded(uint32_t val, uint32_t width) {
+    uint32_t digits = 1;
+    for (uint32_t t = val; t >= 10; t /= 10) digits++;
+    while (digits++ < width) kprint(" ");
+    kprint_dec(val);
+}
+
+// MB/s with one decimal, 12 columns, for `bytes` in `cycles`
+static void fs_print_mbps(uint32_t bytes, uint64_t cycles) {
+    uint32_t us = bench_cycles_to_us(cycles);
+    if (us == 0) us = 1;
+    uint32_t x10 = (uint32_t)bench_div64((uint64_t)bytes * 10, us);
+    fs_print_padded(x10 / 10, 10);
+    kprint(".");
+    kprint_dec(x10 % 10);
+}
+
+void fs_io_bench(void) {
+    if (fs_find_in("fsiobench", FS_ROOT_IDX) != FS_NULL_IDX) {
+        kprint("fsiobench: '/fsiobench' already exists\n");
+        return;
+    }
+    int idx = fs_create_in("fsiobench", FS_ROOT_IDX, FS_TYPE_FILE);
+    char *chunk = (char *)pmm_alloc_page();
+    if (idx == FS_NULL_IDX || !chunk) {
+        kprint("fsiobench: out of memory\n");
+        if (chunk) pmm_free_page((uint32_t)chunk);
+        if (idx != FS_NULL_IDX) fs_free(idx);
+        return;
+    }
+    fs_entry_t *e = fs_table[idx];
+    memset(chunk, 0x5A, FS_IOBENCH_CHUNK);
+
+    kprint("size     write MB/s   read MB/s  extents\n");
+    for (uint32_t z = 0; z < FS_IOBENCH_SIZES; z++) {
+        unsigned int size   = fs_iobench_sizes[z];
+        unsigned int rounds = FS_IOBENCH_BYTES / size;
+        int ok = 1;
+
+        uint64_t start = bench_now();
+        for (unsigned int r = 0; r < rounds && ok; r++) {
+            fs_truncate(e);
+            for (unsigned int off = 0; off < size; off += FS_IOBENCH_CHUNK) {
+                if (fs_file_write(e, off, chunk, FS_IOBENCH_CHUNK) != FS_IOBENCH_CHUNK) {
+                    ok = 0;
+                    break;
+                }
+            }
+        }
+        uint64_t write = bench_now() - start;
+        if (!ok) {
+            kprint("fsiobench: out of memory at ");
+            kprint_dec(size / 1024);
+            kprint(" KB\n");
+            break;
+        }
+
+        start = bench_now();
+        for (unsigned int r = 0; r < rounds; r++) {
+            for (unsigned int off = 0; off < size; off += FS_IOBENCH_CHUNK) {
+                fs_file_read(e, off, chunk, FS_IOBENCH_CHUNK);
+            }
+        }
+        uint64_t read = bench_now() - start;
+
+        fs_print_padded(size >= 1048576 ? size >> 20 : size >> 10, 4);
+        kprint(size >= 1048576 ? " MB" : " KB");
+        fs_print_mbps(FS_IOBENCH_BYTES, write);
+        fs_print_mbps(FS_IOBENCH_BYTES, read);
+        fs_print_padded(e->ext_count, 9);
+        kprint("\n");
+    }
+
+    pmm_free_page((uint32_t)chunk);
+    fs_free(idx);
+}
+
+// ---- mmapbench ----------------------------------------------
+// A 4MB file read three ways: read() into a buffer, a read-only map on
+// first touch (one fault per page, no copy) and the same map warm. Then
+// a writable map dirties every other page and msync writes them back.
+#define FS_MMAPBENCH_BYTES (4u << 20)
+#define FS_MMAPBENCH_PAGES (FS_MMAPBENCH_BYTES / PAGE_SIZE)
+
+static uint32_t fs_sum_words(const uint32_t *p, uint32_t bytes) {
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < bytes / 4; i++) sum += p[i];
+    return sum;
+}
+
+void fs_mmap_bench(void) {
+    const char *path = "/mmapbench";
+    const unsigned int base = FS_MMAP_START;
+    if (fs_find_in("mmapbench", FS_ROOT_IDX) != FS_NULL_IDX) {
+        kprint("mmapbench: '/mmapbench' already exists\n");
+        return;
+    }
+    uint32_t *chunk = (uint32_t *)pmm_alloc_page();
+    if (!chunk) { kprint("mmapbench: out of memory\n"); return; }
+
+    int fd = fs_open(path, FS_O_RDWR | FS_O_CREAT | FS_O_TRUNC);
+    if (fd < 0) {
+        kprint("mmapbench: cannot create /mmapbench\n");
+        pmm_free_page((uint32_t)chunk);
+        return;
+    }
+    uint32_t expect = 0;
+    for (uint32_t p = 0; p < FS_MMAPBENCH_PAGES; p++) {
+        for (uint32_t w = 0; w < PAGE_SIZE / 4; w++) chunk[w] = p * 1024 + w;
+        expect += fs_sum_words(chunk, PAGE_SIZE);
+        if (fs_write(fd, chunk, PAGE_SIZE) != PAGE_SIZE) {
+            kprint("mmapbench: out of memory\n");
+            fs_close(fd);
+            fs_rm(path);
+            pmm_free_page((uint32_t)chunk);
+            return;
+        }
+    }
+
+    // read(): copy into our buffer, then use it
+    uint32_t sum = 0;
+    fs_lseek(fd, 0, FS_SEEK_SET);
+    uint64_t start = bench_now();
+    while (fs_read(fd, chunk, PAGE_SIZE) == PAGE_SIZE) sum += fs_sum_words(chunk, PAGE_SIZE);
+    uint64_t copy = bench_now() - start;
+    int ok = sum == expect;
+
+    // Read-only map: first touch faults every page in, then warm
+    uint32_t faults_before = fs_map_faults;
+    if (fs_mmap(path, base, 0) != 0) {
+        kprint("mmapbench: cannot map /mmapbench\n");
+        fs_close(fd);
+        fs_rm(path);
+        pmm_free_page((uint32_t)chunk);
+        return;
+    }
+    start = bench_now();
+    sum = fs_sum_words((const uint32_t *)base, FS_MMAPBENCH_BYTES);
+    uint64_t cold = bench_now() - start;
+    ok &= sum == expect;
+    start = bench_now();
+    sum = fs_sum_words((const uint32_t *)base, FS_MMAPBENCH_BYTES);
+    uint64_t warm = bench_now() - start;
+    ok &= sum == expect;
+    uint32_t faults = fs_map_faults - faults_before;
+    fs_munmap(base);
+
+    // Writable map: dirty every other page, write back
+    if (fs_mmap(path, base, FS_MAP_WRITE) != 0) {
+        kprint("mmapbench: cannot map /mmapbench for writing\n");
+        fs_close(fd);
+        fs_rm(path);
+        pmm_free_page((uint32_t)chunk);
+        return;
+    }
+    for (uint32_t p = 0; p < FS_MMAPBENCH_PAGES; p++) {
+        volatile uint32_t *w = (volatile uint32_t *)(base + p * PAGE_SIZE);
+        if (p & 1) (void)*w;
+        else       *w = 0xFEEDFACE;
+    }
+    uint32_t written = fs_map_writebacks;
+    start = bench_now();
+    fs_munmap(base);
+    uint64_t sync = bench_now() - start;
+    written = fs_map_writebacks - written;
+
+    // The file now holds the new first word of every even page
+    uint32_t bad = 0;
+    for (uint32_t p = 0; p < FS_MMAPBENCH_PAGES; p++) {
+        fs_lseek(fd, p * PAGE_SIZE, FS_SEEK_SET);
+        fs_read(fd, chunk, 4);
+        if (chunk[0] != ((p & 1) ? p * 1024 : 0xFEEDFACE)) bad++;
+    }
+    fs_close(fd);
+    fs_rm(path);
+    pmm_free_page((uint32_t)chunk);
+
+    kprint("4MB file        MB/s\n");
+    kprint("read() copy ");
+    fs_print_mbps(FS_MMAPBENCH_BYTES, copy);
+    kprint("\nmmap cold   ");
+    fs_print_mbps(FS_MMAPBENCH_BYTES, cold);
+    kprint(" (");
+    kprint_dec(faults);
+    kprint(" faults)\nmmap warm   ");
+    fs_print_mbps(FS_MMAPBENCH_BYTES, warm);
+    kprint("\n");
+    kprint_dec(written);
+    kprint(" of ");
+    kprint_dec(FS_MMAPBENCH_PAGES);
+    kprint(" pages dirty, ");
+    bench_print_rate("written back", written, sync);
+    kprint(ok && bad == 0 ? "contents ok\n" : "contents MISMATCH\n");
+}
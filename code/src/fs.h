@@ -6,9 +6,17 @@
 // Supports files AND directories with a current working dir.
 // ============================================================
 
-#define FS_MAX_ENTRIES    32          // total inodes (files + dirs)
+#define FS_INITIAL_ENTRIES 32         // inode table slots at boot (boot option fs_entries; grows on demand)
 #define FS_MAX_NAME_LEN   16          // max name length (excl. NUL)
-#define FS_MAX_FILE_SIZE  256         // max bytes per file
+#define FS_MAX_PATH       256         // longest path handled by shell commands and pwd
+#define FS_DCACHE_BITS    8
+#define FS_DCACHE_SIZE    (1 << FS_DCACHE_BITS)   // dentry cache slots
+#define FS_INLINE_EXTENTS 4           // extents held in the inode itself
+#define FS_EXTENT_MAX_ORDER 8         // largest extent: 2^8 pages (1MB)
+#define FS_MAX_FDS        16          // open file descriptors at once
+#define FS_MAX_MAPS       16          // file mappings at once
+#define FS_MMAP_START     0xF0000000  // window for file mappings, above the
+#define FS_MMAP_END       0xF8000000  //   mapbench range and below the page tables
 #define FS_ROOT_IDX       0           // inode index of root "/"
 #define FS_NULL_IDX       -1          // sentinel for "no parent"
 
@@ -17,31 +25,133 @@
 #define FS_TYPE_FILE  1
 #define FS_TYPE_DIR   2
 
+// File data lives in extents: PMM blocks of 2^order pages, read and
+// written through the direct map. Extents get larger as a file grows
+// (each about doubles the capacity), so a file of several MB needs only
+// a dozen or so.
+typedef struct {
+    unsigned int phys;               // start of the block (direct mapped)
+    unsigned int order;              // 2^order pages
+} fs_extent_t;
+
 typedef struct {
     char name[FS_MAX_NAME_LEN + 1];  // entry name (not full path)
-    char content[FS_MAX_FILE_SIZE];  // file content (dirs ignore this)
     int  size;                       // bytes of content
     int  type;                       // FS_TYPE_FILE | FS_TYPE_DIR
     int  parent;                     // parent inode index (FS_NULL_IDX for root)
+
+    // Directory index. Every directory keeps its children on a list (in
+    // creation order) and in a hash table keyed by name, so lookups cost
+    // O(1) and ls / rmdir cost O(children) however big the table gets.
+    unsigned int hash;               // hash of name, kept for rehashing
+    int  hash_next;                  // next child in the same bucket of the parent
+    int  next_sibling;               // children list of the parent
+    int  prev_sibling;
+    int  first_child;                // dirs: children list head / tail
+    int  last_child;
+    int  child_count;                // dirs: number of children
+    int  hash_buckets;               // dirs: size of child_hash (power of two, 0 = none)
+    int *child_hash;                 // dirs: bucket -> first child index
+
+    // Files: data extents. The first ones sit in the inode, so a small
+    // file's bytes are one hop away; more spill into a kmalloc'ed array.
+    fs_extent_t  ext[FS_INLINE_EXTENTS];
+    fs_extent_t *ext_more;           // extents FS_INLINE_EXTENTS and up
+    int  ext_count;
+    int  ext_more_cap;               // slots in ext_more
+    unsigned int capacity;           // bytes held by all extents
+    int  open_count;                 // file descriptors referring to it
+    int  map_count;                  // mappings (its extents must stay put)
+    const char *ro_data;             // contents borrowed in place (initramfs);
+                                     //   copied to extents on the first write
 } fs_entry_t;
 
-extern fs_entry_t fs_table[FS_MAX_ENTRIES];
-extern int        fs_cwd;            // current working directory inode index
+#define FS_HASH_MIN_BUCKETS 8         // first index of a directory; doubles past one child per bucket
+#define FS_BENCH_DEFAULT    131072    // largest directory fsbench builds by default
+
+// Inode table: index -> slab-allocated inode (0 when the slot is free).
+// Doubles in size whenever it runs out of free slots.
+extern fs_entry_t **fs_table;
+extern int          fs_table_size;
+extern int          fs_cwd;          // current working directory inode index
 
 // ---- Core API -----------------------------------------------
+// Every name argument is a path: absolute ("/a/b/file") or relative to
+// cwd ("../c/file"), with "." and ".." allowed anywhere.
 void fs_init(void);
 
 // File ops
-int  fs_create_file(const char *name);       // in cwd
-void fs_write_file (const char *name, const char *data);
-void fs_read_file  (const char *name);
+int  fs_create_file(const char *path);
+void fs_write_file (const char *path, const char *data);
+void fs_read_file  (const char *path);
+void fs_append_file(const char *path, const char *data);
+
+// File descriptors. fs_open() resolves `path` and returns an fd,
+// or -1 (no such file, a directory, or no free fd). Every fd has its own
+// offset; reads and writes start there and advance it. With FS_O_APPEND
+// each write first moves the offset to the end of the file. An open file
+// cannot be removed.
+#define FS_O_RDONLY  0x01
+#define FS_O_WRONLY  0x02
+#define FS_O_RDWR    (FS_O_RDONLY | FS_O_WRONLY)
+#define FS_O_CREAT   0x04                    // create the file if missing
+#define FS_O_TRUNC   0x08                    // drop existing data
+#define FS_O_APPEND  0x10                    // every write goes to the end
+
+#define FS_SEEK_SET  0
+#define FS_SEEK_CUR  1
+#define FS_SEEK_END  2
+
+int  fs_open  (const char *path, int flags);
+int  fs_close (int fd);
+int  fs_read  (int fd, void *buf, unsigned int len);         // bytes read, 0 at EOF, -1
+int  fs_write (int fd, const void *buf, unsigned int len);   // bytes written (short when out of memory), -1
+int  fs_lseek (int fd, int offset, int whence);              // new offset, or -1
 
 // Directory ops
-int  fs_mkdir      (const char *name);       // in cwd
-int  fs_cd         (const char *name);       // change cwd
+int  fs_mkdir      (const char *path);
+int  fs_cd         (const char *path);       // change cwd
 void fs_pwd        (void);                   // print cwd path
-void fs_list_files (void);                   // ls in cwd
-int  fs_rm         (const char *name);       // delete file in cwd
-int  fs_rmdir      (const char *name);       // delete empty dir in cwd
+void fs_list_files (const char *path);       // ls (0 or "" = cwd)
+int  fs_rm         (const char *path);       // delete a file
+int  fs_rmdir      (const char *path);       // delete an empty dir
+
+// Memory-mapped files. fs_mmap() reserves the file's size, rounded up to
+// pages, at `vaddr` (page aligned, inside [FS_MMAP_START, FS_MMAP_END));
+// pages come in through the page fault handler on first touch. Read-only
+// maps point straight at the file's own frames. FS_MAP_WRITE maps get a
+// private copy of each page touched; fs_msync() writes the dirty ones
+// back. Each returns -1 on failure; fs_msync() returns the pages written.
+#define FS_MAP_WRITE 0x01
+
+int  fs_mmap  (const char *path, unsigned int vaddr, int flags);
+int  fs_msync (unsigned int vaddr);
+int  fs_munmap(unsigned int vaddr);              // msync, then unmap
+
+// Back the mapped page containing virt_addr after a not-present fault.
+// Returns 0 if handled, -1 if no mapping covers it.
+int  fs_mmap_fault(unsigned int virt_addr);
+
+// Initramfs population. fs_make_dirs() creates a directory and any
+// missing parents (existing ones are fine). fs_attach_file() creates a
+// file, and any missing parents, whose contents are the `size` bytes at
+// `data`, used in place: read-only memory the fs never frees. Both
+// return the inode, or -1.
+int  fs_make_dirs  (const char *path);
+int  fs_attach_file(const char *path, const void *data, unsigned int size);
+
+// Inode and dentry cache counters (shell: fsinfo)
+void fs_print_stats(void);
+
+// Lookups/sec against directory size, up to max_entries children
+// (0 = FS_BENCH_DEFAULT) in a scratch directory /fsbench (shell: fsbench)
+void fs_bench      (int max_entries);
+
+// Sequential write / read MB/s for files of 4KB to 4MB (shell: fsiobench)
+void fs_io_bench   (void);
+
+// read() copies against mmap first touch and warm reads of a 4MB file,
+// then msync of a writable map (shell: mmapbench)
+void fs_mmap_bench (void);
 
 #endif /* FS_H */
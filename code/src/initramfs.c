@@ -0,0 +1,174 @@
+#include "initramfs.h"
+#include "fs.h"
+#include "pmm.h"
+#include "bench.h"
+#include "kstring.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+extern void kprint_hex(unsigned int val);
+
+#define TAR_BLOCK 512
+
+/* POSIX ustar header; numbers are octal text */
+typedef struct {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];           // "ustar"
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];        // leading part of long paths
+    char pad[12];
+} __attribute__((packed)) tar_header_t;
+
+#define TAR_TYPE_FILE     '0'
+#define TAR_TYPE_OLD_FILE '\0'
+#define TAR_TYPE_CONTIG   '7'
+#define TAR_TYPE_DIR      '5'
+
+static uint32_t tar_octal(const char *s, int len)
+{
+    uint32_t val = 0;
+    int i = 0;
+    while (i < len && s[i] == ' ') i++;
+    for (; i < len && s[i] >= '0' && s[i] <= '7'; i++) {
+        val = val * 8 + (uint32_t)(s[i] - '0');
+    }
+    return val;
+}
+
+/* Sum of the header bytes, the checksum field counting as spaces */
+static int tar_checksum_ok(const tar_header_t *h)
+{
+    const uint8_t *b = (const uint8_t *)h;
+    uint32_t sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        int in_field = i >= 148 && i < 156;
+        sum += in_field ? ' ' : b[i];
+    }
+    return sum == tar_octal(h->chksum, sizeof(h->chksum));
+}
+
+/* Append up to `max` bytes of a possibly unterminated field */
+static int tar_append(char *path, int len, const char *field, int max)
+{
+    for (int i = 0; i < max && field[i]; i++) {
+        if (len >= FS_MAX_PATH - 1) return -1;
+        path[len++] = field[i];
+    }
+    path[len] = '\0';
+    return len;
+}
+
+/* "/" + prefix + "/" + name */
+static int tar_path(const tar_header_t *h, char *path)
+{
+    int len = 1;
+    path[0] = '/';
+    path[1] = '\0';
+    if (h->prefix[0]) {
+        len = tar_append(path, len, h->prefix, sizeof(h->prefix));
+        if (len < 0) return -1;
+        len = tar_append(path, len, "/", 1);
+        if (len < 0) return -1;
+    }
+    return tar_append(path, len, h->name, sizeof(h->name)) < 0 ? -1 : 0;
+}
+
+static void initramfs_mount(const multiboot_module_t *mod)
+{
+    const char *p   = (const char *)mod->mod_start;
+    const char *end = (const char *)mod->mod_end;
+    uint32_t files = 0, dirs = 0, bytes = 0, skipped = 0;
+    char path[FS_MAX_PATH];
+    uint64_t start = bench_now();
+
+    while (p + TAR_BLOCK <= end) {
+        const tar_header_t *h = (const tar_header_t *)p;
+        if (h->name[0] == '\0') {
+            break; // End of archive (zero blocks)
+        }
+        if (memcmp(h->magic, "ustar", 5) != 0 || !tar_checksum_ok(h)) {
+            kprint("[INITRAMFS] bad header at offset ");
+            kprint_hex((uint32_t)(p - (const char *)mod->mod_start));
+            kprint(", stopping\n");
+            break;
+        }
+
+        uint32_t size = tar_octal(h->size, sizeof(h->size));
+        const char *data = p + TAR_BLOCK;
+        if (size > (uint32_t)(end - data)) {
+            kprint("[INITRAMFS] truncated archive\n");
+            break;
+        }
+
+        int ok = tar_path(h, path) == 0;
+        if (ok && (h->typeflag == TAR_TYPE_FILE || h->typeflag == TAR_TYPE_OLD_FILE ||
+                   h->typeflag == TAR_TYPE_CONTIG)) {
+            ok = fs_attach_file(path, data, size) >= 0;
+            if (ok) {
+                files++;
+                bytes += size;
+            }
+        } else if (ok && h->typeflag == TAR_TYPE_DIR) {
+            ok = fs_make_dirs(path) >= 0;
+            if (ok) dirs++;
+        } else {
+            ok = 0; // Links, devices, over-long paths
+        }
+        if (!ok) skipped++;
+
+        p = data + ((size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+    }
+
+    uint64_t cycles = bench_now() - start;
+    kprint("[INITRAMFS] ");
+    kprint_hex(mod->mod_start);
+    kprint(": ");
+    kprint_dec(files);
+    kprint(" files (");
+    kprint_dec(bytes / 1024);
+    kprint(" KB in place), ");
+    kprint_dec(dirs);
+    kprint(" dirs, ");
+    kprint_dec(skipped);
+    kprint(" skipped, ");
+    kprint_dec(bench_cycles_to_us(cycles));
+    kprint(" us\n");
+}
+
+void initramfs_init(uint32_t magic, multiboot_info_t *mbi)
+{
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !(mbi->flags & MULTIBOOT_INFO_MODS)) {
+        return;
+    }
+
+    const multiboot_module_t *mods = (const multiboot_module_t *)mbi->mods_addr;
+    for (uint32_t i = 0; i < mbi->mods_count; i++) {
+        const multiboot_module_t *mod = &mods[i];
+        // Only direct-mapped modules stay reserved and readable in place
+        if (mod->mod_end > DIRECT_MAP_END || mod->mod_end - mod->mod_start < TAR_BLOCK) {
+            continue;
+        }
+        if (!pmm_is_reserved(mod->mod_start, mod->mod_end)) {
+            kprint("initramfs: module at 0x");
+            kprint_hex(mod->mod_start);
+            kprint(" is not reserved, not mounted\n");
+            continue;
+        }
+        const tar_header_t *h = (const tar_header_t *)mod->mod_start;
+        if (memcmp(h->magic, "ustar", 5) == 0) {
+            initramfs_mount(mod);
+        }
+    }
+}
@@ -0,0 +1,18 @@
+#ifndef INITRAMFS_H
+#define INITRAMFS_H
+
+#include "multiboot.h"
+
+/*
+   Initial RAM filesystem.
+   GRUB loads a ustar archive as a Multiboot module (grub.cfg "module"
+   line). Its directories and files are added to the fs in place: a file's
+   inode points straight at its data inside the module, which the PMM
+   keeps reserved, so mounting costs one pass over the headers whatever
+   the file sizes. The first write to a file copies it into extents.
+*/
+
+/* Mount every ustar module at "/". Call after fs_init(). */
+void initramfs_init(uint32_t magic, multiboot_info_t *mbi);
+
+#endif
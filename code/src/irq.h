@@ -0,0 +1,22 @@
+#ifndef IRQ_H
+#define IRQ_H
+
+#include "paging.h" // For types
+
+/* Disable interrupts and return the previous EFLAGS */
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+/* Re-enable interrupts if they were on when irq_save() was called */
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & 0x200) {
+        asm volatile("sti" ::: "memory");
+    }
+}
+
+#endif
@@ -22,11 +22,24 @@ extern void keyboard_handler(void);
 extern void timer_handler(void);
 extern void mouse_handler(void);
 extern void page_fault_stub(void);
+extern void ata_irq_stub(void);
 
 #include "./paging.h"
+#include "./pmm.h"
+#include "./slab.h"
 #include "./swap.h"
+#include "./evict.h"
+#include "./dedup.h"
 #include "./fs.h"
 #include "./net.h"
+#include "./bench.h"
+#include "./kstring.h"
+#include "./vmalloc.h"
+#include "./shrink.h"
+#include "./wss.h"
+#include "./multiboot.h"
+#include "./config.h"
+#include "./initramfs.h"
 
 char *vidptr             = (char *)0xb8000;
 unsigned int current_loc = 0;
@@ -79,13 +92,27 @@ void kprint_hex(unsigned int val)
         kprint(buf);
 }
 
-void clear_screen(void)
+void kprint_dec(unsigned int val)
 {
-        for (unsigned int j = 0; j < 80 * 25 * 2; j += 2)
-        {
-                vidptr[j]     = ' ';
-                vidptr[j + 1] = 0x07;
+        char buf[12];
+        int idx = 0;
+        if (val == 0) {
+                kprint("0");
+                return;
         }
+        while (val > 0) {
+                buf[idx++] = '0' + (val % 10);
+                val /= 10;
+        }
+        while (idx > 0) {
+                char s[2] = {buf[--idx], '\0'};
+                kprint(s);
+        }
+}
+
+void clear_screen(void)
+{
+        memset16(vidptr, 0x0720, 80 * 25); // ' ' on light grey
         current_loc = 0;
 }
 
@@ -104,11 +131,34 @@ int strncmp(const char *s1, const char *s2, int n) {
     return *(const unsigned char*)s1 - *(const unsigned char*)s2;
 }
 
+// Parse a decimal argument, skipping leading spaces
+unsigned int parse_uint(const char *s) {
+    unsigned int val = 0;
+    while (*s == ' ') s++;
+    while (*s >= '0' && *s <= '9') { val = val * 10 + (*s - '0'); s++; }
+    return val;
+}
+
 // ==== Terminal / Shell ====
 #define CMD_BUFFER_SIZE 256
 char cmd_buffer[CMD_BUFFER_SIZE];
 int cmd_len = 0;
 
+extern char kernel_end[];
+uint64_t boot_cycles = 0;   // kmain entry to the first prompt
+
+// Boot time and the memory the image itself occupies (shell: info)
+void print_boot_info(void) {
+        kprint("  boot: ");
+        kprint_dec(bench_cycles_to_us(boot_cycles) / 1000);
+        kprint(" ms, image ");
+        kprint_dec(((uint32_t)kernel_end - 0x100000) / 1024);
+        kprint(" KB (BSS included)\n");
+        kprint("  cmdline: ");
+        kprint(config_cmdline());
+        kprint("\n");
+}
+
 void execute_command(char* cmd) {
     char *c = cmd;
     while (*c == ' ') c++; // trim leading space
@@ -122,25 +172,51 @@ void execute_command(char* cmd) {
         kprint("  echo     - Print text (echo <msg>)\n");
         kprint("  info     - Show system info\n");
         kprint("  pwd      - Show current directory\n");
-        kprint("  ls       - List files in current directory\n");
-        kprint("  mkdir    - Create a directory (mkdir <name>)\n");
-        kprint("  cd       - Change directory (cd <name> | .. | .)\n");
-        kprint("  touch    - Create empty file (touch <name>)\n");
-        kprint("  write    - Write text to file (write <name> <content>)\n");
-        kprint("  cat      - Read file content (cat <name>)\n");
-        kprint("  rm       - Delete a file (rm <name>)\n");
-        kprint("  rmdir    - Delete an empty directory (rmdir <name>)\n");
+        kprint("  ls       - List a directory (ls [path], default current)\n");
+        kprint("  mkdir    - Create a directory (mkdir <path>)\n");
+        kprint("  cd       - Change directory (cd <path>, e.g. /a/b or ../c)\n");
+        kprint("  touch    - Create empty file (touch <path>)\n");
+        kprint("  write    - Write text to file (write <path> <content>)\n");
+        kprint("  append   - Append text to file (append <path> <content>)\n");
+        kprint("  cat      - Read file content (cat <path>)\n");
+        kprint("  rm       - Delete a file (rm <path>)\n");
+        kprint("  rmdir    - Delete an empty directory (rmdir <path>)\n");
         kprint("  ifconfig - Show network interface info\n");
         kprint("  arp      - Show ARP cache\n");
         kprint("  ping     - Ping an IP (ping <ip>)\n");
         kprint("  udp      - Send UDP packet (udp <ip> <port> <msg>)\n");
+        kprint("  meminfo  - Show physical memory usage\n");
+        kprint("  pmmbench - Benchmark the page frame allocator\n");
+        kprint("  slabinfo - Show kernel object caches\n");
+        kprint("  shrinkers - Show cache shrinkers and reclaimed frames\n");
+        kprint("  vminfo   - Show page table and mapping counters\n");
+        kprint("  mapbench - Benchmark map_page/unmap_page\n");
+        kprint("  membench - Benchmark memcpy/memset/memcmp variants\n");
+        kprint("  tlbbench - Compare per-page and batched TLB flushes\n");
+        kprint("  tlbthresh - Set range flush threshold (tlbthresh <pages>)\n");
+        kprint("  swapinfo - Show swap slots, compression and index statistics\n");
+        kprint("  vmstat   - Show eviction / refault counters\n");
+        kprint("  wss      - Show page idle ages and the working-set estimate\n");
+        kprint("  reslimit - Cap resident swapped-in pages (reslimit <pages>)\n");
+        kprint("  swaptest - Fault in swap-backed pages (swaptest <pages>)\n");
+        kprint("  dedup    - Merge identical resident pages (copy-on-write)\n");
+        kprint("  vmallocinfo - Show vmalloc areas and address space fragmentation\n");
+        kprint("  vmtest   - Exercise lazy and eager vmalloc areas (vmtest <pages>)\n");
+        kprint("  fsbench  - Directory lookups/sec by size (fsbench [max entries])\n");
+        kprint("  fsinfo   - Show inode and dentry cache statistics\n");
+        kprint("  fsiobench - Sequential file write/read MB/s, 4KB to 4MB files\n");
+        kprint("  mmapbench - read() vs mmap of a 4MB file, msync of a writable map\n");
     } else if (strcmp(c, "clear") == 0) {
         clear_screen();
     } else if (strcmp(c, "pwd") == 0) {
         fs_pwd();
     } else if (strcmp(c, "ls") == 0) {
         fs_pwd();
-        fs_list_files();
+        fs_list_files(0);
+    } else if (strncmp(c, "ls ", 3) == 0) {
+        char *dname = c + 3;
+        while (*dname == ' ') dname++;
+        fs_list_files(dname);
     } else if (strncmp(c, "mkdir ", 6) == 0) {
         char *dname = c + 6;
         while (*dname == ' ') dname++;
@@ -191,26 +267,80 @@ void execute_command(char* cmd) {
         } else {
             kprint("Usage: cat <filename>\n");
         }
-    } else if (strncmp(c, "write ", 6) == 0) {
-        char *args = c + 6;
+    } else if (strncmp(c, "write ", 6) == 0 || strncmp(c, "append ", 7) == 0) {
+        int append = c[0] == 'a';
+        char *args = c + (append ? 7 : 6);
         while (*args == ' ') args++;
-        char filename[16];
+        char filename[FS_MAX_PATH];
         int i = 0;
-        while (*args != ' ' && *args != '\0' && i < 15) {
+        while (*args != ' ' && *args != '\0' && i < FS_MAX_PATH - 1) {
             filename[i++] = *args++;
         }
         filename[i] = '\0';
         while (*args == ' ') args++;
         if (filename[0] != '\0' && *args != '\0') {
-            fs_write_file(filename, args);
+            if (append) {
+                fs_append_file(filename, args);
+            } else {
+                fs_write_file(filename, args);
+            }
         } else {
-            kprint("Usage: write <filename> <content>\n");
+            kprint(append ? "Usage: append <filename> <content>\n"
+                          : "Usage: write <filename> <content>\n");
         }
     } else if (strncmp(c, "echo ", 5) == 0) {
         kprint(c + 5);
         kprint("\n");
     } else if (strcmp(c, "info") == 0) {
         kprint("MOKernel - Terminal | Paging | FS | Networking\n");
+        print_boot_info();
+    } else if (strcmp(c, "meminfo") == 0) {
+        pmm_print_stats();
+    } else if (strcmp(c, "pmmbench") == 0) {
+        pmm_bench();
+    } else if (strcmp(c, "slabinfo") == 0) {
+        slab_print_info();
+    } else if (strcmp(c, "shrinkers") == 0) {
+        shrink_print_stats();
+    } else if (strcmp(c, "vminfo") == 0) {
+        paging_print_stats();
+    } else if (strcmp(c, "fsbench") == 0) {
+        fs_bench(0);
+    } else if (strncmp(c, "fsbench ", 8) == 0) {
+        fs_bench((int)parse_uint(c + 8));
+    } else if (strcmp(c, "fsinfo") == 0) {
+        fs_print_stats();
+    } else if (strcmp(c, "mmapbench") == 0) {
+        fs_mmap_bench();
+    } else if (strcmp(c, "fsiobench") == 0) {
+        fs_io_bench();
+    } else if (strcmp(c, "mapbench") == 0) {
+        paging_bench();
+    } else if (strcmp(c, "swapinfo") == 0) {
+        swap_print_stats();
+    } else if (strcmp(c, "membench") == 0) {
+        kstring_bench();
+    } else if (strcmp(c, "tlbbench") == 0) {
+        paging_tlb_bench();
+    } else if (strncmp(c, "tlbthresh ", 10) == 0) {
+        paging_set_flush_threshold(parse_uint(c + 10));
+        kprint("TLB flush threshold set\n");
+    } else if (strcmp(c, "wss") == 0) {
+        wss_print_stats();
+    } else if (strcmp(c, "vmstat") == 0) {
+        evict_print_stats();
+        dedup_print_stats();
+    } else if (strcmp(c, "dedup") == 0) {
+        dedup_scan();
+    } else if (strcmp(c, "vmallocinfo") == 0) {
+        vmalloc_print_stats();
+    } else if (strncmp(c, "vmtest ", 7) == 0) {
+        vmalloc_selftest(parse_uint(c + 7));
+    } else if (strncmp(c, "reslimit ", 9) == 0) {
+        evict_set_limit(parse_uint(c + 9));
+        kprint("Resident page limit set\n");
+    } else if (strncmp(c, "swaptest ", 9) == 0) {
+        evict_selftest(parse_uint(c + 9));
     } else if (strcmp(c, "ifconfig") == 0) {
         net_cmd_ifconfig();
     } else if (strcmp(c, "arp") == 0) {
@@ -273,11 +403,26 @@ int shift_pressed = 0;
 int ctrl_pressed = 0;
 int e0_pressed = 0;
 
-#define HISTORY_MAX 10
-char history[HISTORY_MAX][CMD_BUFFER_SIZE];
+// Command history: allocated on the first command, with room for as many
+// entries as the `history` boot option asks for (0 turns it off)
+#define HISTORY_DEFAULT 10
+#define HISTORY_LIMIT   256
+char (*history)[CMD_BUFFER_SIZE] = 0;
+int history_max = 0;
 int history_count = 0;
 int history_index = 0;
 
+int history_reserve(void) {
+    if (history) return 0;
+    uint32_t n = config_get("history", HISTORY_DEFAULT);
+    if (n == 0) return -1;
+    if (n > HISTORY_LIMIT) n = HISTORY_LIMIT;
+    history = (char (*)[CMD_BUFFER_SIZE])kmalloc(n * CMD_BUFFER_SIZE);
+    if (!history) return -1;
+    history_max = (int)n;
+    return 0;
+}
+
 void cmd_clear_display(void) {
     while (cmd_len > 0) {
         cmd_len--;
@@ -403,16 +548,15 @@ void keyboard_handler_main(void)
                 {
                         kprint("\n");
                         cmd_buffer[cmd_len] = '\0';
-                        if (cmd_len > 0) {
-                            if (history_count < HISTORY_MAX) {
-                                int i; for(i=0; i<=cmd_len; i++) history[history_count][i] = cmd_buffer[i];
+                        if (cmd_len > 0 && history_reserve() == 0) {
+                            if (history_count < history_max) {
+                                memcpy(history[history_count], cmd_buffer, cmd_len + 1);
                                 history_count++;
                             } else {
-                                for(int j=0; j<HISTORY_MAX-1; j++) {
-                                    int k=0; while(history[j+1][k] != '\0') { history[j][k] = history[j+1][k]; k++; }
-                                    history[j][k] = '\0';
+                                for (int j = 0; j < history_max - 1; j++) {
+                                    memcpy(history[j], history[j + 1], CMD_BUFFER_SIZE);
                                 }
-                                int i; for(i=0; i<=cmd_len; i++) history[HISTORY_MAX-1][i] = cmd_buffer[i];
+                                memcpy(history[history_max - 1], cmd_buffer, cmd_len + 1);
                             }
                         }
                         history_index = history_count;
@@ -446,6 +590,7 @@ void keyboard_handler_main(void)
 void timer_handler_main(void)
 {
         timer_ticks++;
+        wss_tick();
         write_port(0x20, 0x20);
 }
 
@@ -583,6 +728,7 @@ void idt_init(void)
         unsigned long timer_address    = (unsigned long)timer_handler;
         unsigned long mouse_address    = (unsigned long)mouse_handler;
         unsigned long pf_address       = (unsigned long)page_fault_stub;
+        unsigned long ata_address      = (unsigned long)ata_irq_stub;
         unsigned long idt_address      = (unsigned long)IDT;
         unsigned long idt_ptr[2];
 
@@ -607,6 +753,13 @@ void idt_init(void)
         IDT[0x2C].type_attr         = 0x8E;
         IDT[0x2C].offset_higherbits = (mouse_address >> 16) & 0xFFFF;
 
+        // Primary ATA (IRQ14) -> Int 0x2E
+        IDT[0x2E].offset_lowerbits  = ata_address & 0xFFFF;
+        IDT[0x2E].selector          = 0x08;
+        IDT[0x2E].zero              = 0;
+        IDT[0x2E].type_attr         = 0x8E;
+        IDT[0x2E].offset_higherbits = (ata_address >> 16) & 0xFFFF;
+
         // Page Fault (Int 14) -> Int 0x0E
         IDT[14].offset_lowerbits  = pf_address & 0xFFFF;
         IDT[14].selector          = 0x08;
@@ -626,27 +779,42 @@ void idt_init(void)
         
         // Unmask IRQ0, IRQ1, IRQ2 on Master
         write_port(0x21, 0xF8); 
-        // Unmask IRQ12 on Slave
-        write_port(0xA1, 0xEF); 
+        // Unmask IRQ12 and IRQ14 (swap disk) on Slave
+        write_port(0xA1, 0xAF); 
 
         idt_ptr[0] = (sizeof(struct IDT_entry) * IDT_SIZE) | ((idt_address & 0xFFFF) << 16);
         idt_ptr[1] = idt_address >> 16;
         load_idt((unsigned long *)idt_ptr);
 }
 
-void kmain(void)
+void kmain(uint32_t magic, multiboot_info_t *mbi)
 {
+        uint64_t boot_start = bench_now();
+        config_init(magic, mbi);
+
         // clear_screen();
         write_port(0x3F8, 'A');
         write_port(0x3F8, '\n');
         kprint("Booting MOKernel...\n");
 
+        kprint("Initializing String Routines...\n");
+        kstring_init();
+
+        kprint("Initializing Physical Memory...\n");
+        pmm_init_multiboot(magic, mbi);
+
         kprint("Initializing Paging...\n");
         paging_init();
 
+        kprint("Initializing Slab Allocator...\n");
+        slab_init();
+
         kprint("Initializing PIT Timer...\n");
         pit_init();
 
+        kprint("Calibrating TSC...\n");
+        bench_init();
+
         kprint("Initializing PS/2 Mouse...\n");
         mouse_init();
 
@@ -655,6 +823,7 @@ void kmain(void)
 
         kprint("Initializing File System...\n");
         fs_init();
+        initramfs_init(magic, mbi);
 
         kprint("Initializing Network Stack...\n");
         net_stack_init();
@@ -662,11 +831,17 @@ void kmain(void)
         // Draw initial cursor
         update_mouse_cursor(1);
 
+        boot_cycles = bench_now() - boot_start;
         kprint("\nKernel initialization complete!\n");
+        print_boot_info();
         kprint("OS> ");
 
+        // Idle: reclaim below the low watermark, keep the pre-zeroed
+        // page pool topped up, then sleep
         while (1)
         {
-                asm volatile("hlt");
+                if (pmm_reclaim_idle() == 0 && pmm_zero_refill() == 0) {
+                        asm volatile("hlt");
+                }
         }
 }
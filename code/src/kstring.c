@@ -0,0 +1,462 @@
+#include "kstring.h"
+#include "pmm.h"
+#include "bench.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+typedef void *(*memcpy_fn)(void *dst, const void *src, uint32_t n);
+typedef void *(*memset_fn)(void *dst, int val, uint32_t n);
+typedef int   (*memcmp_fn)(const void *a, const void *b, uint32_t n);
+
+/* 32-bit access to byte buffers without breaking aliasing rules */
+typedef uint32_t __attribute__((may_alias)) kword_t;
+
+uint32_t kstring_fxsr_enabled = 0;
+
+/* CPUID feature bits */
+#define CPUID1_EDX_FXSR (1u << 24)
+#define CPUID1_EDX_SSE2 (1u << 26)
+#define CPUID7_EBX_ERMS (1u << 9)
+
+/* =======================
+   Unrolled 32-bit loops
+   ======================= */
+static void *memcpy_unrolled(void *dst, const void *src, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    while (n >= 32) {
+        kword_t *dw = (kword_t *)d;
+        const kword_t *sw = (const kword_t *)s;
+        dw[0] = sw[0]; dw[1] = sw[1]; dw[2] = sw[2]; dw[3] = sw[3];
+        dw[4] = sw[4]; dw[5] = sw[5]; dw[6] = sw[6]; dw[7] = sw[7];
+        d += 32; s += 32; n -= 32;
+    }
+    while (n >= 4) {
+        *(kword_t *)d = *(const kword_t *)s;
+        d += 4; s += 4; n -= 4;
+    }
+    while (n--) *d++ = *s++;
+    return dst;
+}
+
+static void *memset_unrolled(void *dst, int val, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    uint32_t w = (uint8_t)val * 0x01010101u;
+
+    while (n >= 32) {
+        kword_t *dw = (kword_t *)d;
+        dw[0] = w; dw[1] = w; dw[2] = w; dw[3] = w;
+        dw[4] = w; dw[5] = w; dw[6] = w; dw[7] = w;
+        d += 32; n -= 32;
+    }
+    while (n >= 4) {
+        *(kword_t *)d = w;
+        d += 4; n -= 4;
+    }
+    while (n--) *d++ = (uint8_t)val;
+    return dst;
+}
+
+static int memcmp_bytes(const uint8_t *x, const uint8_t *y, uint32_t n)
+{
+    while (n--) {
+        if (*x != *y) return (int)*x - (int)*y;
+        x++; y++;
+    }
+    return 0;
+}
+
+static int memcmp_unrolled(const void *a, const void *b, uint32_t n)
+{
+    const uint8_t *x = (const uint8_t *)a;
+    const uint8_t *y = (const uint8_t *)b;
+
+    // Skip equal words, then find the differing byte
+    while (n >= 16) {
+        const kword_t *xw = (const kword_t *)x;
+        const kword_t *yw = (const kword_t *)y;
+        if (xw[0] != yw[0] || xw[1] != yw[1] || xw[2] != yw[2] || xw[3] != yw[3]) break;
+        x += 16; y += 16; n -= 16;
+    }
+    return memcmp_bytes(x, y, n);
+}
+
+/* =======================
+   String instructions
+   ======================= */
+static void *memcpy_movsd(void *dst, const void *src, uint32_t n)
+{
+    void *d = dst;
+    uint32_t words = n >> 2;
+    uint32_t tail = n & 3;
+    asm volatile("rep movsl\n\t"
+                 "mov %3, %%ecx\n\t"
+                 "rep movsb"
+                 : "+D"(d), "+S"(src), "+c"(words)
+                 : "r"(tail)
+                 : "memory");
+    return dst;
+}
+
+static void *memset_stosd(void *dst, int val, uint32_t n)
+{
+    void *d = dst;
+    uint32_t words = n >> 2;
+    uint32_t tail = n & 3;
+    asm volatile("rep stosl\n\t"
+                 "mov %3, %%ecx\n\t"
+                 "rep stosb"
+                 : "+D"(d), "+c"(words)
+                 : "a"((uint8_t)val * 0x01010101u), "r"(tail)
+                 : "memory");
+    return dst;
+}
+
+static int memcmp_cmpsd(const void *a, const void *b, uint32_t n)
+{
+    const uint8_t *x = (const uint8_t *)a;
+    const uint8_t *y = (const uint8_t *)b;
+    uint32_t words = n >> 2;
+
+    if (words) {
+        uint32_t left = words;
+        asm volatile("repe cmpsl"
+                     : "+S"(x), "+D"(y), "+c"(left)
+                     :
+                     : "memory", "cc");
+        uint32_t done = words - left;
+        // The scan stops after the first differing word: step back over it
+        if (*(const kword_t *)(x - 4) != *(const kword_t *)(y - 4)) {
+            x -= 4; y -= 4; done--;
+        }
+        n -= done * 4;
+    }
+    return memcmp_bytes(x, y, n);
+}
+
+/* Enhanced REP MOVSB/STOSB: the microcode picks the transfer size */
+static void *memcpy_erms(void *dst, const void *src, uint32_t n)
+{
+    void *d = dst;
+    asm volatile("rep movsb" : "+D"(d), "+S"(src), "+c"(n) :: "memory");
+    return dst;
+}
+
+static void *memset_erms(void *dst, int val, uint32_t n)
+{
+    void *d = dst;
+    asm volatile("rep stosb" : "+D"(d), "+c"(n) : "a"(val) : "memory");
+    return dst;
+}
+
+/* =======================
+   SSE2
+   ======================= */
+/* The kernel is built without -msse, so the compiler never keeps values
+   in xmm registers; the interrupt stubs fxsave around handlers instead. */
+#define SSE2_MIN 128    // below this the setup costs more than it saves
+
+static void *memcpy_sse2(void *dst, const void *src, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+    const uint8_t *s = (const uint8_t *)src;
+
+    if (n >= SSE2_MIN) {
+        // Align the destination, then move 64 bytes per iteration
+        uint32_t head = (16 - ((uint32_t)d & 15)) & 15;
+        memcpy_movsd(d, s, head);
+        d += head; s += head; n -= head;
+
+        uint32_t blocks = n >> 6;
+        asm volatile("1:\n\t"
+                     "movdqu   (%1), %%xmm0\n\t"
+                     "movdqu 16(%1), %%xmm1\n\t"
+                     "movdqu 32(%1), %%xmm2\n\t"
+                     "movdqu 48(%1), %%xmm3\n\t"
+                     "movdqa %%xmm0,   (%0)\n\t"
+                     "movdqa %%xmm1, 16(%0)\n\t"
+                     "movdqa %%xmm2, 32(%0)\n\t"
+                     "movdqa %%xmm3, 48(%0)\n\t"
+                     "add $64, %1\n\t"
+                     "add $64, %0\n\t"
+                     "dec %2\n\t"
+                     "jnz 1b"
+                     : "+r"(d), "+r"(s), "+r"(blocks)
+                     :
+                     : "memory", "cc");
+        n &= 63;
+    }
+    memcpy_movsd(d, s, n);
+    return dst;
+}
+
+static void *memset_sse2(void *dst, int val, uint32_t n)
+{
+    uint8_t *d = (uint8_t *)dst;
+
+    if (n >= SSE2_MIN) {
+        uint32_t head = (16 - ((uint32_t)d & 15)) & 15;
+        memset_stosd(d, val, head);
+        d += head; n -= head;
+
+        static uint8_t pattern[16] __attribute__((aligned(16)));
+        memset_stosd(pattern, val, sizeof(pattern));
+
+        uint32_t blocks = n >> 6;
+        asm volatile("movdqa (%2), %%xmm0\n\t"
+                     "1:\n\t"
+                     "movdqa %%xmm0,   (%0)\n\t"
+                     "movdqa %%xmm0, 16(%0)\n\t"
+                     "movdqa %%xmm0, 32(%0)\n\t"
+                     "movdqa %%xmm0, 48(%0)\n\t"
+                     "add $64, %0\n\t"
+                     "dec %1\n\t"
+                     "jnz 1b"
+                     : "+r"(d), "+r"(blocks)
+                     : "r"(pattern)
+                     : "memory", "cc");
+        n &= 63;
+    }
+    memset_stosd(d, val, n);
+    return dst;
+}
+
+static int memcmp_sse2(const void *a, const void *b, uint32_t n)
+{
+    const uint8_t *x = (const uint8_t *)a;
+    const uint8_t *y = (const uint8_t *)b;
+
+    // Compare 16 bytes at a time until a block differs
+    while (n >= 16) {
+        uint32_t mask;
+        asm volatile("movdqu (%1), %%xmm0\n\t"
+                     "movdqu (%2), %%xmm1\n\t"
+                     "pcmpeqb %%xmm1, %%xmm0\n\t"
+                     "pmovmskb %%xmm0, %0"
+                     : "=r"(mask)
+                     : "r"(x), "r"(y)
+                     : "memory");
+        if (mask != 0xFFFF) break;
+        x += 16; y += 16; n -= 16;
+    }
+    return memcmp_bytes(x, y, n);
+}
+
+/* =======================
+   Dispatch
+   ======================= */
+typedef struct {
+    const char *name;
+    int         available;
+    memcpy_fn   cpy;
+    memset_fn   set;
+    memcmp_fn   cmp;
+} kstring_variant_t;
+
+#define KSTRING_UNROLLED 0
+#define KSTRING_MOVSD    1
+#define KSTRING_ERMS     2
+#define KSTRING_SSE2     3
+
+static kstring_variant_t kstring_variants[] = {
+    { "unrolled", 1, memcpy_unrolled, memset_unrolled, memcmp_unrolled },
+    { "movsd",    1, memcpy_movsd,    memset_stosd,    memcmp_cmpsd    },
+    { "erms",     0, memcpy_erms,     memset_erms,     memcmp_unrolled },
+    { "sse2",     0, memcpy_sse2,     memset_sse2,     memcmp_sse2     },
+};
+#define KSTRING_VARIANTS (sizeof(kstring_variants) / sizeof(kstring_variants[0]))
+
+static memcpy_fn memcpy_impl = memcpy_unrolled;
+static memset_fn memset_impl = memset_unrolled;
+static memcmp_fn memcmp_impl = memcmp_unrolled;
+
+void *memcpy(void *dst, const void *src, uint32_t n)
+{
+    return memcpy_impl(dst, src, n);
+}
+
+void *memset(void *dst, int val, uint32_t n)
+{
+    return memset_impl(dst, val, n);
+}
+
+int memcmp(const void *a, const void *b, uint32_t n)
+{
+    return memcmp_impl(a, b, n);
+}
+
+void *memset16(void *dst, uint16_t val, uint32_t count)
+{
+    void *d = dst;
+    asm volatile("rep stosw" : "+D"(d), "+c"(count) : "a"(val) : "memory");
+    return dst;
+}
+
+/* Returns EAX */
+static uint32_t cpuid(uint32_t leaf, uint32_t *ebx, uint32_t *edx)
+{
+    uint32_t eax = leaf, ecx = 0;
+    asm volatile("cpuid" : "+a"(eax), "=b"(*ebx), "+c"(ecx), "=d"(*edx));
+    return eax;
+}
+
+void kstring_init(void)
+{
+    uint32_t ebx, edx;
+    uint32_t max_leaf = cpuid(0, &ebx, &edx);
+
+    cpuid(1, &ebx, &edx);
+    if ((edx & CPUID1_EDX_SSE2) && (edx & CPUID1_EDX_FXSR)) {
+        // Enable SSE: no x87 emulation, monitor coprocessor, OS saves
+        // state with fxsave and handles SIMD exceptions
+        uint32_t cr0, cr4;
+        asm volatile("mov %%cr0, %0" : "=r"(cr0));
+        cr0 &= ~0x4;  // EM
+        cr0 |= 0x2;   // MP
+        asm volatile("mov %0, %%cr0" :: "r"(cr0));
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= 0x600; // OSFXSR | OSXMMEXCPT
+        asm volatile("mov %0, %%cr4" :: "r"(cr4));
+        asm volatile("fninit");
+        kstring_fxsr_enabled = 1;
+        kstring_variants[KSTRING_SSE2].available = 1;
+    }
+
+    if (max_leaf >= 7) {
+        cpuid(7, &ebx, &edx);
+        if (ebx & CPUID7_EBX_ERMS) {
+            kstring_variants[KSTRING_ERMS].available = 1;
+        }
+    }
+
+    // ERMS string moves for copy and fill, SSE2 for compare
+    int best = KSTRING_MOVSD;
+    if (kstring_variants[KSTRING_ERMS].available) {
+        best = KSTRING_ERMS;
+    } else if (kstring_variants[KSTRING_SSE2].available) {
+        best = KSTRING_SSE2;
+    }
+    memcpy_impl = kstring_variants[best].cpy;
+    memset_impl = kstring_variants[best].set;
+    memcmp_impl = kstring_variants[kstring_variants[KSTRING_SSE2].available ?
+                                   KSTRING_SSE2 : KSTRING_UNROLLED].cmp;
+
+    kprint("String routines: ");
+    kprint(kstring_variants[best].name);
+    kprint(kstring_variants[KSTRING_SSE2].available ? " (memcmp sse2)\n" : " (memcmp unrolled)\n");
+}
+
+/* =======================
+   Benchmark
+   ======================= */
+#define KSTRING_BENCH_ORDER 8                   // 1MB buffers
+#define KSTRING_BENCH_BYTES (8 * 1024 * 1024)   // moved per measurement
+
+static const uint32_t kstring_bench_sizes[] = { 64, 512, 4096, 65536, 1048576 };
+#define KSTRING_BENCH_SIZES (sizeof(kstring_bench_sizes) / sizeof(kstring_bench_sizes[0]))
+
+/* Print GB/s with two decimals for KSTRING_BENCH_BYTES moved in `cycles` */
+static void kstring_print_gbps(uint64_t cycles)
+{
+    uint32_t khz = bench_tsc_khz();
+    while (cycles >> 32) cycles >>= 1, khz >>= 1;
+    // Bytes per millisecond fit in 32 bits; 10^4 of them are 0.01 GB/s
+    uint32_t x100 = cycles ? (uint32_t)bench_div64((uint64_t)KSTRING_BENCH_BYTES * khz,
+                                                   (uint32_t)cycles) / 10000 : 0;
+    kprint(" ");
+    if (x100 < 1000) kprint(" ");
+    kprint_dec(x100 / 100);
+    kprint(".");
+    if (x100 % 100 < 10) kprint("0");
+    kprint_dec(x100 % 100);
+}
+
+/* Check a variant against the unrolled reference at odd sizes and offsets */
+static int kstring_verify(const kstring_variant_t *v, uint8_t *a, uint8_t *b)
+{
+    for (uint32_t off = 0; off < 4; off++) {
+        for (uint32_t n = 0; n < 300; n += 7) {
+            memset_unrolled(a, 0x11, 512);
+            memset_unrolled(b, 0x22, 512);
+            v->set(a + off, 0x5A, n);
+            for (uint32_t i = 0; i < 512; i++) {
+                uint8_t want = (i >= off && i < off + n) ? 0x5A : 0x11;
+                if (a[i] != want) return 0;
+            }
+            v->cpy(b + 3 - off, a + off, n);
+            if (memcmp_unrolled(b + 3 - off, a + off, n) != 0) return 0;
+            if (v->cmp(b + 3 - off, a + off, n) != 0) return 0;
+            if (n) {
+                b[3 - off + n / 2] ^= 1;
+                if (v->cmp(b + 3 - off, a + off, n) == 0) return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+void kstring_bench(void)
+{
+    uint32_t src = pmm_alloc_pages(KSTRING_BENCH_ORDER);
+    uint32_t dst = pmm_alloc_pages(KSTRING_BENCH_ORDER);
+    if (!src || !dst) {
+        kprint("membench: out of memory\n");
+        if (src) pmm_free_pages(src, KSTRING_BENCH_ORDER);
+        if (dst) pmm_free_pages(dst, KSTRING_BENCH_ORDER);
+        return;
+    }
+    uint8_t *s = (uint8_t *)src;
+    uint8_t *d = (uint8_t *)dst;
+    memset_unrolled(s, 0xA5, 1 << (KSTRING_BENCH_ORDER + 12));
+    memset_unrolled(d, 0xA5, 1 << (KSTRING_BENCH_ORDER + 12));
+
+    for (int op = 0; op < 3; op++) {
+        kprint(op == 0 ? "memcpy GB/s " : op == 1 ? "memset GB/s " : "memcmp GB/s ");
+        for (uint32_t z = 0; z < KSTRING_BENCH_SIZES; z++) {
+            uint32_t size = kstring_bench_sizes[z];
+            kprint(size >= 1048576 ? "    1MB" : size >= 65536 ? "   64KB" :
+                   size >= 4096 ? "    4KB" : size >= 512 ? "   512B" : "    64B");
+        }
+        kprint("\n");
+
+        for (uint32_t v = 0; v < KSTRING_VARIANTS; v++) {
+            const kstring_variant_t *var = &kstring_variants[v];
+            if (!var->available) continue;
+
+            kprint("  ");
+            kprint(var->name);
+            uint32_t len = 0;
+            while (var->name[len]) len++;
+            while (len++ < 10) kprint(" ");
+
+            for (uint32_t z = 0; z < KSTRING_BENCH_SIZES; z++) {
+                uint32_t size = kstring_bench_sizes[z];
+                uint32_t reps = KSTRING_BENCH_BYTES / size;
+                uint64_t start = bench_now();
+                for (uint32_t r = 0; r < reps; r++) {
+                    if (op == 0) var->cpy(d, s, size);
+                    else if (op == 1) var->set(d, 0xA5, size);
+                    else var->cmp(d, s, size);
+                }
+                kstring_print_gbps(bench_now() - start);
+            }
+            kprint("\n");
+        }
+    }
+
+    kprint("Verify:");
+    for (uint32_t v = 0; v < KSTRING_VARIANTS; v++) {
+        if (!kstring_variants[v].available) continue;
+        kprint(" ");
+        kprint(kstring_variants[v].name);
+        kprint(kstring_verify(&kstring_variants[v], d, s) ? " ok" : " FAILED");
+    }
+    kprint("\n");
+
+    pmm_free_pages(src, KSTRING_BENCH_ORDER);
+    pmm_free_pages(dst, KSTRING_BENCH_ORDER);
+}
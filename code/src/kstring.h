@@ -0,0 +1,31 @@
+#ifndef KSTRING_H
+#define KSTRING_H
+
+#include "paging.h" // For types
+
+/*
+   Kernel string library.
+   memcpy/memset/memcmp dispatch through function pointers chosen at boot
+   from CPUID: ERMS "rep movsb/stosb", SSE2 16-byte moves, "rep movsd/stosd",
+   or unrolled 32-bit loops. Until kstring_init() runs the unrolled
+   versions are used.
+*/
+
+void *memcpy(void *dst, const void *src, uint32_t n);
+void *memset(void *dst, int val, uint32_t n);
+int   memcmp(const void *a, const void *b, uint32_t n);
+
+/* Fill `count` 16-bit cells (e.g. VGA text characters) */
+void *memset16(void *dst, uint16_t val, uint32_t count);
+
+/* Nonzero once SSE is enabled: interrupt stubs then preserve the
+   SSE registers with fxsave/fxrstor */
+extern uint32_t kstring_fxsr_enabled;
+
+/* Probe CPUID, enable SSE if present and select the fastest variants */
+void kstring_init(void);
+
+/* GB/s per size class for every available variant (shell: membench) */
+void kstring_bench(void);
+
+#endif
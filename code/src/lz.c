@@ -0,0 +1,152 @@
+#include "lz.h"
+#include "kstring.h"
+
+#define LZ_HASH_BITS  12
+#define LZ_MIN_MATCH  4
+#define LZ_MAX_OFFSET 0xFFFF
+
+/* Last position seen for each hashed 4-byte sequence. Entries left over
+   from an earlier buffer are harmless: every candidate is verified
+   against the current input before it is used. */
+static uint16_t lz_table[1 << LZ_HASH_BITS];
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+           ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint32_t lz_hash(uint32_t seq)
+{
+    return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Write a length continuation: runs of 255 then the remainder */
+static inline uint32_t lz_put_len(uint8_t *dst, uint32_t op, uint32_t len)
+{
+    while (len >= 255) {
+        dst[op++] = 255;
+        len -= 255;
+    }
+    dst[op++] = (uint8_t)len;
+    return op;
+}
+
+/* Emit one sequence; match_len == 0 marks the final literals-only one.
+   Returns the new output position, or 0 if dst is too small. */
+static uint32_t lz_emit(const uint8_t *lit, uint32_t lit_len,
+                        uint32_t offset, uint32_t match_len,
+                        uint8_t *dst, uint32_t op, uint32_t dst_max)
+{
+    uint32_t need = 1 + lit_len + lit_len / 255 + 1 + 2 + match_len / 255 + 1;
+    if (op + need > dst_max) {
+        return 0;
+    }
+
+    uint32_t token = op++;
+    dst[token] = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) {
+        op = lz_put_len(dst, op, lit_len - 15);
+    }
+    memcpy(dst + op, lit, lit_len);
+    op += lit_len;
+
+    if (match_len) {
+        uint32_t ml = match_len - LZ_MIN_MATCH;
+        dst[op++] = (uint8_t)offset;
+        dst[op++] = (uint8_t)(offset >> 8);
+        dst[token] |= (uint8_t)(ml >= 15 ? 15 : ml);
+        if (ml >= 15) {
+            op = lz_put_len(dst, op, ml - 15);
+        }
+    }
+    return op;
+}
+
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_max)
+{
+    uint32_t ip = 0, anchor = 0, op = 0;
+
+    while (ip + LZ_MIN_MATCH <= src_len) {
+        uint32_t seq = lz_read32(src + ip);
+        uint32_t h = lz_hash(seq);
+        uint32_t ref = lz_table[h];
+        lz_table[h] = (uint16_t)ip;
+
+        if (ref >= ip || ip - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != seq) {
+            // Step faster through data that keeps missing
+            ip += 1 + ((ip - anchor) >> 6);
+            continue;
+        }
+
+        uint32_t len = LZ_MIN_MATCH;
+        while (ip + len < src_len && src[ref + len] == src[ip + len]) {
+            len++;
+        }
+
+        op = lz_emit(src + anchor, ip - anchor, ip - ref, len, dst, op, dst_max);
+        if (!op) {
+            return 0;
+        }
+        ip += len;
+        anchor = ip;
+    }
+
+    return lz_emit(src + anchor, src_len - anchor, 0, 0, dst, op, dst_max);
+}
+
+uint32_t lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_max)
+{
+    uint32_t ip = 0, op = 0;
+
+    while (ip < src_len) {
+        uint32_t token = src[ip++];
+        uint32_t b;
+
+        uint32_t lit = token >> 4;
+        if (lit == 15) {
+            do {
+                if (ip >= src_len) return 0;
+                b = src[ip++];
+                lit += b;
+            } while (b == 255);
+        }
+        if (ip + lit > src_len || op + lit > dst_max) {
+            return 0;
+        }
+        memcpy(dst + op, src + ip, lit);
+        op += lit;
+        ip += lit;
+
+        if (ip == src_len) {
+            break; // Final literals-only sequence
+        }
+
+        if (ip + 2 > src_len) return 0;
+        uint32_t offset = src[ip] | ((uint32_t)src[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return 0;
+        }
+
+        uint32_t len = token & 15;
+        if (len == 15) {
+            do {
+                if (ip >= src_len) return 0;
+                b = src[ip++];
+                len += b;
+            } while (b == 255);
+        }
+        len += LZ_MIN_MATCH;
+        if (op + len > dst_max) {
+            return 0;
+        }
+
+        // Byte copy: the match may overlap the bytes it produces
+        const uint8_t *m = dst + op - offset;
+        for (uint32_t i = 0; i < len; i++) {
+            dst[op++] = m[i];
+        }
+    }
+    return op;
+}
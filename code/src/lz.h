@@ -0,0 +1,23 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include "paging.h" // For types
+
+/*
+   LZ77 block compressor in the LZ4 block format: each sequence is a
+   token (literal length << 4 | match length - 4), optional length
+   extension bytes, the literals, then a 16-bit little endian offset and
+   match length extension. The last sequence carries literals only.
+   Greedy matching through a 4-byte hash table, no entropy stage.
+*/
+
+/* Compress src into dst. Returns the compressed length, or 0 if the
+   result would not fit in dst_max bytes. src_len must be below 64KB.
+   Not reentrant (the match table is static). */
+uint32_t lz_compress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_max);
+
+/* Decompress into dst. Returns the decompressed length, or 0 if the
+   input is malformed or would overflow dst_max bytes. */
+uint32_t lz_decompress(const uint8_t *src, uint32_t src_len, uint8_t *dst, uint32_t dst_max);
+
+#endif
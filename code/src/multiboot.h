@@ -0,0 +1,56 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "paging.h" // For types
+
+/* 
+   Multiboot (version 1) boot information.
+   GRUB leaves a pointer to this structure in EBX and the magic value in EAX;
+   start.asm passes both on to kmain().
+*/
+
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* multiboot_info_t.flags */
+#define MULTIBOOT_INFO_MEMORY   0x001   // mem_lower / mem_upper valid
+#define MULTIBOOT_INFO_CMDLINE  0x004   // cmdline valid
+#define MULTIBOOT_INFO_MODS     0x008   // mods_count / mods_addr valid
+#define MULTIBOOT_INFO_MEM_MAP  0x040   // mmap_length / mmap_addr valid
+
+/* multiboot_mmap_entry_t.type */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+typedef struct {
+    uint32_t flags;
+    uint32_t mem_lower;      // KB of memory below 1MB
+    uint32_t mem_upper;      // KB of memory above 1MB (up to the first hole)
+    uint32_t boot_device;
+    uint32_t cmdline;
+    uint32_t mods_count;
+    uint32_t mods_addr;
+    uint32_t syms[4];
+    uint32_t mmap_length;
+    uint32_t mmap_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+/* One boot module (mods_addr points at mods_count of these). With
+   MB_PAGEALIGN in the kernel header each starts on a page boundary. */
+typedef struct {
+    uint32_t mod_start;
+    uint32_t mod_end;        // exclusive
+    uint32_t string;         // module command line
+    uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+/* One BIOS E820 region. `size` does not count itself, so the next entry
+   starts at (uint8_t *)entry + entry->size + 4. */
+typedef struct {
+    uint32_t size;
+    uint32_t base_low;
+    uint32_t base_high;
+    uint32_t len_low;
+    uint32_t len_high;
+    uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+#endif
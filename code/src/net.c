@@ -2,52 +2,23 @@
 // MOKernel Networking Stack Implementation
 // ============================================================
 #include "net.h"
+#include "slab.h"
+#include "kstring.h"
+#include "shrink.h"
+#include "pmm.h"
+#include "config.h"
 
 // ---- external kernel helpers --------------------------------
 extern void  kprint(const char *s);
 extern void  kprint_hex(unsigned int v);
+extern void  kprint_dec(unsigned int v);
 extern void  write_port(unsigned short port, unsigned char data);
 extern unsigned char read_port(unsigned short port);
 
 // --------------- Utility helpers (no libc) -------------------
 
-static void memset_n(void *dst, u8 val, u16 n) {
-    u8 *d = (u8 *)dst;
-    while (n--) *d++ = val;
-}
-
-static void memcpy_n(void *dst, const void *src, u16 n) {
-    u8 *d = (u8 *)dst;
-    const u8 *s = (const u8 *)src;
-    while (n--) *d++ = *s++;
-}
-
-static int memcmp_n(const void *a, const void *b, u16 n) {
-    const u8 *x = (const u8 *)a, *y = (const u8 *)b;
-    while (n--) {
-        if (*x != *y) return (int)*x - (int)*y;
-        x++; y++;
-    }
-    return 0;
-}
-
-static u16 strlen_n(const char *s) {
-    u16 n = 0;
-    while (*s++) n++;
-    return n;
-}
-
 static int isdigit_n(char c) { return c >= '0' && c <= '9'; }
 
-// Print a decimal number
-static void kprint_dec(u32 v) {
-    char buf[12];
-    int i = 0;
-    if (v == 0) { kprint("0"); return; }
-    while (v) { buf[i++] = '0' + (v % 10); v /= 10; }
-    while (i--) { char s[2] = {buf[i], '\0'}; kprint(s); }
-}
-
 // Print an IP address (host byte order big-endian u32)
 static void kprint_ip(ip_addr_t ip) {
     kprint_dec((ip >> 24) & 0xFF); kprint(".");
@@ -135,18 +106,17 @@ mac_addr_t net_mac;
 ip_addr_t  net_ip  = MAKE_IP(10, 0, 2, 15); // QEMU default DHCP lease
 u16        net_iobase = 0;
 
-static u8 rx_buf[RTL_RX_BUF_SIZE]  __attribute__((aligned(4)));
-static u8 tx_buf[RTL_TX_DESC_NUM][RTL_TX_BUF_SIZE] __attribute__((aligned(4)));
+// DMA buffers, allocated once a NIC is found: the Rx ring (plus the
+// overflow area the chip writes past its end in WRAP mode) followed by
+// the Tx buffers, in one physically contiguous PMM block
+static u8  *rx_buf = 0;
+static u8  *tx_buf = 0;           // RTL_TX_DESC_NUM * RTL_TX_BUF_SIZE bytes
+static u32  rx_ring_len = 0;      // 8K << RBLEN, from the net_rx boot option
+static u32  net_buf_order = 0;
 static int tx_cur = 0;
 static u16 rx_cur = 0;  // software read pointer (byte offset into rx_buf)
 
-// 16-bit port helpers (RTL8139 uses 16-bit registers too)
-static u16 rtl_inw(u8 reg) {
-    u8 lo = read_port(net_iobase + reg);
-    u8 hi = read_port(net_iobase + reg + 1);
-    return (u16)((u16)hi << 8 | lo);
-}
-
+// 16-bit port helper (RTL8139 uses 16-bit registers too)
 static void rtl_outw(u8 reg, u16 val) {
     write_port(net_iobase + reg,     (u8)(val & 0xFF));
     write_port(net_iobase + reg + 1, (u8)((val >> 8) & 0xFF));
@@ -222,22 +192,40 @@ int net_init(void) {
     kprint_mac(&net_mac);
     kprint("\n");
 
+    // ---- Allocate Rx ring + Tx buffers ------------------------
+    // Ring size in KB (8, 16 or 32); WRAP mode cannot use the 64K ring
+    u32 rblen = 0;
+    u32 ring_kb = config_get("net_rx", RTL_RX_RING_DEFAULT_KB);
+    while (rblen < 2 && (8u << rblen) < ring_kb) rblen++;
+    rx_ring_len = (8 * 1024) << rblen;
+
+    u32 bytes = RTL_RX_BUF_SIZE(rx_ring_len) + RTL_TX_DESC_NUM * RTL_TX_BUF_SIZE;
+    net_buf_order = 0;
+    while (((u32)PAGE_SIZE << net_buf_order) < bytes) net_buf_order++;
+    u32 phys = pmm_alloc_pages(net_buf_order);
+    if (!phys) {
+        kprint("[NET] Out of memory for DMA buffers.\n");
+        net_iobase = 0;
+        return -1;
+    }
+    rx_buf = (u8 *)(unsigned long)phys;              // Direct mapped
+    tx_buf = rx_buf + RTL_RX_BUF_SIZE(rx_ring_len);
+
     // ---- Set up Rx ring buffer --------------------------------
-    u32 rbstart = (u32)(unsigned long)rx_buf;
-    rtl_outl(RTL_RBSTART, rbstart);
+    rtl_outl(RTL_RBSTART, phys);
 
     // ---- Set Rx Config: accept broadcast + physical match ----
     rtl_outl(RTL_RCR,
         RTL_RCR_AB | RTL_RCR_APM | RTL_RCR_AAP | RTL_RCR_AM |
         RTL_RCR_WRAP | RTL_RCR_MXDMA_UNLIM |
-        RTL_RCR_RBLEN_32K | RTL_RCR_RXFTH_NONE);
+        RTL_RCR_RBLEN(rblen) | RTL_RCR_RXFTH_NONE);
 
     // ---- Set Tx Config ---------------------------------------
     rtl_outl(RTL_TCR, 0x03000700); // IFG normal, max DMA unlimited
 
     // ---- Set Tx buffer addresses in descriptor regs ----------
     for (int i = 0; i < RTL_TX_DESC_NUM; i++) {
-        rtl_outl(RTL_TSAD0 + i * 4, (u32)(unsigned long)tx_buf[i]);
+        rtl_outl(RTL_TSAD0 + i * 4, (u32)(unsigned long)(tx_buf + i * RTL_TX_BUF_SIZE));
     }
 
     // ---- Enable Rx + Tx --------------------------------------
@@ -249,7 +237,9 @@ int net_init(void) {
     // ---- Initialize ring buffer pointer ----------------------
     rx_cur = 0;
 
-    kprint("[NET] RTL8139 initialized. IP: ");
+    kprint("[NET] RTL8139 initialized, ");
+    kprint_dec(rx_ring_len / 1024);
+    kprint(" KB Rx ring. IP: ");
     kprint_ip(net_ip);
     kprint("\n");
 
@@ -276,25 +266,25 @@ static u16 rtl_recv(u8 *out_buf) {
     if (data_len == 0 || data_len > 1514) {
         // Corrupt / empty — advance by 4 (header only)
         rx_cur = (rx_cur + 4 + 3) & ~3;
-        rx_cur %= sizeof(rx_buf);
+        rx_cur %= rx_ring_len;
         rtl_outw(RTL_CAPR, (u16)(rx_cur - 16));
         return 0;
     }
 
     // Copy packet data
-    if (rx_cur + 4 + data_len <= sizeof(rx_buf)) {
-        memcpy_n(out_buf, ptr + 4, data_len);
+    if ((u32)(rx_cur + 4 + data_len) <= RTL_RX_BUF_SIZE(rx_ring_len)) {
+        memcpy(out_buf, ptr + 4, data_len);
     } else {
         // Wraparound copy
-        u16 first  = (u16)(sizeof(rx_buf) - rx_cur - 4);
+        u16 first  = (u16)(RTL_RX_BUF_SIZE(rx_ring_len) - rx_cur - 4);
         u16 second = data_len - first;
-        memcpy_n(out_buf, ptr + 4, first);
-        memcpy_n(out_buf + first, rx_buf, second);
+        memcpy(out_buf, ptr + 4, first);
+        memcpy(out_buf + first, rx_buf, second);
     }
 
     // Advance ring pointer (DWORD-aligned, +4 for header)
     rx_cur = (rx_cur + pkt_len + 4 + 3) & ~3;
-    rx_cur %= sizeof(rx_buf);
+    rx_cur %= rx_ring_len;
     rtl_outw(RTL_CAPR, (u16)(rx_cur - 16));
 
     return data_len;
@@ -305,7 +295,7 @@ int net_send(const u8 *frame, u16 len) {
     if (!net_iobase || len > RTL_TX_BUF_SIZE) return -1;
 
     // Copy to transmit buffer
-    memcpy_n(tx_buf[tx_cur], frame, len);
+    memcpy(tx_buf + tx_cur * RTL_TX_BUF_SIZE, frame, len);
 
     // Write address already set in init; write length + OWN to TSD
     // TSD: bits[12:0] = size, bit13 = OWN (0 means NIC owns it)
@@ -326,7 +316,7 @@ int net_send(const u8 *frame, u16 len) {
 // Ethernet
 // ============================================================
 
-static u8 pkt_buf[1518];  // Scratch buffer for received frames
+static kmem_cache_t *net_pkt_cache = 0;  // frame buffers for Rx and Tx
 
 static void eth_process(const u8 *frame, u16 len) {
     if (len < (u16)sizeof(eth_hdr_t)) return;
@@ -346,8 +336,8 @@ static void eth_process(const u8 *frame, u16 len) {
 // Build Ethernet frame header into buf, return header length
 static u16 eth_build(u8 *buf, const mac_addr_t *dst, u16 ethertype) {
     eth_hdr_t *h = (eth_hdr_t *)buf;
-    memcpy_n(h->dst.b, dst->b, 6);
-    memcpy_n(h->src.b, net_mac.b, 6);
+    memcpy(h->dst.b, dst->b, 6);
+    memcpy(h->src.b, net_mac.b, 6);
     h->ethertype = htons(ethertype);
     return sizeof(eth_hdr_t);
 }
@@ -355,41 +345,117 @@ static u16 eth_build(u8 *buf, const mac_addr_t *dst, u16 ethertype) {
 // Poll the NIC for incoming frames
 void net_poll(void) {
     u16 len;
-    while ((len = rtl_recv(pkt_buf)) > 0) {
-        eth_process(pkt_buf, len);
+    if (!net_pkt_cache) return;
+    u8 *buf = (u8 *)kmem_cache_alloc(net_pkt_cache);
+    if (!buf) return;
+    while ((len = rtl_recv(buf)) > 0) {
+        eth_process(buf, len);
     }
+    kmem_cache_free(net_pkt_cache, buf);
 }
 
 // ============================================================
 // ARP
 // ============================================================
 
-arp_entry_t arp_cache[ARP_CACHE_SIZE];
+arp_entry_t *arp_cache = 0;
+static int arp_count = 0;
+static kmem_cache_t *arp_entry_cache = 0;
+
+// Shrinker: entries are rebuilt by the next ARP exchange, so under
+// memory pressure whole slabs of them are dropped, oldest entry first.
+// Empty slabs are left to the slab shrinker.
+static uint32_t arp_slab_of(const arp_entry_t *e) {
+    return (uint32_t)e & ~((PAGE_SIZE << arp_entry_cache->order) - 1);
+}
+
+static uint32_t arp_shrink_count(void) {
+    if (!arp_count) return 0;
+    uint32_t slabs = 0;
+    for (arp_entry_t *e = arp_cache; e; e = e->next) {
+        // Count each slab at its first entry
+        arp_entry_t *f = arp_cache;
+        while (f != e && arp_slab_of(f) != arp_slab_of(e)) f = f->next;
+        if (f == e) slabs++;
+    }
+    return slabs << arp_entry_cache->order;
+}
+
+static uint32_t arp_shrink_scan(uint32_t nr) {
+    uint32_t freed = 0;
+    while (arp_cache && freed < nr) {
+        // Drop every entry sharing a slab with the oldest one
+        arp_entry_t *e;
+        for (e = arp_cache; e->next; e = e->next);
+        uint32_t slab = arp_slab_of(e);
+        arp_entry_t **link = &arp_cache;
+        while ((e = *link) != 0) {
+            if (arp_slab_of(e) == slab) {
+                *link = e->next;
+                kmem_cache_free(arp_entry_cache, e);
+                arp_count--;
+            } else {
+                link = &e->next;
+            }
+        }
+        freed += kmem_cache_shrink(arp_entry_cache);
+    }
+    return freed;
+}
+
+static shrinker_t arp_shrinker = {
+    .name     = "arp",
+    .priority = 20,
+    .count    = arp_shrink_count,
+    .scan     = arp_shrink_scan,
+};
 
 static void arp_cache_init(void) {
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) arp_cache[i].valid = 0;
+    arp_entry_cache = kmem_cache_create("arp_entry", sizeof(arp_entry_t), 0);
+    arp_cache = 0;
+    arp_count = 0;
+    if (arp_entry_cache) shrinker_register(&arp_shrinker);
 }
 
 static void arp_cache_insert(ip_addr_t ip, const mac_addr_t *mac) {
-    // Overwrite first invalid slot, or slot 0
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (!arp_cache[i].valid || arp_cache[i].ip == ip) {
-            arp_cache[i].ip    = ip;
-            arp_cache[i].mac   = *mac;
-            arp_cache[i].valid = 1;
+    arp_entry_t *e, *prev = 0;
+
+    // Update an existing entry and move it to the front
+    for (e = arp_cache; e; prev = e, e = e->next) {
+        if (e->ip == ip) {
+            e->mac = *mac;
+            if (prev) {
+                prev->next = e->next;
+                e->next    = arp_cache;
+                arp_cache  = e;
+            }
             return;
         }
     }
-    // Evict slot 0
-    arp_cache[0].ip    = ip;
-    arp_cache[0].mac   = *mac;
-    arp_cache[0].valid = 1;
+
+    if (arp_count < ARP_CACHE_MAX && arp_entry_cache) {
+        e = (arp_entry_t *)kmem_cache_alloc(arp_entry_cache);
+        if (e) arp_count++;
+    }
+    if (!e) {
+        // Full (or out of memory): recycle the oldest entry
+        if (!arp_cache) return;
+        prev = 0;
+        for (e = arp_cache; e->next; prev = e, e = e->next);
+        if (prev) prev->next = 0;
+        else arp_cache = 0;
+    }
+
+    e->ip     = ip;
+    e->mac    = *mac;
+    e->next   = arp_cache;
+    arp_cache = e;
 }
 
 int arp_lookup(ip_addr_t ip, mac_addr_t *out_mac) {
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].valid && arp_cache[i].ip == ip) {
-            *out_mac = arp_cache[i].mac;
+    for (arp_entry_t *e = arp_cache; e; e = e->next) {
+        if (e->ip == ip) {
+            *out_mac = e->mac;
             return 1;
         }
     }
@@ -449,14 +515,12 @@ void arp_handle(const u8 *pkt, u16 len) {
 
 void arp_print_cache(void) {
     int found = 0;
-    for (int i = 0; i < ARP_CACHE_SIZE; i++) {
-        if (arp_cache[i].valid) {
-            kprint_ip(arp_cache[i].ip);
-            kprint("  ->  ");
-            kprint_mac(&arp_cache[i].mac);
-            kprint("\n");
-            found++;
-        }
+    for (arp_entry_t *e = arp_cache; e; e = e->next) {
+        kprint_ip(e->ip);
+        kprint("  ->  ");
+        kprint_mac(&e->mac);
+        kprint("\n");
+        found++;
     }
     if (!found) kprint("(ARP cache empty)\n");
 }
@@ -523,7 +587,9 @@ int ip_send(ip_addr_t dst_ip, u8 proto, const u8 *payload, u16 plen) {
 
     u16 total = (u16)(sizeof(ip_hdr_t) + plen);
     u16 frame_size = (u16)(sizeof(eth_hdr_t) + total);
-    u8 frame[1500] = {0};
+    if (frame_size > NET_PKT_BUF_SIZE || !net_pkt_cache) return -1;
+    u8 *frame = (u8 *)kmem_cache_alloc(net_pkt_cache);
+    if (!frame) return -1;
 
     u16 off = eth_build(frame, &dst_mac, ETH_TYPE_IP);
     ip_hdr_t *ip = (ip_hdr_t *)(frame + off);
@@ -539,8 +605,10 @@ int ip_send(ip_addr_t dst_ip, u8 proto, const u8 *payload, u16 plen) {
     ip->dst        = htonl(dst_ip);
     ip->checksum   = ip_checksum(ip, sizeof(ip_hdr_t));
 
-    memcpy_n(frame + off + sizeof(ip_hdr_t), payload, plen);
-    return net_send(frame, frame_size);
+    memcpy(frame + off + sizeof(ip_hdr_t), payload, plen);
+    int ret = net_send(frame, frame_size);
+    kmem_cache_free(net_pkt_cache, frame);
+    return ret;
 }
 
 // ============================================================
@@ -558,7 +626,7 @@ void icmp_handle(ip_addr_t src_ip, const u8 *pkt, u16 len) {
         // Build a reply
         u8 reply[64];
         if (len > 64) len = 64;
-        memcpy_n(reply, pkt, len);
+        memcpy(reply, pkt, len);
         icmp_hdr_t *r = (icmp_hdr_t *)reply;
         r->type     = ICMP_ECHO_REPLY;
         r->checksum = 0;
@@ -572,7 +640,7 @@ void icmp_handle(ip_addr_t src_ip, const u8 *pkt, u16 len) {
 
 void icmp_send_echo(ip_addr_t dst_ip, u16 seq) {
     u8 payload[sizeof(icmp_hdr_t) + 8];
-    memset_n(payload, 0, sizeof(payload));
+    memset(payload, 0, sizeof(payload));
     icmp_hdr_t *icmp = (icmp_hdr_t *)payload;
     icmp->type     = ICMP_ECHO_REQUEST;
     icmp->code     = 0;
@@ -606,7 +674,7 @@ int udp_send(ip_addr_t dst_ip, u16 src_port, u16 dst_port,
     udp->dst_port = htons(dst_port);
     udp->length   = htons(udp_len);
     udp->checksum = 0;
-    memcpy_n(buf + sizeof(udp_hdr_t), data, dlen);
+    memcpy(buf + sizeof(udp_hdr_t), data, dlen);
 
     return ip_send(dst_ip, IP_PROTO_UDP, buf, udp_len);
 }
@@ -687,6 +755,7 @@ int parse_ip(const char *s, ip_addr_t *out) {
 // Called once during kernel init
 // ============================================================
 void net_stack_init(void) {
+    net_pkt_cache = kmem_cache_create("net_pkt", NET_PKT_BUF_SIZE, 0);
     arp_cache_init();
     net_init();
 }
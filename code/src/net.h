@@ -57,7 +57,7 @@ int  pci_find_device(u16 vendor, u16 device, u8 *out_bus, u8 *out_slot);
 #define RTL_RCR_AB        (1<<3) // Accept broadcast
 #define RTL_RCR_WRAP      (1<<7) // Wrap Rx buffer
 #define RTL_RCR_MXDMA_UNLIM (7<<8)
-#define RTL_RCR_RBLEN_32K (2<<11)
+#define RTL_RCR_RBLEN(n)  ((n)<<11) // Rx ring is 8K << n
 #define RTL_RCR_RXFTH_NONE (7<<13)
 
 // ISR flags
@@ -69,9 +69,11 @@ int  pci_find_device(u16 vendor, u16 device, u8 *out_bus, u8 *out_slot);
 #define RTL_TSD_TOK  (1<<15) // Transmit OK
 
 // --------------- RTL8139 driver API --------------------------
-#define RTL_RX_BUF_SIZE  (32*1024 + 16 + 1500)
+#define RTL_RX_RING_DEFAULT_KB 16
+#define RTL_RX_BUF_SIZE(ring) ((ring) + 16 + 1500)
 #define RTL_TX_BUF_SIZE  1536
 #define RTL_TX_DESC_NUM  4
+#define NET_PKT_BUF_SIZE 1536   // slab-allocated frame buffer (max frame + slack)
 
 extern mac_addr_t net_mac;     // Our MAC address
 extern ip_addr_t  net_ip;      // Our IP (host byte order stored as u32 BE)
@@ -119,14 +121,16 @@ typedef struct {
     u32        tpa; // Target protocol address
 } __attribute__((packed)) arp_pkt_t;
 
-#define ARP_CACHE_SIZE 8
-typedef struct {
+// Entries come from a slab cache and are kept most-recent first.
+// The oldest entry is recycled once ARP_CACHE_MAX are in use.
+#define ARP_CACHE_MAX 256
+typedef struct arp_entry {
     ip_addr_t  ip;
     mac_addr_t mac;
-    int        valid;
+    struct arp_entry *next;
 } arp_entry_t;
 
-extern arp_entry_t arp_cache[ARP_CACHE_SIZE];
+extern arp_entry_t *arp_cache;
 
 void arp_handle(const u8 *pkt, u16 len);
 int  arp_lookup(ip_addr_t ip, mac_addr_t *out_mac);
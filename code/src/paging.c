@@ -1,6 +1,13 @@
 #include "paging.h"
 #include "pmm.h"
 #include "swap.h"
+#include "bench.h"
+#include "evict.h"
+#include "dedup.h"
+#include "kstring.h"
+#include "vmalloc.h"
+#include "config.h"
+#include "fs.h"
 
 /* 
    We reference external functions to print to screen or handle errors.
@@ -9,18 +16,225 @@
 */
 extern void *vidptr;
 extern unsigned int current_loc;
+extern void kprint(const char *str);
+extern void kprint_hex(unsigned int val);
+extern void kprint_dec(unsigned int val);
 
 /* Address of the page directory (must be 4KB aligned) */
 __attribute__((aligned(PAGE_SIZE)))
 uint32_t page_directory[PAGE_ENTRIES];
 
-/* First page table (to map the first 4MB of memory) */
+/* First page table (maps the first 4MB when the CPU has no PSE) */
 __attribute__((aligned(PAGE_SIZE)))
 uint32_t first_page_table[PAGE_ENTRIES];
 
+/* PAE: page-directory-pointer table, one entry per GB. The four
+   directories it points to come from the PMM. */
+__attribute__((aligned(32)))
+uint64_t pae_pdpt[4];
+
+/* Directory slots: 1024 of 4MB, or 4 x 512 of 2MB under PAE */
+#define PAGE_DIR_SLOTS_MAX 2048
+
+/* Layout of the active mode: VA bits below one directory slot, entries
+   per page table, the first slot of the page table window and where the
+   window is mapped. Every entry is one dword, or two under PAE. */
+static uint32_t pd_shift     = 22;
+static uint32_t pt_entries   = PAGE_ENTRIES;
+static uint32_t window_slot  = RECURSIVE_SLOT;
+static uint32_t window_vaddr = PAGE_TABLES_VADDR;
+static uint32_t max_map_pfn  = 0x100000;   // 4GB
+
+/* Directory slots below this belong to the identity map and are never freed */
+static uint32_t direct_map_pdes = 0;
+
+/* Present entries per dynamically allocated page table */
+static uint16_t pt_used[PAGE_DIR_SLOTS_MAX];
+
+/* Large pages available (CPUID PSE, CR4.PSE set; always under PAE) */
+static int pse_enabled = 0;
+static int pae_enabled = 0;
+static int nx_enabled  = 0;
+
+/* Counters for vminfo */
+static uint32_t page_tables_live  = 0;
+static uint32_t page_tables_freed = 0;
+static uint32_t small_pages_live  = 0;
+static uint32_t large_pages_live  = 0;
+static uint32_t large_pages_split = 0;
+
+/* Batched invalidation: ranges longer than this many pages reload CR3 */
+static uint32_t tlb_flush_threshold = TLB_FLUSH_THRESHOLD_DEFAULT;
+static uint32_t tlb_invlpg_count   = 0;
+static uint32_t tlb_full_flushes   = 0;
+
+/* Faults on all-zero swap pages, from fault to mapped */
+static uint32_t zero_fill_faults = 0;
+static uint64_t zero_fill_cycles = 0;
+
+static inline void invlpg(uint32_t virt_addr)
+{
+    asm volatile("invlpg (%0)" :: "r" (virt_addr) : "memory");
+}
+
+/* Entry i of a table, as the low dword of the entry */
+static inline uint32_t *pt_slot(uint32_t *table, uint32_t i)
+{
+    return table + (i << pae_enabled);
+}
+
+static inline uint32_t *pd_entry(uint32_t pd_index)
+{
+    if (pae_enabled) {
+        return pt_slot((uint32_t *)PAE_DIRS_VADDR, pd_index);
+    }
+    return (uint32_t *)PAGE_DIR_VADDR + pd_index;
+}
+
+static inline uint32_t *pt_window(uint32_t pd_index)
+{
+    return (uint32_t *)(window_vaddr + pd_index * PAGE_SIZE);
+}
+
+/* High dword of a PAE entry: frame bits 32 and up, and NX */
+static inline uint32_t entry_high(uint32_t pfn, uint32_t flags)
+{
+    if (!pae_enabled) {
+        return 0;
+    }
+    return (pfn >> 20) | ((flags & PAGE_NX) && nx_enabled ? PAGE_NX : 0);
+}
+
+/* Store an entry. Under PAE the high dword goes in before the present
+   bit is set and comes out after it is cleared, so the CPU never walks
+   a half-written entry. */
+static inline void entry_set(uint32_t *e, uint32_t lo, uint32_t hi)
+{
+    if (!pae_enabled) {
+        e[0] = lo;
+    } else if (lo & PAGE_PRESENT) {
+        e[1] = hi;
+        asm volatile("" ::: "memory");
+        e[0] = lo;
+    } else {
+        e[0] = lo;
+        asm volatile("" ::: "memory");
+        e[1] = hi;
+    }
+}
+
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *edx)
+{
+    uint32_t ebx, ecx;
+    asm volatile("cpuid" : "=a"(*eax), "=b"(ebx), "=c"(ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static int cpu_has_pse(void)
+{
+    uint32_t eax, edx;
+    cpuid(1, &eax, &edx);
+    return (edx >> 3) & 1;
+}
+
+static int cpu_has_pae(void)
+{
+    uint32_t eax, edx;
+    cpuid(1, &eax, &edx);
+    return (edx >> 6) & 1;
+}
+
+/* NX (extended leaf 1, EDX bit 20) and the physical address width */
+static int cpu_has_nx(void)
+{
+    uint32_t max, eax, edx;
+    cpuid(0x80000000, &max, &edx);
+    if (max < 0x80000001) {
+        return 0;
+    }
+    cpuid(0x80000001, &eax, &edx);
+    return (edx >> 20) & 1;
+}
+
+static uint32_t cpu_phys_bits(void)
+{
+    uint32_t max, eax, edx;
+    cpuid(0x80000000, &max, &edx);
+    if (max < 0x80000008) {
+        return 36;
+    }
+    cpuid(0x80000008, &eax, &edx);
+    return eax & 0xFF;
+}
+
+/* Build the PAE tables: four directories, the identity map in 2MB pages
+   and the page table window in the last four slots. Paging is still off,
+   so the directories are filled through their physical address.
+   Returns 0, or -1 (nothing changed) if the PMM cannot supply them. */
+static int paging_init_pae(uint32_t map_end)
+{
+    uint32_t dirs[4];
+    uint32_t i, pd;
+
+    for (i = 0; i < 4; i++) {
+        dirs[i] = pmm_alloc_page();
+        if (!dirs[i]) {
+            while (i--) pmm_free_page(dirs[i]);
+            return -1;
+        }
+        memset((void *)dirs[i], 0, PAGE_SIZE);
+        pae_pdpt[i] = dirs[i] | PAGE_PRESENT;  // RW/US are reserved here
+    }
+
+    pae_enabled  = 1;
+    pse_enabled  = 1;
+    pd_shift     = 21;
+    pt_entries   = PAGE_ENTRIES / 2;
+    window_slot  = PAE_TABLES_VADDR >> 21;
+    window_vaddr = PAE_TABLES_VADDR;
+
+    uint32_t bits = cpu_phys_bits();
+    max_map_pfn = bits >= 44 ? 0xFFFFFFFF : 1u << (bits - 12);
+
+    for (pd = 0; pd < (map_end >> 21); pd++) {
+        uint32_t *e = pt_slot((uint32_t *)dirs[pd >> 9], pd & 511);
+        e[0] = (pd << 21) | PAGE_PRESENT | PAGE_RW | PAGE_LARGE;
+    }
+    large_pages_live = pd;
+    direct_map_pdes  = pd;
+
+    for (i = 0; i < 4; i++) {
+        uint32_t *e = pt_slot((uint32_t *)dirs[3], (window_slot & 511) + i);
+        e[0] = dirs[i] | PAGE_PRESENT | PAGE_RW;
+    }
+
+    /* CR4.PAE, then EFER.NXE (MSR 0xC0000080 bit 11) if the CPU has NX */
+    uint32_t cr4;
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= 0x20;
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+    if (cpu_has_nx()) {
+        uint32_t lo, hi;
+        asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(0xC0000080));
+        lo |= 1u << 11;
+        asm volatile("wrmsr" :: "a"(lo), "d"(hi), "c"(0xC0000080));
+        nx_enabled = 1;
+    }
+
+    asm volatile("mov %0, %%cr3" :: "r"(pae_pdpt));
+    return 0;
+}
+
 void paging_init(void)
 {
-    uint32_t i;
+    uint32_t i, pd, cr0;
+
+    /* Identity-map all of RAM the PMM manages, in whole 4MB chunks */
+    uint32_t map_end = (pmm_max_phys() + 0x3FFFFF) & ~0x3FFFFF;
+    if (map_end < 0x400000) map_end = 0x400000;
+
+    if (config_get("pae", 0) && cpu_has_pae() && paging_init_pae(map_end) == 0) {
+        goto enable;
+    }
 
     /* 1. Clear page directory */
     for (i = 0; i < PAGE_ENTRIES; i++) {
@@ -28,93 +242,596 @@ void paging_init(void)
         page_directory[i] = 0x00000002; 
     }
 
-    /* 2. Identity-map first 4 MB */
-    for (i = 0; i < PAGE_ENTRIES; i++) {
-        /* (i * 4096) | Present | R/W | Supervisor */
-        first_page_table[i] = (i * PAGE_SIZE) | PAGE_PRESENT | PAGE_RW;
+    if (cpu_has_pse()) {
+        /* 2. Enable 4MB pages (CR4.PSE) */
+        uint32_t cr4;
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= 0x10;
+        asm volatile("mov %0, %%cr4" :: "r"(cr4));
+        pse_enabled = 1;
+
+        /* 3. One 4MB page per directory entry: the kernel image, its BSS
+           and every PMM block share a handful of TLB entries */
+        for (pd = 0; pd < (map_end >> 22); pd++) {
+            page_directory[pd] = (pd << 22) | PAGE_PRESENT | PAGE_RW | PAGE_LARGE;
+        }
+        large_pages_live = pd;
+    } else {
+        /* 2. Identity-map first 4 MB */
+        for (i = 0; i < PAGE_ENTRIES; i++) {
+            /* (i * 4096) | Present | R/W | Supervisor */
+            first_page_table[i] = (i * PAGE_SIZE) | PAGE_PRESENT | PAGE_RW;
+        }
+
+        /* Entry 0 maps virtual addresses 0x00000000 - 0x003FFFFF */
+        page_directory[0] = ((uint32_t)first_page_table) | PAGE_PRESENT | PAGE_RW;
+
+        /* 3. Identity-map the rest of RAM. Paging is still off, so the
+           page tables taken from the PMM can be filled through their physical address. */
+        for (pd = 1; pd < (map_end >> 22); pd++) {
+            uint32_t *pt = (uint32_t *)pmm_alloc_page();
+            if (!pt) break;
+            for (i = 0; i < PAGE_ENTRIES; i++) {
+                pt[i] = ((pd << 22) + i * PAGE_SIZE) | PAGE_PRESENT | PAGE_RW;
+            }
+            page_directory[pd] = ((uint32_t)pt) | PAGE_PRESENT | PAGE_RW;
+        }
+        page_tables_live = pd;
+        small_pages_live = pd * PAGE_ENTRIES;
     }
+    direct_map_pdes = pd;
 
-    /* 3. Register the first page table in the directory */
-    /* Entry 0 maps virtual addresses 0x00000000 - 0x003FFFFF */
-    page_directory[0] = ((uint32_t)first_page_table) | PAGE_PRESENT | PAGE_RW;
+    /* Recursive slot: the directory doubles as the page table for the top 4MB */
+    page_directory[RECURSIVE_SLOT] = ((uint32_t)page_directory) | PAGE_PRESENT | PAGE_RW;
 
     /* 4. Load Page Directory Base Register (CR3) */
     asm volatile("mov %0, %%cr3" :: "r"(page_directory));
 
+enable:
     /* 5. Enable Paging (Set PG bit in CR0) */
-    uint32_t cr0;
     asm volatile("mov %%cr0, %0": "=r"(cr0));
     cr0 |= 0x80000000; // Set PG bit
+    cr0 |= 0x00010000; // Set WP bit: read-only pages also fault on kernel writes (copy-on-write)
     asm volatile("mov %0, %%cr0":: "r"(cr0));
 
-    /* Initialize PMM and Swap */
-    pmm_init(0x1000000); // Assume 16MB RAM
+    /* Frames outside the direct map that map_frame() can reach */
+    pmm_high_init(max_map_pfn);
+
+    /* Initialize Swap (the PMM is set up by kmain before paging) */
     swap_init();
 }
 
-void map_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags)
+int paging_pae_enabled(void)
+{
+    return pae_enabled;
+}
+
+int paging_nx_enabled(void)
+{
+    return nx_enabled;
+}
+
+uint32_t paging_max_pfn(void)
+{
+    return max_map_pfn;
+}
+
+uint32_t paging_table_span(void)
+{
+    return 1u << pd_shift;
+}
+
+uint32_t *paging_get_pte(uint32_t virt_addr)
+{
+    uint32_t pd_index = virt_addr >> pd_shift;
+
+    uint32_t pde = *pd_entry(pd_index);
+
+    if (pd_index >= window_slot || !(pde & PAGE_PRESENT) || (pde & PAGE_LARGE)) {
+        return 0;
+    }
+    return pt_slot(pt_window(pd_index), (virt_addr >> 12) & (pt_entries - 1));
+}
+
+uint32_t paging_pte_pfn(const uint32_t *pte)
+{
+    uint32_t pfn = pte[0] >> 12;
+    if (pae_enabled) {
+        pfn |= (pte[1] & ~PAGE_NX) << 20;
+    }
+    return pfn;
+}
+
+uint32_t paging_test_and_clear(uint32_t virt_addr, uint32_t flags)
+{
+    uint32_t *pte = paging_get_pte(virt_addr);
+    if (!pte || !(*pte & PAGE_PRESENT)) {
+        return 0;
+    }
+    uint32_t mask = flags;
+    if (flags & PAGE_ACCESSED) {
+        mask |= PAGE_SOFT_ACCESSED;
+    }
+    uint32_t old = *pte & mask;
+    if (old) {
+        *pte &= ~old;
+        invlpg(virt_addr);
+    }
+    if (old & PAGE_SOFT_ACCESSED) {
+        old = (old & ~PAGE_SOFT_ACCESSED) | PAGE_ACCESSED;
+    }
+    return old;
+}
+
+/* Replace a large mapping with a page table holding the same pages, so
+   part of it can be remapped or unmapped. Returns 0 or -1. */
+static int split_large_page(uint32_t pd_index)
+{
+    uint32_t *pde = pd_entry(pd_index);
+    uint32_t *pt  = pt_window(pd_index);
+    uint32_t base  = (*pde & ~((1u << pd_shift) - 1)) >> 12;   // frame number
+    uint32_t flags = *pde & (0xFFF & ~PAGE_LARGE);
+    uint32_t high  = 0;
+    if (pae_enabled) {
+        base |= (pde[1] & ~PAGE_NX) << 20;
+        high  = pde[1] & PAGE_NX;
+    }
+
+    uint32_t table = pmm_alloc_page();
+    if (!table) {
+        return -1;
+    }
+
+    /* The table is only reachable through the window once it is installed,
+       so fill it through the identity map (PMM frames always are mapped). */
+    uint32_t *phys_pt = (uint32_t *)table;
+    for (uint32_t i = 0; i < pt_entries; i++) {
+        uint32_t *e = pt_slot(phys_pt, i);
+        e[0] = ((base + i) << 12) | flags;
+        if (pae_enabled) {
+            e[1] = ((base + i) >> 20) | high;
+        }
+    }
+
+    /* NX stays on the pages: in a directory entry it would cover them all */
+    entry_set(pde, table | PAGE_PRESENT | PAGE_RW | (flags & PAGE_USER), 0);
+    invlpg(pd_index << pd_shift);
+    invlpg((uint32_t)pt);
+
+    pt_used[pd_index] = pt_entries;
+    page_tables_live++;
+    small_pages_live += pt_entries;
+    large_pages_live--;
+    large_pages_split++;
+    return 0;
+}
+
+/* Install a PTE for frame `pfn` without touching the TLB. Returns 0 or -1. */
+static int set_pte(uint32_t pfn, uint32_t virt_addr, uint32_t flags)
 {
     /* Calculate indexes */
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x03FF;
+    uint32_t pd_index = virt_addr >> pd_shift;
+    uint32_t pt_index = (virt_addr >> 12) & (pt_entries - 1);
+    uint32_t *pde = pd_entry(pd_index);
+    uint32_t *pt  = pt_window(pd_index);
+
+    /* The top of the address space is the page table window itself */
+    if (pd_index >= window_slot || pfn >= max_map_pfn) {
+        return -1;
+    }
+
+    /* Remapping part of a 4MB page needs a real page table */
+    if ((*pde & (PAGE_PRESENT | PAGE_LARGE)) == (PAGE_PRESENT | PAGE_LARGE)) {
+        if (split_large_page(pd_index) != 0) {
+            return -1;
+        }
+    }
 
     /* Check if the page table exists */
-    if (!((page_directory[pd_index]) & PAGE_PRESENT)) {
-        /* Page table not present. In a full OS, we'd allocate a new physical page for the table.
-           Here, we don't have a physical memory manager yet! 
-           This is a limitation. We can only map into the first 4MB for now unless we statically alloc more tables.
-           
-           CRITICAL: for this task, if we try to map outside existing tables, we effectively fail or need a simpler allocator.
-           For now, let's just assume we only map if table exists or we are reusing the first one.
-        */
-        return; // Fail silently or panic
-    }
-
-    uint32_t *pt = (uint32_t *)(page_directory[pd_index] & ~0xFFF);
-    
-    /* Since we are not mapping the page tables themselves to virtual memory recursively yet,
-       we must access them by physical address IF identity mapped. 
-       Luckily first 4MB is identity mapped, and our static arrays likely fall there.
-    */
-    
-    pt[pt_index] = (phys_addr & ~0xFFF) | (flags & 0xFFF) | PAGE_PRESENT;
+    if (!(*pde & PAGE_PRESENT)) {
+        /* Allocate a fresh, already empty table. It is reached through
+           the recursive window, so it does not have to be identity-mapped. */
+        uint32_t table = pmm_alloc_zeroed_page();
+        if (!table) {
+            return -1; // Out of memory
+        }
+        entry_set(pde, table | PAGE_PRESENT | PAGE_RW | (flags & PAGE_USER), 0);
+        invlpg((uint32_t)pt);
+        pt_used[pd_index] = 0;
+        page_tables_live++;
+    } else if (flags & PAGE_USER) {
+        *pde |= PAGE_USER;
+    }
+
+    uint32_t *pte = pt_slot(pt, pt_index);
+    if (!(*pte & PAGE_PRESENT)) {
+        pt_used[pd_index]++;
+        small_pages_live++;
+    }
+    entry_set(pte, (pfn << 12) | (flags & 0xFFF) | PAGE_PRESENT, entry_high(pfn, flags));
+    return 0;
+}
+
+/* Clear a PTE without touching the TLB. Returns 1 if a mapping was removed. */
+static int clear_pte(uint32_t virt_addr)
+{
+    uint32_t pd_index = virt_addr >> pd_shift;
+
+    if ((*pd_entry(pd_index) & (PAGE_PRESENT | PAGE_LARGE)) == (PAGE_PRESENT | PAGE_LARGE) &&
+        pd_index < window_slot) {
+        if (split_large_page(pd_index) != 0) {
+            return 0;
+        }
+    }
+
+    uint32_t *pte = paging_get_pte(virt_addr);
+
+    if (!pte || !(*pte & PAGE_PRESENT)) {
+        return 0;
+    }
+
+    entry_set(pte, 0, 0); // Clear entry
+    small_pages_live--;
+    if (pt_used[pd_index]) pt_used[pd_index]--;
+    return 1;
+}
+
+/* Give an empty page table back (the identity map stays). Stale
+   translations through it must already have been flushed. */
+static void release_table_if_empty(uint32_t pd_index)
+{
+    uint32_t *pde = pd_entry(pd_index);
+
+    if (pd_index < direct_map_pdes || pd_index >= window_slot) return;
+    if ((*pde & (PAGE_PRESENT | PAGE_LARGE)) != PAGE_PRESENT) return;
+    if (pt_used[pd_index] != 0) return;
+
+    uint32_t table = *pde & ~0xFFF;
+    entry_set(pde, 0, 0);
+    invlpg((uint32_t)pt_window(pd_index));
+    pmm_free_page(table);
+    page_tables_live--;
+    page_tables_freed++;
+}
+
+/* Flush the translations for `pages` pages from virt_addr: one invlpg per
+   page up to tlb_flush_threshold, a full CR3 reload above it. */
+static void flush_range(uint32_t virt_addr, uint32_t pages)
+{
+    if (pages > tlb_flush_threshold) {
+        uint32_t cr3;
+        asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) :: "memory");
+        tlb_full_flushes++;
+        return;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        invlpg(virt_addr + i * PAGE_SIZE);
+    }
+    tlb_invlpg_count += pages;
+}
+
+int map_frame(uint32_t pfn, uint32_t virt_addr, uint32_t flags)
+{
+    if (set_pte(pfn, virt_addr, flags) != 0) {
+        return -1;
+    }
     
     /* Invalidate TLB for this address */
-    asm volatile("invlpg (%0)" :: "r" (virt_addr) : "memory");
+    invlpg(virt_addr);
+    tlb_invlpg_count++;
+    return 0;
+}
+
+int map_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags)
+{
+    return map_frame(phys_addr >> 12, virt_addr, flags);
 }
 
 void unmap_page(uint32_t virt_addr)
 {
-    uint32_t pd_index = virt_addr >> 22;
-    uint32_t pt_index = (virt_addr >> 12) & 0x03FF;
+    if (clear_pte(virt_addr)) {
+        invlpg(virt_addr);
+        tlb_invlpg_count++;
+        release_table_if_empty(virt_addr >> pd_shift);
+    }
+}
+
+int map_range(uint32_t phys_addr, uint32_t virt_addr, uint32_t pages, uint32_t flags)
+{
+    for (uint32_t i = 0; i < pages; i++) {
+        if (set_pte((phys_addr >> 12) + i, virt_addr + i * PAGE_SIZE, flags) != 0) {
+            flush_range(virt_addr, i);
+            return -1;
+        }
+    }
+    flush_range(virt_addr, pages);
+    return 0;
+}
+
+void unmap_range(uint32_t virt_addr, uint32_t pages)
+{
+    if (pages == 0) {
+        return;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        clear_pte(virt_addr + i * PAGE_SIZE);
+    }
+    flush_range(virt_addr, pages);
+
+    /* Tables can only be freed once nothing in the TLB points through them */
+    uint32_t last = (virt_addr + (pages - 1) * PAGE_SIZE) >> pd_shift;
+    for (uint32_t pd = virt_addr >> pd_shift; pd <= last; pd++) {
+        release_table_if_empty(pd);
+    }
+}
+
+void paging_set_flush_threshold(uint32_t pages)
+{
+    tlb_flush_threshold = pages;
+}
+
+int map_large_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags)
+{
+    uint32_t pd_index = virt_addr >> pd_shift;
+    uint32_t slots = LARGE_PAGE_SIZE >> pd_shift;   // two 2MB pages under PAE
+
+    if ((phys_addr | virt_addr) & (LARGE_PAGE_SIZE - 1) || pd_index + slots > window_slot) {
+        return -1;
+    }
+
+    if (!pse_enabled) {
+        /* No PSE: same mapping out of 4KB pages */
+        for (uint32_t off = 0; off < LARGE_PAGE_SIZE; off += PAGE_SIZE) {
+            if (map_page(phys_addr + off, virt_addr + off, flags) != 0) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    for (uint32_t s = 0; s < slots; s++) {
+        uint32_t *pde = pd_entry(pd_index + s);
+        if ((*pde & (PAGE_PRESENT | PAGE_LARGE)) == PAGE_PRESENT) {
+            return -1; // Small pages live here; unmap them first
+        }
+    }
+
+    for (uint32_t s = 0; s < slots; s++) {
+        uint32_t *pde = pd_entry(pd_index + s);
+        uint32_t off = s << pd_shift;
+        if (!(*pde & PAGE_PRESENT)) {
+            large_pages_live++;
+        }
+        entry_set(pde, (phys_addr + off) | (flags & 0xFFF) | PAGE_PRESENT | PAGE_LARGE,
+                  entry_high(0, flags));
+        invlpg(virt_addr + off);
+    }
+    return 0;
+}
+
+void unmap_large_page(uint32_t virt_addr)
+{
+    uint32_t base = virt_addr & ~(LARGE_PAGE_SIZE - 1);
+    uint32_t slots = LARGE_PAGE_SIZE >> pd_shift;
+
+    for (uint32_t s = 0; s < slots; s++) {
+        uint32_t pd_index = (base >> pd_shift) + s;
+        uint32_t *pde = pd_entry(pd_index);
+        uint32_t start = pd_index << pd_shift;
+
+        if (pd_index >= window_slot || !(*pde & PAGE_PRESENT)) {
+            continue;
+        }
+        if (!(*pde & PAGE_LARGE)) {
+            /* Built from small pages (no PSE) */
+            for (uint32_t off = 0; off < (1u << pd_shift); off += PAGE_SIZE) {
+                unmap_page(start + off);
+            }
+            continue;
+        }
+
+        entry_set(pde, 0, 0);
+        invlpg(start);
+        large_pages_live--;
+    }
+}
+
+void paging_print_stats(void)
+{
+    kprint("Paging: ");
+    kprint_dec(page_tables_live);
+    kprint(" page tables (");
+    kprint_dec(direct_map_pdes);
+    kprint(" identity map slots), ");
+    kprint_dec(page_tables_freed);
+    kprint(" freed\n");
+    kprint("  PAE: ");
+    kprint(pae_enabled ? "on" : "off");
+    kprint(", NX: ");
+    kprint(nx_enabled ? "on" : "off");
+    kprint(", frames reachable below ");
+    kprint_dec(max_map_pfn >= 0x100000 ? (max_map_pfn >> 18) : 0);
+    kprint(" GB\n");
+    kprint("  PSE: ");
+    kprint(pse_enabled ? "on" : "off");
+    kprint(pae_enabled ? ", 2MB mappings: " : ", 4MB mappings: ");
+    kprint_dec(large_pages_live);
+    kprint(" (");
+    kprint_dec(large_pages_split);
+    kprint(" split), 4KB mappings: ");
+    kprint_dec(small_pages_live);
+    kprint("\n");
+    kprint("  TLB: ");
+    kprint_dec(tlb_invlpg_count);
+    kprint(" invlpg, ");
+    kprint_dec(tlb_full_flushes);
+    kprint(" full flushes (threshold ");
+    kprint_dec(tlb_flush_threshold);
+    kprint(" pages)\n");
+    kprint("  zero-fill faults: ");
+    kprint_dec(zero_fill_faults);
+    kprint(", ");
+    kprint_dec(zero_fill_faults ? (uint32_t)bench_div64(zero_fill_cycles, zero_fill_faults) : 0);
+    kprint(" cycles/fault\n");
+}
+
+// ==== Benchmark ====
+
+#define MAP_BENCH_BASE  0xE0000000
+#define MAP_BENCH_PAGES 65536   // 256MB of virtual space, 64 page tables (128 under PAE)
+
+void paging_bench(void)
+{
+    uint32_t i;
+    uint32_t frame = pmm_alloc_page();
+    if (!frame) {
+        kprint("mapbench: out of memory\n");
+        return;
+    }
+
+    kprint("mapbench: ");
+    kprint_dec(MAP_BENCH_PAGES);
+    kprint(" pages at ");
+    kprint_hex(MAP_BENCH_BASE);
+    kprint("\n");
+
+    uint32_t tables_before = page_tables_live;
+    uint32_t free_before   = pmm_free_count();
+
+    /* Every page aliases the same frame, so only page tables cost memory */
+    uint64_t start = bench_now();
+    for (i = 0; i < MAP_BENCH_PAGES; i++) {
+        if (map_page(frame, MAP_BENCH_BASE + i * PAGE_SIZE, PAGE_PRESENT | PAGE_RW) != 0) {
+            break;
+        }
+    }
+    uint64_t map_cycles = bench_now() - start;
+    uint32_t mapped = i;
+
+    /* Sanity check: a store through the first page shows up in the last */
+    volatile uint32_t *first = (volatile uint32_t *)MAP_BENCH_BASE;
+    volatile uint32_t *last  = (volatile uint32_t *)(MAP_BENCH_BASE + (mapped - 1) * PAGE_SIZE);
+    *first = 0xC0FFEE;
+    int alias_ok = mapped && *last == 0xC0FFEE;
+    uint32_t tables_used = page_tables_live - tables_before;
+
+    start = bench_now();
+    for (i = 0; i < mapped; i++) {
+        unmap_page(MAP_BENCH_BASE + i * PAGE_SIZE);
+    }
+    uint64_t unmap_cycles = bench_now() - start;
+
+    pmm_free_page(frame);
 
-    if (page_directory[pd_index] & PAGE_PRESENT) {
-        uint32_t *pt = (uint32_t *)(page_directory[pd_index] & ~0xFFF);
-        pt[pt_index] = 0; // Clear entry
-        asm volatile("invlpg (%0)" :: "r" (virt_addr) : "memory");
+    /* Same range again as 4MB pages, all aliasing the first 4MB of RAM */
+    uint32_t large = MAP_BENCH_PAGES / PAGE_ENTRIES;
+    start = bench_now();
+    for (i = 0; i < large; i++) {
+        map_large_page(0, MAP_BENCH_BASE + i * LARGE_PAGE_SIZE, PAGE_PRESENT | PAGE_RW);
     }
+    uint64_t large_map_cycles = bench_now() - start;
+    start = bench_now();
+    for (i = 0; i < large; i++) {
+        unmap_large_page(MAP_BENCH_BASE + i * LARGE_PAGE_SIZE);
+    }
+    uint64_t large_unmap_cycles = bench_now() - start;
+
+    bench_print_rate("  map", mapped, map_cycles);
+    bench_print_rate("  unmap", mapped, unmap_cycles);
+    bench_print_rate("  map 4MB", large, large_map_cycles);
+    bench_print_rate("  unmap 4MB", large, large_unmap_cycles);
+    kprint("  page tables allocated: ");
+    kprint_dec(tables_used);
+    kprint(", alias check ");
+    kprint(alias_ok ? "ok" : "FAILED");
+    kprint(", frames leaked: ");
+    kprint_dec(free_before - pmm_free_count());
+    kprint("\n");
 }
 
-void page_fault_handler(void)
+void page_fault_handler(uint32_t error_code)
 {
     uint32_t faulting_address;
     asm volatile("mov %%cr2, %0" : "=r" (faulting_address));
 
+    /* Write to a present, read-only page: copy-on-write of a merged page */
+    if ((error_code & (PF_ERR_PRESENT | PF_ERR_WRITE)) == (PF_ERR_PRESENT | PF_ERR_WRITE)) {
+        if (dedup_cow_fault(faulting_address) == 0) {
+            return;
+        }
+        goto panic;
+    }
+
+    /* First touch of a lazily backed vmalloc page */
+    if (!(error_code & PF_ERR_PRESENT) && vmalloc_fault(faulting_address) == 0) {
+        return;
+    }
+
+    /* First touch of a memory-mapped file page */
+    if (!(error_code & PF_ERR_PRESENT) && fs_mmap_fault(faulting_address) == 0) {
+        return;
+    }
+
     /* Demand Paging Logic */
     /* Check if this address is in our Swap Store */
-    if (swap_exists(faulting_address)) {
-        /* It is! Allocate a new physical frame */
-        uint32_t new_phys = pmm_alloc_page();
-        if (new_phys == 0) {
-           // OOM Panic
-           goto panic;
-        }
+    if (!(error_code & PF_ERR_PRESENT) && swap_exists(faulting_address)) {
+        uint32_t page = faulting_address & ~0xFFF;
+        uint64_t start = bench_now();
+
+        /* Map it (User + RW). A new page table may need one more frame.
+           Accessed is preset so the clock does not pick this page before
+           the faulting instruction gets to use it. */
+        uint32_t flags = PAGE_PRESENT | PAGE_RW | PAGE_USER | PAGE_ACCESSED;
+        int zero = swap_is_zero(page);
+
+        /* High memory first, keeping direct-mapped frames for the kernel.
+           Such a frame is only reachable through the new mapping, so it
+           is mapped first and filled through it. */
+        uint32_t pfn = evict_alloc_high_frame();
+        if (pfn) {
+            while (map_frame(pfn, page, flags) != 0) {
+                if (evict_one() != 0) {
+                    pmm_free_frame(pfn);
+                    goto panic;
+                }
+            }
+            if (zero) {
+                memset((void *)page, 0, PAGE_SIZE);
+            } else {
+                swap_read(page, page);
+            }
+            /* Our own stores do not make it differ from its swap copy */
+            paging_test_and_clear(page, PAGE_DIRTY);
+        } else {
+            /* It is! Allocate a new physical frame, evicting a resident
+               page when memory is short. All-zero pages take a pre-zeroed
+               frame and need no copy. */
+            uint32_t new_phys = zero ? evict_alloc_zeroed_frame() : evict_alloc_frame();
+            if (new_phys == 0) {
+               // Nothing left to evict
+               goto panic;
+            }
+
+            /* Load data from swap */
+            if (!zero) {
+                swap_read(page, new_phys);
+            }
 
-        /* Load data from swap */
-        swap_read(faulting_address, new_phys);
+            while (map_page(new_phys, page, flags) != 0) {
+                if (evict_one() != 0) {
+                    pmm_free_page(new_phys);
+                    goto panic;
+                }
+            }
+        }
+        evict_track(page);
+        if (zero) {
+            zero_fill_faults++;
+            zero_fill_cycles += bench_now() - start;
+        }
 
-        /* Map it (User + RW) */
-        map_page(new_phys, faulting_address, PAGE_PRESENT | PAGE_RW | PAGE_USER);
+        /* Pull in the following swapped pages if the pattern is sequential */
+        evict_readahead(page);
 
         /* Print "Loaded" message to screen (bottom row) */
         char *video = (char*)0xb8000;
@@ -145,3 +862,53 @@ panic:
     
     while(1) asm volatile("hlt");
 }
+
+/* Per-page vs batched invalidation for a few range sizes. Each run moves
+   the same number of pages so the cycles/page figures are comparable. */
+void paging_tlb_bench(void)
+{
+    static const uint32_t sizes[] = { 16, 256, 4096 };
+    uint32_t frame = pmm_alloc_page();
+    if (!frame) {
+        kprint("tlbbench: out of memory\n");
+        return;
+    }
+
+    kprint("tlbbench: map+unmap cycles/page (threshold ");
+    kprint_dec(tlb_flush_threshold);
+    kprint(" pages)\n");
+
+    for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        uint32_t pages = sizes[s];
+        uint32_t reps  = MAP_BENCH_PAGES / pages;
+        uint32_t r, i;
+
+        uint64_t start = bench_now();
+        for (r = 0; r < reps; r++) {
+            for (i = 0; i < pages; i++) {
+                map_page(frame, MAP_BENCH_BASE + i * PAGE_SIZE, PAGE_PRESENT | PAGE_RW);
+            }
+            for (i = 0; i < pages; i++) {
+                unmap_page(MAP_BENCH_BASE + i * PAGE_SIZE);
+            }
+        }
+        uint64_t per_page = bench_now() - start;
+
+        start = bench_now();
+        for (r = 0; r < reps; r++) {
+            map_range(frame, MAP_BENCH_BASE, pages, PAGE_PRESENT | PAGE_RW);
+            unmap_range(MAP_BENCH_BASE, pages);
+        }
+        uint64_t batched = bench_now() - start;
+
+        kprint("  ");
+        kprint_dec(pages);
+        kprint(" pages: per-page ");
+        kprint_dec((uint32_t)bench_div64(per_page, reps * pages));
+        kprint(", batched ");
+        kprint_dec((uint32_t)bench_div64(batched, reps * pages));
+        kprint("\n");
+    }
+
+    pmm_free_page(frame);
+}
@@ -4,6 +4,7 @@
 /* =======================
    Basic integer types
    ======================= */
+typedef unsigned long long uint64_t;
 typedef unsigned int   uint32_t;
 typedef unsigned short uint16_t;
 typedef unsigned char  uint8_t;
@@ -13,11 +14,49 @@ typedef unsigned char  uint8_t;
    ======================= */
 #define PAGE_SIZE        4096
 #define PAGE_ENTRIES     1024
+#define LARGE_PAGE_SIZE  0x400000   // 4MB PSE page (two 2MB pages under PAE)
+
+/* All usable RAM below this address is identity-mapped by paging_init() */
+#define DIRECT_MAP_END   0xC0000000
+
+/* The last page-directory slot points back at the directory, which makes
+   every page table visible at PAGE_TABLES_VADDR + pd_index * PAGE_SIZE and
+   the directory itself at PAGE_DIR_VADDR. */
+#define RECURSIVE_SLOT    1023
+#define PAGE_TABLES_VADDR 0xFFC00000
+#define PAGE_DIR_VADDR    0xFFFFF000
+
+/* PAE mode (boot option pae=1, on CPUs that have it): three levels with
+   64-bit entries, so frames above 4GB can be mapped. A directory slot then
+   covers 2MB. The last four slots of the top directory point at the four
+   directories, so the page tables show up at PAE_TABLES_VADDR + slot *
+   PAGE_SIZE and the directories, back to back, at PAE_DIRS_VADDR. */
+#define PAE_TABLES_VADDR  0xFF800000
+#define PAE_DIRS_VADDR    0xFFFFC000
 
 /* Page entry flags */
 #define PAGE_PRESENT     0x001
 #define PAGE_RW          0x002
 #define PAGE_USER        0x004
+#define PAGE_ACCESSED    0x020
+#define PAGE_DIRTY       0x040
+#define PAGE_LARGE       0x080      // PDE maps a 4MB page (PSE), 2MB under PAE
+
+/* No-execute. Only valid in the `flags` argument of the map functions;
+   honoured in PAE mode on CPUs with NX (bit 63 of the entry). */
+#define PAGE_NX          0x80000000
+
+/* Software bits (PTE bits 9-11), kept by the working-set scanner (wss.h).
+   The scanner clears PAGE_ACCESSED to sample it, so it parks the bit in
+   PAGE_SOFT_ACCESSED for paging_test_and_clear() to still report. */
+#define PAGE_AGE_SHIFT     9
+#define PAGE_AGE_MASK      0x600    // scans since the page was last accessed (0-3)
+#define PAGE_SOFT_ACCESSED 0x800
+
+/* Page fault error code bits */
+#define PF_ERR_PRESENT   0x1        // protection violation (clear: page not present)
+#define PF_ERR_WRITE     0x2        // the access was a write
+#define PF_ERR_USER      0x4        // the access came from ring 3
 
 /* =======================
    Structures
@@ -31,19 +70,77 @@ typedef unsigned char  uint8_t;
 /* =======================
    Function Prototypes
    ======================= */
-/* Initialize paging */
+/* Initialize paging (classic or PAE, per the pae boot option) */
 void paging_init(void);
 
+/* Nonzero when PAE / no-execute are in use */
+int paging_pae_enabled(void);
+int paging_nx_enabled(void);
+
+/* First frame number map_frame() cannot reach (1M frames without PAE) */
+uint32_t paging_max_pfn(void);
+
+/* Bytes of address space behind one page table (4MB, or 2MB under PAE) */
+uint32_t paging_table_span(void);
+
 /* Map a virtual address to a physical address */
 /* phys_addr and virt_addr must be 4KB aligned */
-void map_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags);
+/* Page tables are allocated on demand. Returns 0, or -1 if out of memory. */
+int map_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags);
 
-/* Unmap a virtual page */
+/* Map page frame number `pfn`, which may lie above 4GB under PAE.
+   Returns 0, or -1 if out of memory or the frame is out of reach. */
+int map_frame(uint32_t pfn, uint32_t virt_addr, uint32_t flags);
+
+/* Unmap a virtual page. Page tables left empty are returned to the PMM. */
 void unmap_page(uint32_t virt_addr);
 
+/* Map `pages` consecutive pages starting at phys_addr / virt_addr and
+   flush the TLB once at the end. Returns 0, or -1 if out of memory (the
+   pages mapped so far stay mapped). */
+int map_range(uint32_t phys_addr, uint32_t virt_addr, uint32_t pages, uint32_t flags);
+
+/* Unmap `pages` consecutive pages with a single deferred flush */
+void unmap_range(uint32_t virt_addr, uint32_t pages);
+
+/* Ranges longer than this are flushed with a CR3 reload instead of
+   one invlpg per page */
+#define TLB_FLUSH_THRESHOLD_DEFAULT 32
+void paging_set_flush_threshold(uint32_t pages);
+
+/* Map a 4MB page. phys_addr and virt_addr must be 4MB aligned.
+   Falls back to 1024 small pages when the CPU has no PSE.
+   Returns 0, or -1 if the range already holds small mappings / out of memory. */
+int map_large_page(uint32_t phys_addr, uint32_t virt_addr, uint32_t flags);
+
+/* Unmap a 4MB page mapped with map_large_page() */
+void unmap_large_page(uint32_t virt_addr);
+
+/* Page table entry for virt_addr, or 0 if its page table does not exist
+   (including addresses covered by a 4MB page). Under PAE this is the low
+   half of the 64-bit entry: every flag is where it always is, but frame
+   bits above 4GB are not, so read the frame with paging_pte_pfn(). */
+uint32_t *paging_get_pte(uint32_t virt_addr);
+
+/* Frame number held by a present entry from paging_get_pte() */
+uint32_t paging_pte_pfn(const uint32_t *pte);
+
+/* Clear `flags` (e.g. PAGE_ACCESSED) in the PTE for virt_addr and flush
+   its TLB entry so the CPU sets them again. Returns the bits that were set;
+   PAGE_ACCESSED covers an accessed bit harvested by the scanner too. */
+uint32_t paging_test_and_clear(uint32_t virt_addr, uint32_t flags);
+
+/* Print page table / mapping counters (shell: vminfo) */
+void paging_print_stats(void);
+
+/* Map/unmap benchmark over a large range (shell: mapbench) */
+void paging_bench(void);
+
+/* Per-page vs batched TLB invalidation benchmark (shell: tlbbench) */
+void paging_tlb_bench(void);
+
 /* Page fault handler - to be called from ISR */
-/* regs argument type depends on your interrupt frame struct, 
-   but for now we'll just take error code if passed */
-void page_fault_handler(void);
+/* error_code is the CPU-pushed error code (PF_ERR_* bits) */
+void page_fault_handler(uint32_t error_code);
 
 #endif
@@ -1,40 +1,867 @@
 #include "pmm.h"
+#include "bench.h"
+#include "irq.h"
+#include "kstring.h"
+#include "shrink.h"
+
+extern void kprint(const char *str);
+extern void kprint_hex(unsigned int val);
+extern void kprint_dec(unsigned int val);
+
+/* End of the kernel image (link.ld) */
+extern char kernel_end[];
 
 /* 
-   For this simple kernel, we will use a very basic "Watermark Allocator" 
-   for the free heap space. 
+   Binary Buddy Allocator.
    
-   We assume the kernel and initial paging setup utilize the first few MBs.
-   We will start allocating from 4MB onwards.
+   Every frame has a small descriptor in `frames[]`. The first frame of a
+   free block carries the block order and links it into the free list for
+   that order. Allocation takes the smallest block that fits and splits it;
+   freeing merges the block with its buddy (pfn ^ (1 << order)) as long as
+   the buddy is also free, so both are O(PMM_MAX_ORDER).
+   
+   The descriptor table is sized from the detected memory and placed right
+   after the kernel image. Everything below the end of that table (BIOS area,
+   kernel, BSS) is never handed out.
 */
 
-// Start allocation after 4MB to avoid kernel code
-static uint32_t free_mem_start = 0x00400000; 
-static uint32_t system_max_mem = 0;
+#define PMM_NONE        0xFFFFFFFF
+#define PMM_MAX_EXCLUDE 8
+
+/* Frame states (only meaningful for the first frame of a block) */
+#define FRAME_RESERVED  0   /* never handed to the allocator / inside a block */
+#define FRAME_FREE      1   /* head of a free block */
+#define FRAME_ALLOCATED 2   /* head of an allocated block */
+
+typedef struct {
+    uint32_t next;   // next free block of the same order (pfn)
+    uint32_t prev;   // previous free block of the same order (pfn)
+    uint8_t  order;
+    uint8_t  state;
+} pmm_frame_t;
+
+static pmm_frame_t *frames;
+static uint32_t frames_end = 0;   // physical end of the descriptor table
+static uint32_t free_head[PMM_MAX_ORDER + 1];
+static uint32_t free_blocks[PMM_MAX_ORDER + 1];
+static uint32_t max_pfn = 0;
+static uint32_t free_pages = 0;
+static uint32_t total_pages = 0;
+
+/* Ranges that must stay out of the allocator even if the memory map says
+   they are usable (boot information handed over by the loader). */
+static uint32_t exclude_start[PMM_MAX_EXCLUDE];
+static uint32_t exclude_end[PMM_MAX_EXCLUDE];
+static int      exclude_count = 0;
+
+/* Pre-zeroed single frames, cleared by the idle loop. Pool frames count
+   as allocated; order-0 requests fall back to them when the buddy lists
+   run dry. */
+#define PMM_ZERO_POOL_SIZE 64
+#define PMM_ZERO_CHUNK     4     // frames cleared per idle pass
+
+static uint32_t zero_pool[PMM_ZERO_POOL_SIZE];
+static uint32_t zero_count    = 0;
+static uint32_t zero_hits     = 0;
+static uint32_t zero_misses   = 0;   // cleared inline by the caller
+static uint32_t zero_refilled = 0;
+static uint64_t zero_refill_cycles = 0;
+
+/* Watermarks, in free frames. Below low the idle loop reclaims up to
+   high; an allocation that would go below min reclaims first. */
+static uint32_t wmark_min  = 0;
+static uint32_t wmark_low  = 0;
+static uint32_t wmark_high = 0;
+static int      reclaim_pending = 0;
+static int      reclaiming      = 0;
+static uint32_t reclaim_direct     = 0;   // runs from an allocation
+static uint32_t reclaim_background = 0;   // runs from the idle loop
+static uint32_t reclaim_frames     = 0;
+
+/* High memory, tracked by a bitmap in low memory: the frames cannot
+   hold free list links the kernel could read. Regions are recorded while
+   parsing the memory map and the bitmap is built by pmm_high_init(). */
+#define PMM_MAX_HIGH_REGIONS 8
+#define PMM_HIGH_BASE_PFN    (DIRECT_MAP_END / PAGE_SIZE)
+
+static uint32_t high_start[PMM_MAX_HIGH_REGIONS];   // frame numbers
+static uint32_t high_end[PMM_MAX_HIGH_REGIONS];
+static int      high_regions = 0;
+static uint32_t *high_map    = 0;    // 1 = allocated, or not RAM
+static uint32_t high_map_order = 0;
+static uint32_t high_end_pfn = 0;    // bitmap covers [PMM_HIGH_BASE_PFN, high_end_pfn)
+static uint32_t high_cursor  = 0;    // next-fit start (bit)
+static uint32_t high_free    = 0;
+static uint32_t high_total   = 0;
+
+static void list_push(uint32_t pfn, uint32_t order)
+{
+    frames[pfn].order = (uint8_t)order;
+    frames[pfn].state = FRAME_FREE;
+    frames[pfn].prev  = PMM_NONE;
+    frames[pfn].next  = free_head[order];
+    if (free_head[order] != PMM_NONE) {
+        frames[free_head[order]].prev = pfn;
+    }
+    free_head[order] = pfn;
+    free_blocks[order]++;
+}
+
+static void list_remove(uint32_t pfn, uint32_t order)
+{
+    if (frames[pfn].prev != PMM_NONE) {
+        frames[frames[pfn].prev].next = frames[pfn].next;
+    } else {
+        free_head[order] = frames[pfn].next;
+    }
+    if (frames[pfn].next != PMM_NONE) {
+        frames[frames[pfn].next].prev = frames[pfn].prev;
+    }
+    frames[pfn].state = FRAME_RESERVED;
+    free_blocks[order]--;
+}
+
+/* Return a block to the free lists, merging with its buddy while possible */
+static void free_block(uint32_t pfn, uint32_t order)
+{
+    free_pages += 1u << order;
+
+    /* No longer allocated, whatever block it ends up inside: a second
+       free of this pfn must fail the check in pmm_free_pages() */
+    frames[pfn].state = FRAME_RESERVED;
+
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= max_pfn) break;
+        if (frames[buddy].state != FRAME_FREE || frames[buddy].order != order) break;
+
+        list_remove(buddy, order);
+        pfn &= ~(1u << order);
+        order++;
+    }
+
+    list_push(pfn, order);
+}
+
+static uint32_t align_up(uint32_t addr)
+{
+    return (addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
+
+/* Keep [start, end) out of the allocator. A range touching one already
+   excluded is merged into it (modules are usually loaded back to back).
+   Returns 0, or -1 with a warning when every slot is taken. */
+static int pmm_exclude(uint32_t start, uint32_t end)
+{
+    if (start >= end) {
+        return 0;
+    }
+    start = start & ~(PAGE_SIZE - 1);
+    end   = align_up(end);
+    for (int i = 0; i < exclude_count; i++) {
+        if (start <= exclude_end[i] && exclude_start[i] <= end) {
+            if (start < exclude_start[i]) exclude_start[i] = start;
+            if (end > exclude_end[i])     exclude_end[i]   = end;
+            return 0;
+        }
+    }
+    if (exclude_count == PMM_MAX_EXCLUDE) {
+        kprint("[PMM] Too many reserved ranges, not reserving 0x");
+        kprint_hex(start);
+        kprint("\n");
+        return -1;
+    }
+    exclude_start[exclude_count] = start;
+    exclude_end[exclude_count]   = end;
+    exclude_count++;
+    return 0;
+}
+
+int pmm_is_reserved(uint32_t start, uint32_t end)
+{
+    for (int i = 0; i < exclude_count; i++) {
+        if (exclude_start[i] <= start && end <= exclude_end[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Size the descriptor table for `mem_end` bytes of physical memory and
+   reset all frames to reserved. */
+static void pmm_setup(uint32_t mem_end)
+{
+    uint32_t i;
+
+    if (mem_end > DIRECT_MAP_END) {
+        mem_end = DIRECT_MAP_END;
+    }
+    max_pfn = mem_end / PAGE_SIZE;
+
+    /* The table goes right after the kernel, unless that would overwrite
+       an excluded range: loaders tend to put modules there */
+    uint32_t base  = align_up((uint32_t)kernel_end);
+    uint32_t bytes = align_up(max_pfn * sizeof(pmm_frame_t));
+    for (int k = 0; k < exclude_count; k++) {
+        if (base < exclude_end[k] && exclude_start[k] < base + bytes) {
+            base = exclude_end[k];
+            k = -1; /* Recheck the ranges below the new spot */
+        }
+    }
+    frames     = (pmm_frame_t *)base;
+    frames_end = base + bytes;
+
+    for (i = 0; i <= PMM_MAX_ORDER; i++) {
+        free_head[i]   = PMM_NONE;
+        free_blocks[i] = 0;
+    }
+    for (i = 0; i < max_pfn; i++) {
+        frames[i].state = FRAME_RESERVED;
+    }
+    free_pages  = 0;
+    total_pages = 0;
+}
+
+/* Hand [start, end) over in the largest aligned blocks that fit */
+static void pmm_free_range(uint32_t start, uint32_t end)
+{
+    uint32_t pfn = start / PAGE_SIZE;
+    uint32_t end_pfn = end / PAGE_SIZE;
+
+    while (pfn < end_pfn) {
+        uint32_t order = 0;
+        while (order < PMM_MAX_ORDER &&
+               (pfn & ((2u << order) - 1)) == 0 &&
+               pfn + (2u << order) <= end_pfn) {
+            order++;
+        }
+        free_block(pfn, order);
+        total_pages += 1u << order;
+        pfn += 1u << order;
+    }
+}
+
+/* Add a usable RAM region, minus the kernel, the frame table and any
+   excluded ranges. */
+static void pmm_add_region(uint32_t start, uint32_t end, int first_exclude)
+{
+    start = align_up(start);
+    end  &= ~(PAGE_SIZE - 1);
+    if (start < frames_end) start = frames_end;
+    if (end > max_pfn * PAGE_SIZE) end = max_pfn * PAGE_SIZE;
+    if (start >= end) return;
+
+    for (int i = first_exclude; i < exclude_count; i++) {
+        if (exclude_start[i] < end && exclude_end[i] > start) {
+            pmm_add_region(start, exclude_start[i], i + 1);
+            pmm_add_region(exclude_end[i], end, i + 1);
+            return;
+        }
+    }
+    pmm_free_range(start, end);
+}
+
+/* Shrinker: idle pre-zeroed frames go back to the buddy lists first */
+static uint32_t zero_shrink_count(void)
+{
+    return zero_count;
+}
+
+static uint32_t zero_shrink_scan(uint32_t nr)
+{
+    uint32_t freed = 0;
+    while (zero_count && freed < nr) {
+        pmm_free_page(zero_pool[--zero_count]);
+        freed++;
+    }
+    return freed;
+}
+
+static shrinker_t zero_shrinker = {
+    .name     = "zero-pool",
+    .priority = 0,
+    .count    = zero_shrink_count,
+    .scan     = zero_shrink_scan,
+};
+
+/* Scale the watermarks with managed memory (min is 1/256 of it) and
+   let the shrinkers see the zero pool */
+static void pmm_setup_reclaim(void)
+{
+    wmark_min = total_pages / 256;
+    if (wmark_min < 16) wmark_min = 16;
+    wmark_low  = wmark_min * 2;
+    wmark_high = wmark_min * 3;
+    shrinker_register(&zero_shrinker);
+}
 
 void pmm_init(uint32_t mem_size)
 {
-    system_max_mem = mem_size;
+    pmm_setup(mem_size);
+    pmm_add_region(0, mem_size, 0);
+    pmm_setup_reclaim();
 }
 
-uint32_t pmm_alloc_page(void)
+/* Keep the boot information out of the allocator: the info block and
+   command line first, as they are read again late in boot, then the
+   memory map, the module list and the modules (an initramfs), which stay
+   reserved for good since files are served from them in place. A module
+   that finds no free slot is not mounted (see pmm_is_reserved()). */
+static void pmm_exclude_boot_info(multiboot_info_t *mbi)
+{
+    exclude_count = 0;
+    pmm_exclude((uint32_t)mbi, (uint32_t)mbi + sizeof(multiboot_info_t));
+    if (mbi->flags & MULTIBOOT_INFO_CMDLINE) {
+        const char *cmdline = (const char *)mbi->cmdline;
+        uint32_t len = 0;
+        while (cmdline[len]) len++;
+        pmm_exclude(mbi->cmdline, mbi->cmdline + len + 1);
+    }
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        pmm_exclude(mbi->mmap_addr, mbi->mmap_addr + mbi->mmap_length);
+    }
+    if (!(mbi->flags & MULTIBOOT_INFO_MODS)) {
+        return;
+    }
+    multiboot_module_t *mods = (multiboot_module_t *)mbi->mods_addr;
+    pmm_exclude(mbi->mods_addr, mbi->mods_addr + mbi->mods_count * sizeof(multiboot_module_t));
+    for (uint32_t i = 0; i < mbi->mods_count; i++) {
+        if (mods[i].mod_start < DIRECT_MAP_END) {
+            pmm_exclude(mods[i].mod_start, mods[i].mod_end);
+        }
+    }
+}
+
+void pmm_init_multiboot(uint32_t magic, multiboot_info_t *mbi)
 {
-    if (free_mem_start >= system_max_mem) {
-        return 0; // Out of memory
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC) {
+        kprint("[PMM] No Multiboot info, assuming 16MB\n");
+        pmm_init(0x1000000);
+        return;
     }
+    pmm_exclude_boot_info(mbi);
+    if (!(mbi->flags & MULTIBOOT_INFO_MEM_MAP)) {
+        /* No E820 map: fall back to the contiguous amount above 1MB */
+        uint32_t mem = 0x1000000;
+        if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+            mem = 0x100000 + mbi->mem_upper * 1024;
+        }
+        kprint("[PMM] No memory map, using mem_upper\n");
+        pmm_init(mem);
+        return;
+    }
+
+    uint32_t mmap     = mbi->mmap_addr;
+    uint32_t mmap_end = mbi->mmap_addr + mbi->mmap_length;
+    multiboot_mmap_entry_t *e;
+
+    /* Pass 1: highest usable address below 4GB sizes the frame table */
+    uint32_t mem_end = 0;
+    for (uint32_t p = mmap; p < mmap_end; p += e->size + 4) {
+        e = (multiboot_mmap_entry_t *)p;
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE || e->base_high) continue;
+        uint32_t end = e->base_low + e->len_low;
+        if (e->len_high || end < e->base_low) end = 0xFFFFF000;
+        if (end > mem_end) mem_end = end;
+    }
+
+    pmm_setup(mem_end);
+
+    /* Pass 2: hand every available region to the buddy allocator, and
+       note the parts the direct map does not cover as high memory */
+    high_regions = 0;
+    for (uint32_t p = mmap; p < mmap_end; p += e->size + 4) {
+        e = (multiboot_mmap_entry_t *)p;
+        uint32_t end = e->base_low + e->len_low;
+        if (e->len_high || end < e->base_low) end = 0xFFFFF000;
+
+        kprint("[PMM] ");
+        if (e->base_high) {
+            kprint_hex(e->base_high);
+            kprint(":");
+        }
+        kprint_hex(e->base_low);
+        kprint(" (");
+        kprint_dec((e->len_high << 22) | (e->len_low >> 10));
+        kprint(" KB)");
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE) {
+            kprint(" reserved\n");
+            continue;
+        }
 
-    uint32_t alloc = free_mem_start;
-    free_mem_start += PAGE_SIZE;
-    return alloc;
+        uint64_t base64 = ((uint64_t)e->base_high << 32) | e->base_low;
+        uint64_t end64  = base64 + (((uint64_t)e->len_high << 32) | e->len_low);
+        uint32_t first = (uint32_t)((base64 + PAGE_SIZE - 1) >> 12);
+        uint32_t last  = (uint32_t)(end64 >> 12);
+        if (first < PMM_HIGH_BASE_PFN) first = PMM_HIGH_BASE_PFN;
+        if (first < last && high_regions < PMM_MAX_HIGH_REGIONS) {
+            high_start[high_regions] = first;
+            high_end[high_regions]   = last;
+            high_regions++;
+        }
+
+        kprint(e->base_high ? " usable, high memory\n" : " usable\n");
+        if (!e->base_high) {
+            pmm_add_region(e->base_low, end, 0);
+        }
+    }
+    pmm_setup_reclaim();
+
+    kprint("[PMM] ");
+    kprint_dec(total_pages / 256);
+    kprint(" MB managed, frame table ");
+    kprint_dec((frames_end - (uint32_t)frames) / 1024);
+    kprint(" KB\n");
+}
+
+uint32_t pmm_max_phys(void)
+{
+    return max_pfn * PAGE_SIZE;
+}
+
+/* Mark bits [first, last) of the high bitmap, a word at a time where possible */
+static void high_mark(uint32_t first, uint32_t last, int used)
+{
+    uint32_t i = first;
+    while (i < last) {
+        if ((i & 31) == 0 && i + 32 <= last) {
+            high_map[i >> 5] = used ? 0xFFFFFFFF : 0;
+            i += 32;
+            continue;
+        }
+        if (used) {
+            high_map[i >> 5] |= 1u << (i & 31);
+        } else {
+            high_map[i >> 5] &= ~(1u << (i & 31));
+        }
+        i++;
+    }
+}
+
+void pmm_high_init(uint32_t limit_pfn)
+{
+    high_end_pfn = 0;
+    for (int r = 0; r < high_regions; r++) {
+        uint32_t end = high_end[r] < limit_pfn ? high_end[r] : limit_pfn;
+        if (end > high_end_pfn) high_end_pfn = end;
+    }
+    if (high_end_pfn <= PMM_HIGH_BASE_PFN) {
+        high_end_pfn = 0;
+        return;
+    }
+
+    /* One bit per frame; the largest block caps it at 128GB of frames */
+    uint32_t bits = high_end_pfn - PMM_HIGH_BASE_PFN;
+    uint32_t max_bits = ((uint32_t)PAGE_SIZE << PMM_MAX_ORDER) * 8;
+    if (bits > max_bits) {
+        bits = max_bits;
+        high_end_pfn = PMM_HIGH_BASE_PFN + bits;
+    }
+    uint32_t bytes = (bits + 31) / 32 * 4;
+    high_map_order = 0;
+    while (((uint32_t)PAGE_SIZE << high_map_order) < bytes) high_map_order++;
+    high_map = (uint32_t *)pmm_alloc_pages(high_map_order);
+    if (!high_map) {
+        high_end_pfn = 0;
+        kprint("[PMM] No room for the high memory bitmap\n");
+        return;
+    }
+    memset(high_map, 0xFF, bytes);
+
+    for (int r = 0; r < high_regions; r++) {
+        uint32_t first = high_start[r] - PMM_HIGH_BASE_PFN;
+        uint32_t last  = (high_end[r] < high_end_pfn ? high_end[r] : high_end_pfn) - PMM_HIGH_BASE_PFN;
+        if (first < last) {
+            high_mark(first, last, 0);
+            high_total += last - first;
+        }
+    }
+    high_free = high_total;
+    high_cursor = 0;
+
+    kprint("[PMM] ");
+    kprint_dec(high_total / 256);
+    kprint(" MB high memory, bitmap ");
+    kprint_dec(bytes / 1024);
+    kprint(" KB\n");
+}
+
+uint32_t pmm_alloc_high_frame(void)
+{
+    uint32_t flags = irq_save();
+    uint32_t pfn = 0;
+
+    if (high_free) {
+        // Next fit, skipping whole words that are taken
+        uint32_t words = (high_end_pfn - PMM_HIGH_BASE_PFN + 31) / 32;
+        uint32_t w = high_cursor / 32;
+        for (uint32_t n = 0; n < words; n++, w = (w + 1) % words) {
+            if (high_map[w] != 0xFFFFFFFF) {
+                uint32_t bit = (uint32_t)__builtin_ctz(~high_map[w]);
+                high_map[w] |= 1u << bit;
+                high_free--;
+                high_cursor = w * 32 + bit;
+                pfn = PMM_HIGH_BASE_PFN + high_cursor;
+                break;
+            }
+        }
+    }
+
+    irq_restore(flags);
+    return pfn;
+}
+
+void pmm_free_frame(uint32_t pfn)
+{
+    if (pfn < PMM_HIGH_BASE_PFN || pfn >= high_end_pfn) {
+        pmm_free_page(pfn * PAGE_SIZE);
+        return;
+    }
+    uint32_t flags = irq_save();
+    uint32_t i = pfn - PMM_HIGH_BASE_PFN;
+    if (high_map[i >> 5] & (1u << (i & 31))) {
+        high_map[i >> 5] &= ~(1u << (i & 31));
+        high_free++;
+    }
+    irq_restore(flags);
+}
+
+uint32_t pmm_high_free_count(void)
+{
+    return high_free;
+}
+
+uint32_t pmm_high_total_count(void)
+{
+    return high_total;
+}
+
+/* Run the shrinkers until `target` frames are free. Shrinkers free
+   memory, so they may land back here; those calls do nothing. */
+static uint32_t pmm_reclaim(uint32_t target)
+{
+    if (reclaiming || free_pages >= target) {
+        return 0;
+    }
+    reclaiming = 1;
+    uint32_t freed = shrink_caches(target - free_pages);
+    reclaiming = 0;
+    reclaim_frames += freed;
+    return freed;
+}
+
+uint32_t pmm_alloc_pages(uint32_t order)
+{
+    uint32_t o;
+
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+
+    /* Getting close to empty: give the caches back first */
+    if (free_pages < wmark_min + (1u << order) && !reclaiming) {
+        reclaim_direct++;
+        pmm_reclaim(wmark_low);
+    }
+
+    /* Smallest non-empty list that can satisfy the request */
+    for (o = order; o <= PMM_MAX_ORDER; o++) {
+        if (free_head[o] != PMM_NONE) break;
+    }
+    if (o > PMM_MAX_ORDER) {
+        if (order == 0 && zero_count) {
+            return zero_pool[--zero_count];
+        }
+        return 0; // Out of memory (or too fragmented)
+    }
+
+    uint32_t pfn = free_head[o];
+    list_remove(pfn, o);
+
+    /* Split, giving the upper halves back to the lower orders */
+    while (o > order) {
+        o--;
+        list_push(pfn + (1u << o), o);
+    }
+
+    frames[pfn].order = (uint8_t)order;
+    frames[pfn].state = FRAME_ALLOCATED;
+    free_pages -= 1u << order;
+    if (free_pages < wmark_low) {
+        reclaim_pending = 1;
+    }
+    return pfn * PAGE_SIZE;
+}
+
+void pmm_free_pages(uint32_t phys_addr, uint32_t order)
+{
+    uint32_t pfn = phys_addr / PAGE_SIZE;
+
+    /* Ignore addresses we never handed out (and double frees) */
+    if (pfn >= max_pfn || frames[pfn].state != FRAME_ALLOCATED) {
+        return;
+    }
+    if (frames[pfn].order != order) {
+        return;
+    }
+
+    free_block(pfn, order);
+}
+
+uint32_t pmm_alloc_page(void)
+{
+    return pmm_alloc_pages(0);
 }
 
 void pmm_free_page(uint32_t phys_addr)
 {
-    /* 
-       A watermark allocator cannot easily free individual pages 
-       without fragmentation or a bitmap. 
-       For this specific "Demand Paging Demo" task, we can ignore freeing 
-       since we just want to demonstrate loading on fault.
-    */
-    (void)phys_addr;
+    pmm_free_pages(phys_addr, 0);
+}
+
+uint32_t pmm_alloc_zeroed_page(void)
+{
+    uint32_t flags = irq_save();
+    uint32_t phys = 0;
+    if (zero_count) {
+        phys = zero_pool[--zero_count];
+        zero_hits++;
+    }
+    irq_restore(flags);
+    if (phys) {
+        return phys;
+    }
+
+    phys = pmm_alloc_page();
+    if (phys) {
+        memset((void *)phys, 0, PAGE_SIZE);
+        zero_misses++;
+    }
+    return phys;
+}
+
+uint32_t pmm_zero_refill(void)
+{
+    uint32_t done = 0;
+
+    while (done < PMM_ZERO_CHUNK) {
+        uint32_t flags = irq_save();
+        uint32_t phys = 0;
+        if (zero_count < PMM_ZERO_POOL_SIZE && free_pages > wmark_high) {
+            phys = pmm_alloc_page();
+        }
+        irq_restore(flags);
+        if (!phys) {
+            break;
+        }
+
+        // The frame is ours alone: clear it with interrupts on
+        uint64_t start = bench_now();
+        memset((void *)phys, 0, PAGE_SIZE);
+        zero_refill_cycles += bench_now() - start;
+
+        flags = irq_save();
+        if (zero_count < PMM_ZERO_POOL_SIZE) {
+            zero_pool[zero_count++] = phys;
+            zero_refilled++;
+        } else {
+            pmm_free_page(phys);
+        }
+        irq_restore(flags);
+        done++;
+    }
+    return done;
+}
+
+uint32_t pmm_reclaim_idle(void)
+{
+    uint32_t flags = irq_save();
+    uint32_t freed = 0;
+    if (reclaim_pending) {
+        reclaim_pending = 0;
+        if (free_pages < wmark_high) {
+            reclaim_background++;
+            freed = pmm_reclaim(wmark_high);
+        }
+    }
+    irq_restore(flags);
+    return freed;
+}
+
+uint32_t pmm_free_count(void)
+{
+    return free_pages + zero_count;
+}
+
+uint32_t pmm_total_count(void)
+{
+    return total_pages;
+}
+
+uint32_t pmm_wmark_high(void)
+{
+    return wmark_high;
+}
+
+/* Share of free memory that sits outside the largest free blocks, in
+   percent. 0 means every free frame is in blocks of the biggest order present. */
+static uint32_t pmm_fragmentation(void)
+{
+    int o;
+
+    if (free_pages == 0) {
+        return 0;
+    }
+    for (o = PMM_MAX_ORDER; o >= 0; o--) {
+        if (free_blocks[o]) break;
+    }
+    uint32_t largest = free_blocks[o] << o;
+    return 100 - (largest * 100) / free_pages;
+}
+
+void pmm_print_stats(void)
+{
+    kprint("PMM: ");
+    kprint_dec(free_pages);
+    kprint(" / ");
+    kprint_dec(total_pages);
+    kprint(" frames free (");
+    kprint_dec(free_pages / 256);
+    kprint(" MB)\n");
+    kprint("  kernel + frame table end at ");
+    kprint_hex(frames_end);
+    kprint("\n");
+    if (high_total) {
+        kprint("  high memory: ");
+        kprint_dec(high_free);
+        kprint(" / ");
+        kprint_dec(high_total);
+        kprint(" frames free (");
+        kprint_dec(high_free / 256);
+        kprint(" MB), bitmap ");
+        kprint_dec((PAGE_SIZE << high_map_order) / 1024);
+        kprint(" KB\n");
+    }
+
+    kprint("  free blocks by order:");
+    for (int o = 0; o <= PMM_MAX_ORDER; o++) {
+        kprint(" ");
+        kprint_dec(free_blocks[o]);
+    }
+    kprint("\n  fragmentation: ");
+    kprint_dec(pmm_fragmentation());
+    kprint("%\n");
+
+    uint32_t requests = zero_hits + zero_misses;
+    kprint("  zero pool: ");
+    kprint_dec(zero_count);
+    kprint(" / ");
+    kprint_dec(PMM_ZERO_POOL_SIZE);
+    kprint(" frames, ");
+    kprint_dec(zero_hits);
+    kprint(" hits, ");
+    kprint_dec(zero_misses);
+    kprint(" misses (");
+    kprint_dec(requests ? zero_hits * 100 / requests : 0);
+    kprint("% hit), ");
+    kprint_dec(zero_refilled);
+    kprint(" refilled while idle\n");
+    if (zero_refilled) {
+        bench_print_rate("  idle refill", zero_refilled, zero_refill_cycles);
+    }
+
+    kprint("  watermarks: min ");
+    kprint_dec(wmark_min);
+    kprint(", low ");
+    kprint_dec(wmark_low);
+    kprint(", high ");
+    kprint_dec(wmark_high);
+    kprint(" frames; reclaim: ");
+    kprint_dec(reclaim_direct);
+    kprint(" direct, ");
+    kprint_dec(reclaim_background);
+    kprint(" background, ");
+    kprint_dec(reclaim_frames);
+    kprint(" frames freed\n");
+}
+
+// ==== Benchmark ====
+
+#define PMM_BENCH_SLOTS  256
+#define PMM_BENCH_ROUNDS 200000
+
+static uint32_t bench_addr[PMM_BENCH_SLOTS];
+static uint8_t  bench_order[PMM_BENCH_SLOTS];
+
+void pmm_bench(void)
+{
+    uint32_t seed     = 12345;
+    uint32_t ops      = 0;
+    uint32_t frames_moved = 0;
+    uint32_t failures = 0;
+    uint32_t peak_frag = 0;
+    uint32_t baseline = free_pages;
+    int i;
+
+    for (i = 0; i < PMM_BENCH_SLOTS; i++) {
+        bench_addr[i] = 0;
+    }
+
+    kprint("pmmbench: ");
+    kprint_dec(PMM_BENCH_ROUNDS);
+    kprint(" random alloc/free ops over ");
+    kprint_dec(PMM_BENCH_SLOTS);
+    kprint(" slots\n");
+
+    uint64_t start = bench_now();
+    for (i = 0; i < PMM_BENCH_ROUNDS; i++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t s = (seed >> 16) & (PMM_BENCH_SLOTS - 1);
+
+        if (bench_addr[s]) {
+            pmm_free_pages(bench_addr[s], bench_order[s]);
+            frames_moved += 1u << bench_order[s];
+            bench_addr[s] = 0;
+        } else {
+            /* Mostly single frames, one in four requests is order 1..3 */
+            uint32_t order = ((seed >> 8) & 3) ? 0 : 1 + ((seed >> 10) % 3);
+            uint32_t addr  = pmm_alloc_pages(order);
+            if (!addr) {
+                failures++;
+                continue;
+            }
+            bench_addr[s]  = addr;
+            bench_order[s] = (uint8_t)order;
+            frames_moved  += 1u << order;
+        }
+        ops++;
+
+        if ((i & 0xFFF) == 0) {
+            uint32_t frag = pmm_fragmentation();
+            if (frag > peak_frag) peak_frag = frag;
+        }
+    }
+    uint64_t cycles = bench_now() - start;
+
+    bench_print_rate("  alloc/free ops", ops, cycles);
+    bench_print_rate("  frames", frames_moved, cycles);
+    kprint("  fragmentation under load: ");
+    kprint_dec(pmm_fragmentation());
+    kprint("% (peak ");
+    kprint_dec(peak_frag);
+    kprint("%), failed allocs: ");
+    kprint_dec(failures);
+    kprint("\n");
+
+    for (i = 0; i < PMM_BENCH_SLOTS; i++) {
+        if (bench_addr[i]) {
+            pmm_free_pages(bench_addr[i], bench_order[i]);
+            bench_addr[i] = 0;
+        }
+    }
+
+    kprint("  after teardown: ");
+    kprint_dec(free_pages);
+    kprint(" frames free, fragmentation ");
+    kprint_dec(pmm_fragmentation());
+    kprint(free_pages == baseline ? "% (no leaks)\n" : "% (LEAK!)\n");
 }
@@ -2,19 +2,86 @@
 #define PMM_H
 
 #include "paging.h" // For types
+#include "multiboot.h"
 
 /* 
-   Simple Physical Memory Manager 
-   Manages allocation of physical page frames.
+   Buddy Physical Memory Manager 
+   Manages allocation of physical page frames in power-of-two blocks.
 */
 
+/* Largest block handed out: 2^PMM_MAX_ORDER pages (4MB) */
+#define PMM_MAX_ORDER 10
+
 /* Initialize PMM with total system memory size (in bytes) */
 void pmm_init(uint32_t mem_size);
 
+/* Initialize PMM from the Multiboot memory map. Falls back to mem_upper,
+   then to 16MB, when the loader did not provide one. Boot modules stay
+   reserved for good. */
+void pmm_init_multiboot(uint32_t magic, multiboot_info_t *mbi);
+
+/* Nonzero when [start, end) lies in one range kept out of the allocator
+   at boot (boot information and modules) */
+int pmm_is_reserved(uint32_t start, uint32_t end);
+
+/* End of managed physical memory (the direct map must cover it) */
+uint32_t pmm_max_phys(void);
+
 /* Allocate a physical page frame. Returns physical address or 0 if out of memory. */
 uint32_t pmm_alloc_page(void);
 
 /* Free a physical page frame. */
 void pmm_free_page(uint32_t phys_addr);
 
+/* Allocate a frame filled with zeroes: from the pre-zeroed pool when it
+   has one, otherwise a fresh frame cleared inline. Returns 0 if out of memory. */
+uint32_t pmm_alloc_zeroed_page(void);
+
+/* Top up the pre-zeroed pool by a few frames, with interrupts enabled
+   while clearing. Called from the idle loop; returns the frames added. */
+uint32_t pmm_zero_refill(void);
+
+/* Background reclaim: once an allocation has left free frames below the
+   low watermark, run the shrinkers up to the high one. Called from the
+   idle loop; returns the frames freed. */
+uint32_t pmm_reclaim_idle(void);
+
+/* Allocate 2^order physically contiguous frames, aligned to their size.
+   Returns the physical address of the first frame or 0 if out of memory. */
+uint32_t pmm_alloc_pages(uint32_t order);
+
+/* Free a block previously returned by pmm_alloc_pages() with the same order. */
+void pmm_free_pages(uint32_t phys_addr, uint32_t order);
+
+/* High memory: usable frames the direct map does not cover (above
+   DIRECT_MAP_END, including RAM past 4GB). They are handed out as frame
+   numbers and only reachable through page tables (map_frame()). */
+
+/* Build the high memory bitmap for frames below limit_pfn, the reach of
+   the paging mode. Called by paging_init(). */
+void pmm_high_init(uint32_t limit_pfn);
+
+/* Allocate a high frame. Returns its frame number or 0 if there is none. */
+uint32_t pmm_alloc_high_frame(void);
+
+/* Free any single frame by frame number, high or direct-mapped */
+void pmm_free_frame(uint32_t pfn);
+
+/* Free / managed high frames */
+uint32_t pmm_high_free_count(void);
+uint32_t pmm_high_total_count(void);
+
+/* Number of free (pre-zeroed pool included) / managed frames */
+uint32_t pmm_free_count(void);
+uint32_t pmm_total_count(void);
+
+/* Free frames the idle loop reclaims back up to */
+uint32_t pmm_wmark_high(void);
+
+/* Print free block counts per order and fragmentation (shell: meminfo) */
+void pmm_print_stats(void);
+
+/* Alloc/free churn benchmark (shell: pmmbench) */
+void pmm_bench(void);
+
 #endif
@@ -4,6 +4,8 @@
 # Define paths (relative to src directory)
 ISO_PATH="../kernel.iso"
 BIN_PATH="../kernel.bin"
+SWAP_IMG="../swap.img"
+INITRAMFS="../isodir/boot/initramfs.tar"
 
 echo "Looking for kernel at: $BIN_PATH"
 ls -l $BIN_PATH 2>/dev/null || echo "File not found by ls"
@@ -15,15 +17,25 @@ if ! command -v qemu-system-i386 &> /dev/null; then
     exit 1
 fi
 
+# Swap disk on the primary IDE master (created empty on first run)
+if [ ! -f "$SWAP_IMG" ]; then
+    echo "Creating 64MB swap disk $SWAP_IMG..."
+    dd if=/dev/zero of="$SWAP_IMG" bs=1M count=64 status=none
+fi
+SWAP_DRIVE="-drive file=$SWAP_IMG,format=raw,if=ide,index=0"
+
 # Prefer booting the ISO if it exists (Test full bootloader flow)
 if [ -f "$ISO_PATH" ]; then
     echo "🚀 Booting $ISO_PATH..."
-    qemu-system-i386 -cdrom "$ISO_PATH" -m 128M
+    qemu-system-i386 -cdrom "$ISO_PATH" -boot d -m 128M $SWAP_DRIVE
 
 elif [ -f "$BIN_PATH" ]; then
     # Fallback to direct kernel boot (Faster, skips GRUB, good for quick tests)
     echo "⚠️  ISO not found. Booting direct kernel binary $BIN_PATH..."
-    qemu-system-i386 -kernel "$BIN_PATH" -m 128M -no-reboot -d int,guest_errors
+    # The initramfs goes in as a Multiboot module
+    INITRD=""
+    [ -f "$INITRAMFS" ] && INITRD="-initrd $INITRAMFS"
+    qemu-system-i386 -kernel "$BIN_PATH" $INITRD -m 128M $SWAP_DRIVE -no-reboot -d int,guest_errors
 
 else
     echo "❌ No kernel found! Please run ./build.sh first."
@@ -0,0 +1,61 @@
+#include "shrink.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+static shrinker_t *shrinker_list = 0;   // by priority
+static uint32_t    shrink_runs   = 0;
+
+void shrinker_register(shrinker_t *s)
+{
+    shrinker_t **p = &shrinker_list;
+    while (*p && (*p)->priority <= s->priority) {
+        p = &(*p)->next;
+    }
+    s->calls     = 0;
+    s->reclaimed = 0;
+    s->next      = *p;
+    *p = s;
+}
+
+uint32_t shrink_caches(uint32_t nr)
+{
+    uint32_t freed = 0;
+
+    shrink_runs++;
+    for (shrinker_t *s = shrinker_list; s && freed < nr; s = s->next) {
+        uint32_t avail = s->count();
+        if (avail == 0) {
+            continue;
+        }
+        uint32_t want = nr - freed;
+        uint32_t got = s->scan(want < avail ? want : avail);
+        s->calls++;
+        s->reclaimed += got;
+        freed += got;
+    }
+    return freed;
+}
+
+void shrink_print_stats(void)
+{
+    kprint("shrinker      prio  now  calls  reclaimed\n");
+    for (shrinker_t *s = shrinker_list; s; s = s->next) {
+        int len = 0;
+        kprint(s->name);
+        while (s->name[len]) len++;
+        while (len++ < 14) kprint(" ");
+
+        kprint_dec((uint32_t)s->priority);
+        kprint("     ");
+        kprint_dec(s->count());
+        kprint("    ");
+        kprint_dec(s->calls);
+        kprint("      ");
+        kprint_dec(s->reclaimed);
+        kprint("\n");
+    }
+    kprint("reclaim runs: ");
+    kprint_dec(shrink_runs);
+    kprint("\n");
+}
@@ -0,0 +1,36 @@
+#ifndef SHRINK_H
+#define SHRINK_H
+
+#include "paging.h" // For types
+
+/*
+   Shrinker registry.
+   Subsystems that hold memory they can give back (empty slabs, idle
+   pre-zeroed frames, rebuildable caches) register a shrinker. When free
+   frames drop below the PMM watermarks the shrinkers run in priority
+   order, lowest first, before the allocator fails or pages get evicted.
+   All counts are in frames.
+*/
+
+typedef struct shrinker {
+    const char *name;
+    int         priority;                // lower runs first (cheaper to lose)
+    uint32_t  (*count)(void);            // frames scan() could free now
+    uint32_t  (*scan)(uint32_t nr);      // free up to nr frames, return freed
+
+    uint32_t    calls;
+    uint32_t    reclaimed;
+    struct shrinker *next;
+} shrinker_t;
+
+/* Add a shrinker. It must stay valid forever (static storage). */
+void shrinker_register(shrinker_t *s);
+
+/* Run the shrinkers in priority order until `nr` frames are freed or
+   every one has had its turn. Returns the frames freed. */
+uint32_t shrink_caches(uint32_t nr);
+
+/* Print every shrinker with its reclaimable and reclaimed frames (shell: shrinkers) */
+void shrink_print_stats(void);
+
+#endif
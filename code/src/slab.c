@@ -0,0 +1,337 @@
+#include "slab.h"
+#include "pmm.h"
+#include "shrink.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+/* 
+   Slab layout (one buddy block of PAGE_SIZE << order bytes):
+   
+     [kmem_slab_t header][obj 0][obj 1] ... [obj n-1][unused tail]
+   
+   Free objects are chained through a link word. Without a constructor the
+   link overlays the start of the object; with one it sits after the object
+   so the constructed state survives a free/alloc cycle.
+*/
+
+#define SLAB_MAX_ORDER    3
+#define KMALLOC_LARGE_MAGIC 0x4B4D4C47  // "KMLG"
+
+struct kmem_slab {
+    kmem_slab_t  *next;
+    kmem_slab_t  *prev;
+    kmem_cache_t *cache;
+    void         *free;     // first free object
+    uint32_t      inuse;    // objects handed out from this slab
+};
+
+#define SLAB_HDR_SIZE ((sizeof(kmem_slab_t) + 7) & ~7u)
+
+/* Header in front of a kmalloc() request too big for the size classes */
+typedef struct {
+    uint32_t magic;
+    uint32_t order;
+    uint32_t pad[2];
+} kmalloc_large_t;
+
+static kmem_cache_t  cache_cache;      // the cache kmem_cache_t objects come from
+static kmem_cache_t *cache_list = 0;
+/* KMALLOC_MIN .. KMALLOC_MAX. These all fit 4+ objects in one page, so
+   kfree() can find the slab header by masking with PAGE_SIZE. */
+static kmem_cache_t *kmalloc_caches[6];
+static const char   *kmalloc_names[6] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64",
+    "kmalloc-128", "kmalloc-256", "kmalloc-512"
+};
+
+static void **obj_link(kmem_cache_t *c, void *obj)
+{
+    return (void **)((uint8_t *)obj + c->link_offset);
+}
+
+static void slab_list_add(kmem_slab_t **head, kmem_slab_t *s)
+{
+    s->prev = 0;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void slab_list_del(kmem_slab_t **head, kmem_slab_t *s)
+{
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = 0;
+}
+
+/* Fill in the geometry of a cache. Slabs stay one page unless that would
+   hold fewer than 4 objects. */
+static void cache_setup(kmem_cache_t *c, const char *name, uint32_t size, kmem_ctor_t ctor)
+{
+    uint32_t stride = (size + 7) & ~7u;
+    if (stride < sizeof(void *)) stride = sizeof(void *);
+
+    c->link_offset = 0;
+    if (ctor) {
+        c->link_offset = stride;
+        stride += sizeof(void *);
+    }
+
+    c->order = 0;
+    while (c->order < SLAB_MAX_ORDER &&
+           ((PAGE_SIZE << c->order) - SLAB_HDR_SIZE) / stride < 4) {
+        c->order++;
+    }
+
+    c->name          = name;
+    c->obj_size      = size;
+    c->stride        = stride;
+    c->objs_per_slab = ((PAGE_SIZE << c->order) - SLAB_HDR_SIZE) / stride;
+    c->ctor          = ctor;
+    c->partial = c->full = c->empty = 0;
+    c->slabs = c->active_objs = c->allocs = c->hits = c->frees = 0;
+
+    c->next    = cache_list;
+    cache_list = c;
+}
+
+/* Grab a new block from the PMM and thread its objects onto a free list */
+static kmem_slab_t *cache_grow(kmem_cache_t *c)
+{
+    uint32_t block = pmm_alloc_pages(c->order);
+    if (!block) {
+        return 0;
+    }
+
+    kmem_slab_t *s = (kmem_slab_t *)block;
+    s->cache = c;
+    s->inuse = 0;
+    s->free  = 0;
+
+    uint8_t *obj = (uint8_t *)block + SLAB_HDR_SIZE;
+    for (uint32_t i = 0; i < c->objs_per_slab; i++, obj += c->stride) {
+        if (c->ctor) c->ctor(obj);
+        *obj_link(c, obj) = s->free;
+        s->free = obj;
+    }
+
+    c->slabs++;
+    return s;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, kmem_ctor_t ctor)
+{
+    if (size == 0 || size > (PAGE_SIZE << SLAB_MAX_ORDER) - SLAB_HDR_SIZE) {
+        return 0;
+    }
+
+    if (!cache_cache.name) {
+        cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 0);
+    }
+
+    kmem_cache_t *c = (kmem_cache_t *)kmem_cache_alloc(&cache_cache);
+    if (!c) {
+        return 0;
+    }
+    cache_setup(c, name, size, ctor);
+    return c;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c)
+{
+    kmem_slab_t *s = c->partial;
+
+    c->allocs++;
+    if (s) {
+        c->hits++;
+    } else if (c->empty) {
+        c->hits++;
+        s = c->empty;
+        slab_list_del(&c->empty, s);
+        slab_list_add(&c->partial, s);
+    } else {
+        s = cache_grow(c);
+        if (!s) {
+            c->allocs--;
+            return 0;
+        }
+        slab_list_add(&c->partial, s);
+    }
+
+    void *obj = s->free;
+    s->free = *obj_link(c, obj);
+    s->inuse++;
+    c->active_objs++;
+
+    if (s->inuse == c->objs_per_slab) {
+        slab_list_del(&c->partial, s);
+        slab_list_add(&c->full, s);
+    }
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj)
+{
+    if (!obj) {
+        return;
+    }
+
+    kmem_slab_t *s = (kmem_slab_t *)((uint32_t)obj & ~((PAGE_SIZE << c->order) - 1));
+    if (s->cache != c) {
+        return; // Not ours
+    }
+
+    *obj_link(c, obj) = s->free;
+    s->free = obj;
+    c->active_objs--;
+    c->frees++;
+
+    if (s->inuse-- == c->objs_per_slab) {
+        slab_list_del(&c->full, s);
+        slab_list_add(&c->partial, s);
+    }
+    if (s->inuse == 0) {
+        slab_list_del(&c->partial, s);
+        slab_list_add(&c->empty, s);
+    }
+}
+
+/* Free up to `max` empty slabs of a cache, returning the frames freed */
+static uint32_t cache_release_empty(kmem_cache_t *c, uint32_t max_frames)
+{
+    uint32_t freed = 0;
+    while (c->empty && freed < max_frames) {
+        kmem_slab_t *s = c->empty;
+        slab_list_del(&c->empty, s);
+        s->cache = 0;
+        pmm_free_pages((uint32_t)s, c->order);
+        c->slabs--;
+        freed += 1u << c->order;
+    }
+    return freed;
+}
+
+uint32_t kmem_cache_shrink(kmem_cache_t *c)
+{
+    return cache_release_empty(c, 0xFFFFFFFF);
+}
+
+// ==== Shrinker: empty slabs of every cache ====
+
+static uint32_t slab_shrink_count(void)
+{
+    uint32_t frames = 0;
+    for (kmem_cache_t *c = cache_list; c; c = c->next) {
+        for (kmem_slab_t *s = c->empty; s; s = s->next) {
+            frames += 1u << c->order;
+        }
+    }
+    return frames;
+}
+
+static uint32_t slab_shrink_scan(uint32_t nr)
+{
+    uint32_t freed = 0;
+    for (kmem_cache_t *c = cache_list; c && freed < nr; c = c->next) {
+        freed += cache_release_empty(c, nr - freed);
+    }
+    return freed;
+}
+
+static shrinker_t slab_shrinker = {
+    .name     = "slab",
+    .priority = 10,
+    .count    = slab_shrink_count,
+    .scan     = slab_shrink_scan,
+};
+
+// ==== kmalloc ====
+
+void slab_init(void)
+{
+    uint32_t size = KMALLOC_MIN;
+    for (int i = 0; size <= KMALLOC_MAX; i++, size <<= 1) {
+        kmalloc_caches[i] = kmem_cache_create(kmalloc_names[i], size, 0);
+    }
+    shrinker_register(&slab_shrinker);
+}
+
+void *kmalloc(uint32_t size)
+{
+    if (size <= KMALLOC_MAX) {
+        uint32_t cls = KMALLOC_MIN;
+        int i = 0;
+        while (cls < size) {
+            cls <<= 1;
+            i++;
+        }
+        if (!kmalloc_caches[i]) {
+            return 0;
+        }
+        return kmem_cache_alloc(kmalloc_caches[i]);
+    }
+
+    /* Large request: whole buddy block with a small header in front */
+    uint32_t order = 0;
+    while (order <= PMM_MAX_ORDER && ((uint32_t)PAGE_SIZE << order) < size + sizeof(kmalloc_large_t)) {
+        order++;
+    }
+    if (order > PMM_MAX_ORDER) {
+        return 0;
+    }
+    kmalloc_large_t *hdr = (kmalloc_large_t *)pmm_alloc_pages(order);
+    if (!hdr) {
+        return 0;
+    }
+    hdr->magic = KMALLOC_LARGE_MAGIC;
+    hdr->order = order;
+    return hdr + 1;
+}
+
+void kfree(void *ptr)
+{
+    if (!ptr) {
+        return;
+    }
+
+    /* Slab objects always follow a slab header, so only large blocks hand
+       out pointers exactly one header past a page boundary. */
+    uint32_t addr = (uint32_t)ptr;
+    if ((addr & (PAGE_SIZE - 1)) == sizeof(kmalloc_large_t)) {
+        kmalloc_large_t *hdr = (kmalloc_large_t *)ptr - 1;
+        if (hdr->magic == KMALLOC_LARGE_MAGIC) {
+            hdr->magic = 0;
+            pmm_free_pages((uint32_t)hdr, hdr->order);
+            return;
+        }
+    }
+
+    kmem_slab_t *s = (kmem_slab_t *)(addr & ~(PAGE_SIZE - 1));
+    kmem_cache_free(s->cache, ptr);
+}
+
+// ==== slabinfo ====
+
+void slab_print_info(void)
+{
+    kprint("cache          objs/total  size  pages  hit%\n");
+    for (kmem_cache_t *c = cache_list; c; c = c->next) {
+        int len = 0;
+        kprint(c->name);
+        while (c->name[len]) len++;
+        while (len++ < 15) kprint(" ");
+
+        kprint_dec(c->active_objs);
+        kprint("/");
+        kprint_dec(c->slabs * c->objs_per_slab);
+        kprint("  ");
+        kprint_dec(c->obj_size);
+        kprint("  ");
+        kprint_dec(c->slabs << c->order);
+        kprint("  ");
+        kprint_dec(c->allocs ? (c->hits * 100) / c->allocs : 0);
+        kprint("\n");
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "paging.h" // For types
+
+/* 
+   Slab Allocator
+   Per-type object caches carved out of PMM blocks. Each slab is one buddy
+   block with a small header at its start, so the slab owning an object is
+   found by masking the object address. Alloc and free are O(1).
+*/
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+typedef struct kmem_slab kmem_slab_t;
+
+typedef struct kmem_cache {
+    const char  *name;
+    uint32_t     obj_size;      // requested object size
+    uint32_t     stride;        // bytes per object in the slab (incl. free link)
+    uint32_t     link_offset;   // where the free-list link lives inside an object
+    uint32_t     objs_per_slab;
+    uint32_t     order;         // slab size is PAGE_SIZE << order
+    kmem_ctor_t  ctor;
+
+    kmem_slab_t *partial;       // some objects free
+    kmem_slab_t *full;          // no objects free
+    kmem_slab_t *empty;         // all objects free (kept for reuse)
+
+    uint32_t     slabs;         // slabs currently owned
+    uint32_t     active_objs;   // objects handed out
+    uint32_t     allocs;
+    uint32_t     hits;          // allocs served without growing the cache
+    uint32_t     frees;
+
+    struct kmem_cache *next;    // all caches, for slabinfo
+} kmem_cache_t;
+
+/* Create a cache of `size`-byte objects. `ctor` (may be 0) runs once per
+   object when a slab is created; freed objects must be returned in their
+   constructed state. Returns 0 if no memory. */
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, kmem_ctor_t ctor);
+
+/* Allocate an object, or 0 if out of memory */
+void *kmem_cache_alloc(kmem_cache_t *cache);
+
+/* Return an object to its cache */
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+
+/* Give the frames of every empty slab back to the PMM. Returns the
+   frames freed. */
+uint32_t kmem_cache_shrink(kmem_cache_t *cache);
+
+/* General purpose allocation from power-of-two size classes. Requests
+   larger than KMALLOC_MAX come straight from the PMM. */
+#define KMALLOC_MIN 16
+#define KMALLOC_MAX 512
+void *kmalloc(uint32_t size);
+void  kfree(void *ptr);
+
+/* Set up the kmalloc size classes. Call once after pmm_init(). */
+void slab_init(void);
+
+/* Print every cache (shell: slabinfo) */
+void slab_print_info(void);
+
+#endif
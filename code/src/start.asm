@@ -7,6 +7,12 @@
 ; ==============================================================================
 
 bits 32
+
+MB_MAGIC     equ 0x1BADB002
+MB_PAGEALIGN equ 1 << 0   ; Load modules on page boundaries
+MB_MEMINFO   equ 1 << 1   ; Ask for mem_lower/mem_upper and the memory map
+MB_FLAGS     equ MB_PAGEALIGN | MB_MEMINFO
+
 section .multiboot
     ; Entry point for our custom 16-bit bootloader to jump to at 0x100000
     jmp start
@@ -14,9 +20,9 @@ section .multiboot
     align 4
     ; Multiboot header (aligned and checksummed)
     ; This header tells the bootloader (like GRUB) that this is a valid kernel.
-    dd 0x1BADB002         ; Magic number (Multiboot 1)
-    dd 0x00               ; Flags (0 means no special requests)
-    dd -(0x1BADB002 + 0x00) ; Checksum (Magic + Flags + Checksum must equal 0)
+    dd MB_MAGIC           ; Magic number (Multiboot 1)
+    dd MB_FLAGS           ; Flags (page-aligned modules + memory map)
+    dd -(MB_MAGIC + MB_FLAGS) ; Checksum (Magic + Flags + Checksum must equal 0)
 
 section .text
 
@@ -27,10 +33,34 @@ global load_idt
 global keyboard_handler
 global timer_handler
 global mouse_handler
+global ata_irq_stub
 extern kmain
 extern keyboard_handler_main
 extern timer_handler_main
 extern mouse_handler_main
+extern ata_irq_handler
+extern kstring_fxsr_enabled
+
+; Handlers may use SSE through memcpy/memset, so once kstring_init() has
+; enabled it the interrupted code's SSE state is saved around the call.
+; Both macros run after pusha; EBP keeps the unaligned stack pointer.
+%macro FPU_SAVE 0
+    mov ebp, esp
+    cmp dword [kstring_fxsr_enabled], 0
+    je %%skip
+    sub esp, 512
+    and esp, 0xFFFFFFF0 ; fxsave needs a 16-byte aligned area
+    fxsave [esp]
+%%skip:
+%endmacro
+
+%macro FPU_RESTORE 0
+    cmp dword [kstring_fxsr_enabled], 0
+    je %%skip
+    fxrstor [esp]
+%%skip:
+    mov esp, ebp
+%endmacro
 
 ; Function: read_port
 ; Description: Reads a byte from an I/O port.
@@ -62,7 +92,9 @@ load_idt:
 ; Description: ISR for keyboard interrupts. Calls C handler.
 keyboard_handler:
     pusha
+    FPU_SAVE
     call keyboard_handler_main
+    FPU_RESTORE
     popa
     iret
 
@@ -70,7 +102,9 @@ keyboard_handler:
 ; Description: ISR for timer interrupts. Calls C handler.
 timer_handler:
     pusha
+    FPU_SAVE
     call timer_handler_main
+    FPU_RESTORE
     popa
     iret
 
@@ -78,7 +112,19 @@ timer_handler:
 ; Description: ISR for mouse interrupts. Calls C handler.
 mouse_handler:
     pusha
+    FPU_SAVE
     call mouse_handler_main
+    FPU_RESTORE
+    popa
+    iret
+
+; Function: ata_irq_stub
+; Description: ISR for the primary ATA channel (IRQ14). Calls C handler.
+ata_irq_stub:
+    pusha
+    FPU_SAVE
+    call ata_irq_handler
+    FPU_RESTORE
     popa
     iret
 
@@ -90,7 +136,11 @@ page_fault_stub:
     ; Page Fault pushes an error code automatically onto the stack.
     ; We should save registers here (pusha) if we want to return to the interrupted code safely.
     pusha
+    FPU_SAVE
+    push dword [ebp + 32] ; Error code (above the 8 pusha registers) as the argument
     call page_fault_handler
+    add esp, 4
+    FPU_RESTORE
     popa
     add esp, 4 ; Remove error code pushed by CPU
     iret
@@ -115,6 +165,11 @@ start:
     ; Correct usage: Point ESP to the top of the stack (which grows down).
     ; Since `stack_space` is after the `resb`, it is already at the top.
     mov esp, stack_space
+
+    ; Pass the Multiboot info pointer (EBX) and magic (EAX) to kmain.
+    ; Our custom 16-bit bootloader leaves garbage here; kmain checks the magic.
+    push ebx
+    push eax
     
     ; DEBUG: write 'X' to 0x3F8 directly
     mov dx, 0x3f8
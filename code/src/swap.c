@@ -1,99 +1,956 @@
 #include "swap.h"
+#include "lz.h"
+#include "bench.h"
+#include "dedup.h"
+#include "ata.h"
+#include "kstring.h"
+#include "vmalloc.h"
+#include "pmm.h"
+#include "config.h"
 
-// Simulate 1MB of swap space (256 pages)
-#define SWAP_MAX_PAGES 256
-#define SWAP_INVALID 0xFFFFFFFF
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+// Index entries: how many pages swap can hold (boot option swap_slots).
+// Backing space is shared between the compressed pool, the swap disk and
+// the raw page store below.
+#define SWAP_DEFAULT_SLOTS 4096
+#define SWAP_MAX_SLOTS     32768
+
+// Hash index: virtual page -> slot. The smallest power of two holding
+// twice as many buckets as slots keeps chains short.
+#define SWAP_NONE      -1
+
+// In-RAM backing store: a pool of 64-byte chunks for LZ output (boot
+// option swap_pool, in KB), and raw 4KB pages (swap_raw) for data that
+// does not compress when no swap disk is attached or it stops taking
+// writes. Nothing is allocated until swap_prepare() runs as the first
+// pageable page is tracked, while memory is still plentiful. Raw pages are
+// reserved then too, so storing a page on the eviction path never has to
+// ask the PMM for memory it is trying to free.
+#define SWAP_DEFAULT_POOL_KB 512
+#define SWAP_MAX_POOL_KB     4096   // 65536 chunks, the reach of a 16-bit loc
+#define SWAP_DEFAULT_RAW     128
+#define SWAP_MAX_RAW         65536
+#define SWAP_CHUNK_SIZE      64
+#define SWAP_LZ_MAX          (PAGE_SIZE * 3 / 4)  // larger output is stored raw
+
+// How a slot's page is stored
+#define SWAP_KIND_ZERO 0    // all zero bytes, nothing stored
+#define SWAP_KIND_LZ   1    // compressed, in the chunk pool
+#define SWAP_KIND_RAW  2    // uncompressed, in a raw page
+#define SWAP_KIND_DISK 3    // uncompressed, on the swap disk
+
+// Swap disk: page n lives at sector n * SWAP_DISK_SECTORS. Writes are
+// staged in RAM and go out in clusters of consecutive disk pages.
+#define SWAP_DISK_SECTORS   (PAGE_SIZE / ATA_SECTOR_SIZE)
+#define SWAP_DISK_MAX_PAGES 65536   // 256MB, the reach of a 16-bit loc
+#define SWAP_WB_PAGES       16      // staging buffers
+#define SWAP_WB_CLUSTER     8       // queued pages that start a write
+#define SWAP_WB_MAX_ERRORS  3       // failed writes in a row that retire the disk
+
+#define SWAP_WB_FREE     0
+#define SWAP_WB_QUEUED   1
+#define SWAP_WB_INFLIGHT 2
 
 typedef struct {
     uint32_t virt_addr; // The virtual address this page belongs to
-    uint8_t data[PAGE_SIZE];
-    int used;
+    uint8_t  used;
+    uint8_t  evicted;   // RAM copy was dropped by the evictor
+    int      blob;      // backing copy, or SWAP_NONE for a zero page
 } swap_page_t;
 
-static swap_page_t swap_storage[SWAP_MAX_PAGES];
+// A stored page image. Slots with identical contents share one blob.
+typedef struct {
+    uint32_t hash;      // dedup_page_hash() of the uncompressed page
+    uint16_t refs;      // slots using this copy, 0 when free
+    uint8_t  kind;      // SWAP_KIND_LZ, SWAP_KIND_RAW or SWAP_KIND_DISK
+    uint16_t len;       // compressed length (SWAP_KIND_LZ)
+    uint16_t loc;       // first chunk (LZ), raw page (RAW) or disk page (DISK)
+} swap_blob_t;
+
+// A disk write waiting in (or being sent from) a staging buffer
+typedef struct {
+    int      blob;      // owner, SWAP_NONE once the blob was dropped
+    uint16_t dpage;
+    uint8_t  state;     // SWAP_WB_*
+} swap_wb_t;
+
+// Sizes from the boot options, read by swap_init()
+static uint32_t swap_slots       = 0;
+static uint32_t swap_hash_bits   = 0;
+static uint32_t swap_hash_size   = 0;
+static uint32_t swap_pool_chunks = 0;
+static uint32_t swap_raw_pages   = 0;
+
+// Everything below the sizes is allocated by swap_setup()
+static int      swap_ready = 0;
+static uint8_t *swap_meta  = 0;         // vmalloc area holding the arrays
+static uint32_t swap_meta_bytes = 0;
+
+static swap_page_t *swap_entries;
+
+static swap_blob_t *swap_blobs;
+static int *swap_blob_head;             // content hash buckets
+static int *swap_blob_next;             // bucket chain, or free list link
+static int  swap_blob_free = SWAP_NONE;
+
+static uint32_t *swap_raw_frames;       // backing frame of each raw page
+static int      *swap_raw_free;         // stack of free raw pages
+static int       swap_raw_top = 0;
+
+static uint8_t  *swap_pool;
+static uint32_t *swap_pool_map;         // 1 = chunk in use
+static uint32_t  swap_pool_cursor = 0;  // next-fit start
+static uint32_t  swap_pool_used = 0;
+
+static uint8_t  swap_scratch[PAGE_SIZE];
+
+static uint32_t  swap_disk_pages = 0;   // 0 when there is no disk
+static uint32_t *swap_disk_map;
+static uint32_t  swap_disk_cursor = 0;  // next-fit start
+static uint32_t  swap_disk_used = 0;
+
+static swap_wb_t swap_wb[SWAP_WB_PAGES];
+static uint8_t  *swap_wb_buf;           // SWAP_WB_PAGES staging pages
+static uint32_t  swap_wb_queued = 0;
+static uint32_t  swap_wb_failing = 0;   // failed writes since the last success
+static int       swap_disk_failed = 0;  // no more writes or new disk pages
+
+static int *swap_hash_head;             // first slot in each bucket
+static int *swap_next;                  // bucket chain, or free list link
+static int  swap_free_head = SWAP_NONE;
+static int  swap_used_count = 0;
+
+// Counters for swapinfo
+static uint32_t swap_lookups   = 0;
+static uint32_t swap_hits      = 0;
+static uint32_t swap_probes    = 0;  // chain entries visited by all lookups
+static uint32_t swap_max_probe = 0;
+
+static uint32_t swap_kind_count[4];        // zero slots, LZ and raw blobs
+static uint32_t swap_dedup_pages    = 0;   // slots sharing another slot's blob
+static uint32_t swap_dedup_bytes    = 0;   // backing bytes those would have used
+static uint32_t swap_dedup_hits     = 0;
+static uint32_t swap_lz_bytes       = 0;   // compressed bytes held in the pool
+static uint32_t swap_incompressible = 0;   // stores that fell back to raw
+static uint32_t swap_compress_count = 0;
+static uint64_t swap_compress_cycles = 0;
+static uint32_t swap_decompress_count = 0;
+static uint64_t swap_decompress_cycles = 0;
+static uint32_t swap_wb_requests    = 0;   // disk writes issued
+static uint32_t swap_wb_pages       = 0;   // pages they carried
+static uint32_t swap_wb_errors      = 0;
+static uint32_t swap_disk_reads     = 0;
+static uint32_t swap_staged_hits    = 0;   // reads served from staging
+
+static inline uint32_t swap_hash(uint32_t aligned)
+{
+    // Fibonacci hashing of the page number
+    return ((aligned >> 12) * 2654435761u) >> (32 - swap_hash_bits);
+}
+
+static uint32_t swap_clamp(uint32_t val, uint32_t lo, uint32_t hi)
+{
+    return val < lo ? lo : val > hi ? hi : val;
+}
 
 void swap_init(void)
 {
-    for (int i = 0; i < SWAP_MAX_PAGES; i++) {
-        swap_storage[i].used = 0;
-        swap_storage[i].virt_addr = 0;
+    swap_slots = swap_clamp(config_get("swap_slots", SWAP_DEFAULT_SLOTS), 1, SWAP_MAX_SLOTS);
+    swap_hash_bits = 1;
+    while ((1u << swap_hash_bits) < swap_slots * 2) {
+        swap_hash_bits++;
+    }
+    swap_hash_size = 1u << swap_hash_bits;
+    swap_pool_chunks = swap_clamp(config_get("swap_pool", SWAP_DEFAULT_POOL_KB), 1, SWAP_MAX_POOL_KB) *
+                       (1024 / SWAP_CHUNK_SIZE);
+    swap_raw_pages = swap_clamp(config_get("swap_raw", SWAP_DEFAULT_RAW), 0, SWAP_MAX_RAW);
+
+    // Use the primary ATA disk, if any, as the swap device
+    if (ata_init()) {
+        swap_disk_pages = ata_sectors() / SWAP_DISK_SECTORS;
+        if (swap_disk_pages > SWAP_DISK_MAX_PAGES) {
+            swap_disk_pages = SWAP_DISK_MAX_PAGES;
+        }
+    }
+}
+
+// Carve `bytes` off the metadata area
+static void *swap_carve(uint8_t **cursor, uint32_t bytes)
+{
+    void *p = *cursor;
+    *cursor += (bytes + 3) & ~3u;
+    return p;
+}
+
+// Allocate and index the backing store and reserve the raw page frames.
+// Returns 0, or -1 if memory is short (the next store tries again).
+static int swap_setup(void)
+{
+    if (swap_ready) {
+        return 0;
+    }
+
+    uint32_t pool_words = (swap_pool_chunks + 31) / 32;
+    uint32_t disk_words = (swap_disk_pages + 31) / 32;
+    uint32_t bytes = swap_slots * (sizeof(swap_page_t) + sizeof(swap_blob_t) + 2 * sizeof(int)) +
+                     swap_hash_size * 2 * sizeof(int) +
+                     swap_raw_pages * (sizeof(uint32_t) + sizeof(int)) +
+                     (pool_words + disk_words) * sizeof(uint32_t);
+
+    uint8_t *meta = (uint8_t *)vmalloc(bytes);
+    uint8_t *pool = (uint8_t *)vmalloc(swap_pool_chunks * SWAP_CHUNK_SIZE);
+    uint8_t *wb   = swap_disk_pages ? (uint8_t *)vmalloc(SWAP_WB_PAGES * PAGE_SIZE) : 0;
+    if (!meta || !pool || (swap_disk_pages && !wb)) {
+        if (meta) vfree(meta);
+        if (pool) vfree(pool);
+        if (wb)   vfree(wb);
+        return -1;
+    }
+
+    uint8_t *cur = meta;
+    swap_entries    = (swap_page_t *)swap_carve(&cur, swap_slots * sizeof(swap_page_t));
+    swap_next       = (int *)swap_carve(&cur, swap_slots * sizeof(int));
+    swap_hash_head  = (int *)swap_carve(&cur, swap_hash_size * sizeof(int));
+    swap_blobs      = (swap_blob_t *)swap_carve(&cur, swap_slots * sizeof(swap_blob_t));
+    swap_blob_next  = (int *)swap_carve(&cur, swap_slots * sizeof(int));
+    swap_blob_head  = (int *)swap_carve(&cur, swap_hash_size * sizeof(int));
+    swap_raw_frames = (uint32_t *)swap_carve(&cur, swap_raw_pages * sizeof(uint32_t));
+    swap_raw_free   = (int *)swap_carve(&cur, swap_raw_pages * sizeof(int));
+    swap_pool_map   = (uint32_t *)swap_carve(&cur, pool_words * sizeof(uint32_t));
+    swap_disk_map   = (uint32_t *)swap_carve(&cur, disk_words * sizeof(uint32_t));
+    swap_pool       = pool;
+    swap_wb_buf     = wb;
+
+    for (uint32_t i = 0; i < swap_hash_size; i++) {
+        swap_hash_head[i] = SWAP_NONE;
+        swap_blob_head[i] = SWAP_NONE;
+    }
+    // Chain every slot and blob onto its free list, lowest index first
+    for (uint32_t i = 0; i < swap_slots; i++) {
+        swap_entries[i].used = 0;
+        swap_entries[i].virt_addr = 0;
+        swap_next[i] = i + 1 < swap_slots ? (int)i + 1 : SWAP_NONE;
+        swap_blobs[i].refs = 0;
+        swap_blob_next[i] = i + 1 < swap_slots ? (int)i + 1 : SWAP_NONE;
+    }
+    swap_free_head = 0;
+    swap_blob_free = 0;
+
+    // Reserve up to swap_raw frames, leaving the PMM above its high
+    // watermark
+    uint32_t raw = 0;
+    while (raw < swap_raw_pages && pmm_free_count() > pmm_wmark_high() &&
+           (swap_raw_frames[raw] = pmm_alloc_page()) != 0) {
+        raw++;
+    }
+    swap_raw_pages = raw;
+    for (uint32_t i = 0; i < swap_raw_pages; i++) {
+        swap_raw_free[i] = (int)(swap_raw_pages - 1 - i);
+    }
+    swap_raw_top = (int)swap_raw_pages;
+
+    memset(swap_pool_map, 0, pool_words * sizeof(uint32_t));
+    memset(swap_disk_map, 0, disk_words * sizeof(uint32_t));
+
+    swap_meta = meta;
+    swap_meta_bytes = bytes;
+    swap_ready = 1;
+    return 0;
+}
+
+void swap_prepare(void)
+{
+    static int tried = 0;
+    if (!tried) {
+        tried = 1;
+        swap_setup();
     }
 }
 
-int swap_find_index(uint32_t virt_addr)
+static inline uint8_t *swap_raw_page(uint32_t loc)
 {
+    return (uint8_t *)swap_raw_frames[loc]; // Direct mapped
+}
+
+static int swap_find_index(uint32_t virt_addr)
+{
+    if (!swap_ready) {
+        return -1; // Nothing stored yet
+    }
+
     // Align address
     uint32_t aligned = virt_addr & ~0xFFF;
-    for (int i = 0; i < SWAP_MAX_PAGES; i++) {
-        if (swap_storage[i].used && swap_storage[i].virt_addr == aligned) {
+    uint32_t probes = 0;
+    int idx = swap_hash_head[swap_hash(aligned)];
+
+    swap_lookups++;
+    while (idx != SWAP_NONE) {
+        probes++;
+        if (swap_entries[idx].virt_addr == aligned) {
+            break;
+        }
+        idx = swap_next[idx];
+    }
+
+    swap_probes += probes;
+    if (probes > swap_max_probe) swap_max_probe = probes;
+    if (idx != SWAP_NONE) swap_hits++;
+    return idx;
+}
+
+// Take a slot off the free list and index it under virt_addr.
+// Returns the slot or -1 if swap is full.
+static int swap_alloc_slot(uint32_t virt_addr)
+{
+    uint32_t aligned = virt_addr & ~0xFFF;
+    int idx = swap_free_head;
+    if (idx == SWAP_NONE) {
+        return -1;
+    }
+    swap_free_head = swap_next[idx];
+
+    uint32_t bucket = swap_hash(aligned);
+    swap_entries[idx].used = 1;
+    swap_entries[idx].evicted = 0;
+    swap_entries[idx].blob = SWAP_NONE;
+    swap_entries[idx].virt_addr = aligned;
+    swap_kind_count[SWAP_KIND_ZERO]++;
+    swap_next[idx] = swap_hash_head[bucket];
+    swap_hash_head[bucket] = idx;
+    swap_used_count++;
+    return idx;
+}
+
+// Unlink a slot from its bucket and put it back on the free list.
+// The slot must hold no backing storage (SWAP_KIND_ZERO).
+static void swap_release_slot(int idx)
+{
+    int *link = &swap_hash_head[swap_hash(swap_entries[idx].virt_addr)];
+    while (*link != idx) {
+        link = &swap_next[*link];
+    }
+    *link = swap_next[idx];
+
+    swap_kind_count[SWAP_KIND_ZERO]--;
+    swap_entries[idx].used = 0;
+    swap_next[idx] = swap_free_head;
+    swap_free_head = idx;
+    swap_used_count--;
+}
+
+static inline int pool_chunk_used(uint32_t c)
+{
+    return (swap_pool_map[c / 32] >> (c % 32)) & 1;
+}
+
+static void pool_mark(uint32_t first, uint32_t chunks, int used)
+{
+    for (uint32_t c = first; c < first + chunks; c++) {
+        if (used) {
+            swap_pool_map[c / 32] |= 1u << (c % 32);
+        } else {
+            swap_pool_map[c / 32] &= ~(1u << (c % 32));
+        }
+    }
+    if (used) {
+        swap_pool_used += chunks;
+    } else {
+        swap_pool_used -= chunks;
+    }
+}
+
+// Next-fit search for `chunks` contiguous free chunks. Returns the first
+// chunk or -1 if the pool is too full or fragmented.
+static int pool_alloc(uint32_t chunks)
+{
+    uint32_t run = 0;
+    for (uint32_t n = 0; n < swap_pool_chunks + chunks; n++) {
+        uint32_t c = (swap_pool_cursor + n) % swap_pool_chunks;
+        if (c == 0) {
+            run = 0; // Runs cannot wrap around the end of the pool
+        }
+        if (pool_chunk_used(c)) {
+            run = 0;
+        } else if (++run == chunks) {
+            uint32_t first = c + 1 - chunks;
+            pool_mark(first, chunks, 1);
+            swap_pool_cursor = (c + 1) % swap_pool_chunks;
+            return (int)first;
+        }
+    }
+    return -1;
+}
+
+// Next-fit disk page allocation: pages evicted together land next to
+// each other on disk, so their writes can be clustered
+static int swap_disk_alloc(void)
+{
+    for (uint32_t n = 0; n < swap_disk_pages; n++) {
+        uint32_t p = (swap_disk_cursor + n) % swap_disk_pages;
+        if (!(swap_disk_map[p / 32] & (1u << (p % 32)))) {
+            swap_disk_map[p / 32] |= 1u << (p % 32);
+            swap_disk_cursor = (p + 1) % swap_disk_pages;
+            swap_disk_used++;
+            return (int)p;
+        }
+    }
+    return -1;
+}
+
+static void swap_disk_free(uint32_t p)
+{
+    swap_disk_map[p / 32] &= ~(1u << (p % 32));
+    swap_disk_used--;
+}
+
+static int swap_wb_find(int b)
+{
+    for (int i = 0; i < SWAP_WB_PAGES; i++) {
+        if (swap_wb[i].state != SWAP_WB_FREE && swap_wb[i].blob == b) {
             return i;
         }
     }
     return -1;
 }
 
+static void swap_wb_kick(void);
+
+// Write completion (IRQ14 or ata_wait): release the staging buffers. A
+// failed write leaves its pages queued, since staging holds the only good
+// copy; after SWAP_WB_MAX_ERRORS failures in a row the disk is retired and
+// they stay there until their blobs are dropped.
+static void swap_wb_done(int status)
+{
+    if (status != 0) {
+        if (++swap_wb_failing >= SWAP_WB_MAX_ERRORS) {
+            swap_disk_failed = 1;
+        }
+    } else {
+        swap_wb_failing = 0;
+    }
+
+    for (int i = 0; i < SWAP_WB_PAGES; i++) {
+        if (swap_wb[i].state != SWAP_WB_INFLIGHT) {
+            continue;
+        }
+        if (swap_wb[i].blob == SWAP_NONE) {
+            swap_disk_free(swap_wb[i].dpage); // Dropped while in flight
+            swap_wb[i].state = SWAP_WB_FREE;
+        } else if (status != 0) {
+            swap_wb_errors++;
+            swap_wb[i].state = SWAP_WB_QUEUED;
+            swap_wb_queued++;
+        } else {
+            swap_wb[i].state = SWAP_WB_FREE;
+        }
+    }
+    // Keep draining while a full cluster is waiting
+    if (swap_wb_queued >= SWAP_WB_CLUSTER) {
+        swap_wb_kick();
+    }
+}
+
+// Start one write for the run of consecutive disk pages beginning at the
+// lowest queued one
+static void swap_wb_kick(void)
+{
+    if (swap_wb_queued == 0 || swap_disk_failed || ata_busy()) {
+        return;
+    }
+
+    int first = -1;
+    for (int i = 0; i < SWAP_WB_PAGES; i++) {
+        if (swap_wb[i].state == SWAP_WB_QUEUED &&
+            (first < 0 || swap_wb[i].dpage < swap_wb[first].dpage)) {
+            first = i;
+        }
+    }
+
+    const uint8_t *pages[SWAP_WB_PAGES];
+    uint32_t start = swap_wb[first].dpage;
+    uint32_t n = 0;
+    int found = first;
+    while (found >= 0) {
+        swap_wb[found].state = SWAP_WB_INFLIGHT;
+        pages[n++] = swap_wb_buf + found * PAGE_SIZE;
+        found = -1;
+        for (int i = 0; i < SWAP_WB_PAGES; i++) {
+            if (swap_wb[i].state == SWAP_WB_QUEUED && swap_wb[i].dpage == start + n) {
+                found = i;
+                break;
+            }
+        }
+    }
+    swap_wb_queued -= n;
+    swap_wb_requests++;
+    swap_wb_pages += n;
+
+    if (ata_write_async(start * SWAP_DISK_SECTORS, pages, n, swap_wb_done) != 0) {
+        swap_wb_done(-1);
+    }
+}
+
+// Stage a page for writing to disk page dpage. Waits for the disk only
+// when every staging buffer is taken. Returns 0, or -1 if they are all
+// held by a retired disk.
+static int swap_wb_queue(int b, uint32_t dpage, const uint8_t *src)
+{
+    int slot;
+    for (;;) {
+        for (slot = 0; slot < SWAP_WB_PAGES; slot++) {
+            if (swap_wb[slot].state == SWAP_WB_FREE) break;
+        }
+        if (slot < SWAP_WB_PAGES) break;
+        if (swap_disk_failed) {
+            return -1;
+        }
+        swap_wb_kick();
+        ata_wait();
+    }
+
+    memcpy(swap_wb_buf + slot * PAGE_SIZE, src, PAGE_SIZE);
+    swap_wb[slot].blob = b;
+    swap_wb[slot].dpage = (uint16_t)dpage;
+    swap_wb[slot].state = SWAP_WB_QUEUED;
+    swap_wb_queued++;
+
+    if (swap_wb_queued >= SWAP_WB_CLUSTER) {
+        swap_wb_kick();
+    }
+    return 0;
+}
+
+// Put blob b's page on a fresh disk page. Returns 0, or -1 if there is no
+// usable disk, it is full, or staging is stuck behind a retired disk.
+static int swap_disk_store(int b, const uint8_t *src)
+{
+    if (!swap_disk_pages || swap_disk_failed) {
+        return -1;
+    }
+    int dpage = swap_disk_alloc();
+    if (dpage < 0) {
+        return -1;
+    }
+    if (swap_wb_queue(b, (uint32_t)dpage, src) != 0) {
+        swap_disk_free((uint32_t)dpage);
+        return -1;
+    }
+    swap_blobs[b].kind = SWAP_KIND_DISK;
+    swap_blobs[b].loc = (uint16_t)dpage;
+    return 0;
+}
+
+// Copy a disk blob's page into dst, from staging if it has not been
+// written yet. Returns 0 or -1 on a read error.
+static int swap_disk_load(int b, uint8_t *dst)
+{
+    int w = swap_wb_find(b);
+    if (w >= 0) {
+        memcpy(dst, swap_wb_buf + w * PAGE_SIZE, PAGE_SIZE);
+        swap_staged_hits++;
+        return 0;
+    }
+    swap_disk_reads++;
+    return ata_read((uint32_t)swap_blobs[b].loc * SWAP_DISK_SECTORS, SWAP_DISK_SECTORS, dst);
+}
+
+static uint32_t blob_bytes(const swap_blob_t *bl)
+{
+    if (bl->kind == SWAP_KIND_LZ) {
+        return ((bl->len + SWAP_CHUNK_SIZE - 1) / SWAP_CHUNK_SIZE) * SWAP_CHUNK_SIZE;
+    }
+    return PAGE_SIZE;
+}
+
+// Drop one slot's reference to a blob; the last one frees its backing store
+static void swap_blob_put(int b)
+{
+    swap_blob_t *bl = &swap_blobs[b];
+    if (--bl->refs > 0) {
+        swap_dedup_pages--;
+        swap_dedup_bytes -= blob_bytes(bl);
+        return;
+    }
+
+    int *link = &swap_blob_head[bl->hash & (swap_hash_size - 1)];
+    while (*link != b) {
+        link = &swap_blob_next[*link];
+    }
+    *link = swap_blob_next[b];
+
+    if (bl->kind == SWAP_KIND_LZ) {
+        pool_mark(bl->loc, (bl->len + SWAP_CHUNK_SIZE - 1) / SWAP_CHUNK_SIZE, 0);
+        swap_lz_bytes -= bl->len;
+    } else if (bl->kind == SWAP_KIND_DISK) {
+        int w = swap_wb_find(b);
+        if (w >= 0 && swap_wb[w].state == SWAP_WB_INFLIGHT) {
+            swap_wb[w].blob = SWAP_NONE; // Disk page freed on completion
+        } else {
+            if (w >= 0) {
+                swap_wb[w].state = SWAP_WB_FREE;
+                swap_wb_queued--;
+            }
+            swap_disk_free(bl->loc);
+        }
+    } else {
+        swap_raw_free[swap_raw_top++] = bl->loc;
+    }
+    swap_kind_count[bl->kind]--;
+
+    swap_blob_next[b] = swap_blob_free;
+    swap_blob_free = b;
+}
+
+static int page_is_zero(const uint8_t *src)
+{
+    const uint32_t *w = (const uint32_t *)src;
+    for (int i = 0; i < PAGE_SIZE / 4; i++) {
+        if (w[i]) return 0;
+    }
+    return 1;
+}
+
+// Does blob b hold exactly this page? Compressed blobs are expanded into
+// the scratch buffer to compare.
+static int swap_blob_equal(int b, const uint8_t *src)
+{
+    swap_blob_t *bl = &swap_blobs[b];
+    const uint8_t *data = swap_scratch;
+    if (bl->kind == SWAP_KIND_RAW) {
+        data = swap_raw_page(bl->loc);
+    } else if (bl->kind == SWAP_KIND_DISK) {
+        if (swap_disk_load(b, swap_scratch) != 0) {
+            return 0;
+        }
+    } else if (lz_decompress(swap_pool + (uint32_t)bl->loc * SWAP_CHUNK_SIZE, bl->len,
+                             swap_scratch, PAGE_SIZE) != PAGE_SIZE) {
+        return 0;
+    }
+    return memcmp(data, src, PAGE_SIZE) == 0;
+}
+
+static int swap_blob_find(uint32_t hash, const uint8_t *src)
+{
+    int b = swap_blob_head[hash & (swap_hash_size - 1)];
+    while (b != SWAP_NONE) {
+        if (swap_blobs[b].hash == hash && swap_blob_equal(b, src)) {
+            return b;
+        }
+        b = swap_blob_next[b];
+    }
+    return SWAP_NONE;
+}
+
+// Store a new page image as LZ chunks in the pool. If it does not
+// compress or the pool is full it goes to the swap disk, or to a raw
+// page when there is no disk or it cannot take the page. Returns the
+// blob or SWAP_NONE.
+static int swap_blob_create(uint32_t hash, const uint8_t *src)
+{
+    int b = swap_blob_free;
+    if (b == SWAP_NONE) {
+        return SWAP_NONE;
+    }
+    swap_blob_t *bl = &swap_blobs[b];
+
+    uint64_t t0 = bench_now();
+    uint32_t len = lz_compress(src, PAGE_SIZE, swap_scratch, SWAP_LZ_MAX);
+    swap_compress_cycles += bench_now() - t0;
+    swap_compress_count++;
+
+    int first = -1;
+    if (len) {
+        first = pool_alloc((len + SWAP_CHUNK_SIZE - 1) / SWAP_CHUNK_SIZE);
+    } else {
+        swap_incompressible++;
+    }
+
+    if (first >= 0) {
+        memcpy(swap_pool + (uint32_t)first * SWAP_CHUNK_SIZE, swap_scratch, len);
+        bl->kind = SWAP_KIND_LZ;
+        bl->loc = (uint16_t)first;
+        bl->len = (uint16_t)len;
+        swap_lz_bytes += len;
+    } else if (swap_disk_store(b, src) == 0) {
+        // Staged for the disk
+    } else {
+        // Raw fallback
+        if (swap_raw_top == 0) {
+            return SWAP_NONE;
+        }
+        bl->kind = SWAP_KIND_RAW;
+        bl->loc = (uint16_t)swap_raw_free[--swap_raw_top];
+        memcpy(swap_raw_page(bl->loc), src, PAGE_SIZE);
+    }
+    swap_kind_count[bl->kind]++;
+
+    swap_blob_free = swap_blob_next[b];
+    bl->hash = hash;
+    bl->refs = 1;
+    uint32_t bucket = hash & (swap_hash_size - 1);
+    swap_blob_next[b] = swap_blob_head[bucket];
+    swap_blob_head[bucket] = b;
+    return b;
+}
+
+// Store a page image in the cheapest form that fits: a zero flag, a
+// reference to an identical stored page, LZ chunks in the pool, or a raw
+// page. The old contents are only released once the new copy is in
+// place. Returns 0 or -1 if there is no room.
+static int swap_store(swap_page_t *e, const uint8_t *src)
+{
+    int b = SWAP_NONE;
+
+    if (!page_is_zero(src)) {
+        uint32_t hash = dedup_page_hash(src);
+        b = swap_blob_find(hash, src);
+        if (b != SWAP_NONE) {
+            if (b == e->blob) {
+                return 0; // Unchanged
+            }
+            swap_blobs[b].refs++;
+            swap_dedup_pages++;
+            swap_dedup_bytes += blob_bytes(&swap_blobs[b]);
+            swap_dedup_hits++;
+        } else {
+            b = swap_blob_create(hash, src);
+            if (b == SWAP_NONE) {
+                return -1;
+            }
+        }
+    }
+
+    if (e->blob != SWAP_NONE) {
+        swap_blob_put(e->blob);
+    } else {
+        swap_kind_count[SWAP_KIND_ZERO]--;
+    }
+    e->blob = b;
+    if (b == SWAP_NONE) {
+        swap_kind_count[SWAP_KIND_ZERO]++;
+    }
+    return 0;
+}
+
+// Find or create the slot for virt_addr and store src in it
+static int swap_put(uint32_t virt_addr, const uint8_t *src)
+{
+    if (swap_setup() != 0) {
+        return -1;
+    }
+
+    int idx = swap_find_index(virt_addr);
+    int fresh = 0;
+    // If not found, take a free slot
+    if (idx == -1) {
+        idx = swap_alloc_slot(virt_addr);
+        fresh = 1;
+    }
+    if (idx == -1) {
+        return -1; // Swap full
+    }
+
+    if (swap_store(&swap_entries[idx], src) != 0) {
+        if (fresh) {
+            swap_release_slot(idx);
+        }
+        return -1;
+    }
+    return 0;
+}
+
 int swap_exists(uint32_t virt_addr)
 {
     return swap_find_index(virt_addr) != -1;
 }
 
+int swap_is_zero(uint32_t virt_addr)
+{
+    int idx = swap_find_index(virt_addr);
+    return idx != -1 && swap_entries[idx].blob == SWAP_NONE;
+}
+
 void swap_read(uint32_t virt_addr, uint32_t phys_addr)
 {
     int idx = swap_find_index(virt_addr);
-    if (idx != -1) {
-        // Copy data from swap to physical RAM
-        uint8_t *dest = (uint8_t *)phys_addr;
-        for (int i = 0; i < PAGE_SIZE; i++) {
-            dest[i] = swap_storage[idx].data[i];
-        }
+    if (idx == -1) {
+        return;
+    }
+
+    // Copy data from swap to physical RAM
+    int b = swap_entries[idx].blob;
+    uint8_t *dest = (uint8_t *)phys_addr;
+    if (b != SWAP_NONE && swap_blobs[b].kind == SWAP_KIND_LZ) {
+        uint64_t t0 = bench_now();
+        lz_decompress(swap_pool + (uint32_t)swap_blobs[b].loc * SWAP_CHUNK_SIZE,
+                      swap_blobs[b].len, dest, PAGE_SIZE);
+        swap_decompress_cycles += bench_now() - t0;
+        swap_decompress_count++;
+    } else if (b != SWAP_NONE && swap_blobs[b].kind == SWAP_KIND_DISK) {
+        swap_disk_load(b, dest);
+    } else if (b != SWAP_NONE) {
+        memcpy(dest, swap_raw_page(swap_blobs[b].loc), PAGE_SIZE);
+    } else {
+        memset(dest, 0, PAGE_SIZE);
     }
 }
 
-void swap_write(uint32_t virt_addr, uint32_t phys_addr) {
-     int idx = swap_find_index(virt_addr);
-     // If not found, find free slot
-     if (idx == -1) {
-         for (int i=0; i < SWAP_MAX_PAGES; i++) {
-             if (!swap_storage[i].used) {
-                 idx = i;
-                 swap_storage[i].used = 1;
-                 swap_storage[i].virt_addr = virt_addr & ~0xFFF;
-                 break;
-             }
-         }
-     }
-     
-     if (idx != -1) {
-        uint8_t *src = (uint8_t *)phys_addr;
-        for (int i = 0; i < PAGE_SIZE; i++) {
-            swap_storage[idx].data[i] = src[i];
-        }
-     }
+int swap_write(uint32_t virt_addr, uint32_t phys_addr)
+{
+    return swap_put(virt_addr, (const uint8_t *)phys_addr);
 }
 
 void swap_test_store(uint32_t virt_addr, const char* data)
 {
-    // Helper to setup a test case: Creates a swapped-out page with known data
-    uint32_t aligned = virt_addr & ~0xFFF;
-    int idx = -1;
-    
-    // Find free
-    for (int i=0; i < SWAP_MAX_PAGES; i++) {
-         if (!swap_storage[i].used) {
-             idx = i;
-             break;
-         }
-    }
-    
+    // Helper to setup a test case: Creates a swapped-out page holding the
+    // string followed by zeroes
+    static uint8_t page[PAGE_SIZE];
+    int c = 0;
+    while (data[c] && c < PAGE_SIZE) {
+        page[c] = (uint8_t)data[c];
+        c++;
+    }
+    memset(page + c, 0, PAGE_SIZE - c);
+    swap_put(virt_addr, page);
+}
+
+void swap_mark_evicted(uint32_t virt_addr)
+{
+    int idx = swap_find_index(virt_addr);
     if (idx != -1) {
-        swap_storage[idx].used = 1;
-        swap_storage[idx].virt_addr = aligned;
-        
-        // Copy string
-        int c = 0;
-        while(data[c] && c < PAGE_SIZE) {
-            swap_storage[idx].data[c] = (uint8_t)data[c];
-            c++;
+        swap_entries[idx].evicted = 1;
+    }
+}
+
+int swap_take_evicted(uint32_t virt_addr)
+{
+    int idx = swap_find_index(virt_addr);
+    if (idx == -1 || !swap_entries[idx].evicted) {
+        return 0;
+    }
+    swap_entries[idx].evicted = 0;
+    return 1;
+}
+
+// Print the average of a cycle total as "<cycles> cycles (<ns> ns)"
+static void swap_print_latency(uint64_t cycles, uint32_t count)
+{
+    uint32_t khz = bench_tsc_khz();
+    uint64_t avg = count ? bench_div64(cycles, count) : 0;
+    kprint_dec((uint32_t)avg);
+    kprint(" cycles (");
+    kprint_dec(khz ? (uint32_t)bench_div64(avg * 1000000, khz) : 0);
+    kprint(" ns)");
+}
+
+void swap_print_stats(void)
+{
+    kprint("Swap: ");
+    kprint_dec(swap_used_count);
+    kprint(" / ");
+    kprint_dec(swap_slots);
+    kprint(" slots used, ");
+    kprint_dec(swap_hash_size);
+    kprint(" hash buckets\n");
+
+    kprint("  memory: ");
+    if (swap_ready) {
+        kprint_dec((swap_meta_bytes + 1023) / 1024);
+        kprint(" KB index, ");
+        kprint_dec(swap_pool_chunks * SWAP_CHUNK_SIZE / 1024);
+        kprint(" KB pool, ");
+        kprint_dec(swap_wb_buf ? SWAP_WB_PAGES * PAGE_SIZE / 1024 : 0);
+        kprint(" KB staging, ");
+        kprint_dec(swap_raw_pages * (PAGE_SIZE / 1024));
+        kprint(" KB raw pages\n");
+    } else {
+        kprint("none allocated until the first page is tracked\n");
+    }
+
+    kprint("  lookups: ");
+    kprint_dec(swap_lookups);
+    kprint(" (");
+    kprint_dec(swap_hits);
+    kprint(" hits), avg probes x100: ");
+    kprint_dec(swap_lookups ? (swap_probes * 100) / swap_lookups : 0);
+    kprint(", max probe: ");
+    kprint_dec(swap_max_probe);
+    kprint("\n");
+
+    kprint("  stored: ");
+    kprint_dec(swap_kind_count[SWAP_KIND_ZERO]);
+    kprint(" zero pages, ");
+    kprint_dec(swap_kind_count[SWAP_KIND_LZ]);
+    kprint(" compressed, ");
+    kprint_dec(swap_kind_count[SWAP_KIND_RAW]);
+    kprint(" raw, ");
+    kprint_dec(swap_kind_count[SWAP_KIND_DISK]);
+    kprint(" on disk (");
+    kprint_dec(swap_incompressible);
+    kprint(" incompressible stores)\n");
+
+    kprint("  dedup: ");
+    kprint_dec(swap_dedup_pages);
+    kprint(" slots share a copy, ");
+    kprint_dec(swap_dedup_bytes);
+    kprint(" bytes saved (");
+    kprint_dec(swap_dedup_hits);
+    kprint(" merges)\n");
+
+    kprint("  pool: ");
+    kprint_dec(swap_pool_used);
+    kprint(" / ");
+    kprint_dec(swap_pool_chunks);
+    kprint(" chunks, raw: ");
+    kprint_dec(swap_ready ? swap_raw_pages - swap_raw_top : 0);
+    kprint(" / ");
+    kprint_dec(swap_raw_pages);
+    kprint(" pages\n");
+
+    if (swap_disk_pages) {
+        kprint("  disk: ");
+        kprint_dec(swap_disk_used);
+        kprint(" / ");
+        kprint_dec(swap_disk_pages);
+        kprint(" pages, ");
+        kprint_dec(swap_wb_queued);
+        kprint(" queued; ");
+        kprint_dec(swap_wb_requests);
+        kprint(" writes of ");
+        kprint_dec(swap_wb_pages);
+        kprint(" pages (");
+        kprint_dec(swap_wb_errors);
+        kprint(" failed), ");
+        kprint_dec(swap_disk_reads);
+        kprint(" reads, ");
+        kprint_dec(swap_staged_hits);
+        kprint(" served from staging\n");
+        if (swap_disk_failed) {
+            kprint("  disk retired after repeated write errors\n");
         }
+        ata_print_stats();
+    } else {
+        kprint("  disk: none\n");
     }
+
+    // Ratio of page bytes held to backing bytes used (chunks, raw and disk pages)
+    uint32_t stored = swap_pool_used * SWAP_CHUNK_SIZE +
+                      (swap_kind_count[SWAP_KIND_RAW] + swap_kind_count[SWAP_KIND_DISK]) * PAGE_SIZE;
+    kprint("  ratio x100: ");
+    if (stored) {
+        kprint_dec((uint32_t)bench_div64((uint64_t)swap_used_count * PAGE_SIZE * 100, stored));
+    } else {
+        kprint("-");
+    }
+    kprint(" (LZ only: ");
+    kprint_dec(swap_lz_bytes ? (uint32_t)bench_div64((uint64_t)swap_kind_count[SWAP_KIND_LZ] * PAGE_SIZE * 100, swap_lz_bytes) : 0);
+    kprint(")\n");
+
+    kprint("  compress: ");
+    swap_print_latency(swap_compress_cycles, swap_compress_count);
+    kprint("/page, decompress: ");
+    swap_print_latency(swap_decompress_cycles, swap_decompress_count);
+    kprint("/page\n");
 }
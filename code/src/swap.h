@@ -8,21 +8,41 @@
    Manages a fake disk store for demand paging.
 */
 
-/* Initialize mocked disk storage */
+/* Read the swap size options and probe the swap disk. Nothing is
+   allocated yet. */
 void swap_init(void);
 
+/* Allocate the index and backing store, once, ahead of the first store
+   (called as the first pageable page is tracked). If memory is short
+   the first store tries again. */
+void swap_prepare(void);
+
 /* Check if a virtual address exists in swap storage (i.e., is it a valid page compliant for loading?) */
 int swap_exists(uint32_t virt_addr);
 
-/* Read page data from swap into a buffer (phys_addr) */
+/* Nonzero when the swap copy of virt_addr is an all-zero page */
+int swap_is_zero(uint32_t virt_addr);
+
+/* Read page data from swap into a buffer (phys_addr): a direct-mapped
+   frame, or the page's own mapping when the frame is in high memory */
 void swap_read(uint32_t virt_addr, uint32_t phys_addr);
 
-/* Write page data from buffer (phys_addr) to swap */
-void swap_write(uint32_t virt_addr, uint32_t phys_addr);
+/* Write page data from buffer (phys_addr, which may also be the page's
+   own mapping) to swap. Returns 0, or -1 if swap is full. */
+int swap_write(uint32_t virt_addr, uint32_t phys_addr);
 
 /* Register a virtual address as "swapped out" containing specific data 
    (For testing purposes, we pre-fill some data)
 */
 void swap_test_store(uint32_t virt_addr, const char* data);
 
+/* Mark the swap copy of virt_addr as the only copy (the page was evicted) */
+void swap_mark_evicted(uint32_t virt_addr);
+
+/* Return and clear the evicted mark; a set mark on fault means a refault */
+int swap_take_evicted(uint32_t virt_addr);
+
+/* Print slot usage and index lookup / probe counters (shell: swapinfo) */
+void swap_print_stats(void);
+
 #endif
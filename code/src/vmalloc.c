@@ -0,0 +1,317 @@
+#include "vmalloc.h"
+#include "pmm.h"
+#include "evict.h"
+#include "bench.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+extern void kprint_hex(unsigned int val);
+
+typedef struct {
+    uint32_t start;       // 0: slot unused
+    uint32_t pages;       // excluding the guard page
+    uint32_t populated;   // pages backed by a frame
+    uint8_t  lazy;
+} vm_area_t;
+
+/* One bit per page of the window; set while reserved (guard pages too) */
+static uint32_t  vmalloc_map[VMALLOC_PAGES / 32];
+static vm_area_t vmalloc_areas[VMALLOC_MAX_AREAS];
+
+/* Counters */
+static uint32_t vmalloc_reserved    = 0;   // pages, guard pages included
+static uint32_t vmalloc_populated   = 0;
+static uint32_t vmalloc_allocs      = 0;
+static uint32_t vmalloc_frees       = 0;
+static uint32_t vmalloc_failures    = 0;
+static uint32_t vmalloc_lazy_faults = 0;
+
+static inline int vmap_test(uint32_t i)
+{
+    return (vmalloc_map[i >> 5] >> (i & 31)) & 1;
+}
+
+static void vmap_set(uint32_t first, uint32_t n, int reserved)
+{
+    for (uint32_t i = first; i < first + n; i++) {
+        if (reserved) {
+            vmalloc_map[i >> 5] |= 1u << (i & 31);
+        } else {
+            vmalloc_map[i >> 5] &= ~(1u << (i & 31));
+        }
+    }
+}
+
+/* First run of `n` free pages, or VMALLOC_PAGES if there is none */
+static uint32_t vmap_find(uint32_t n)
+{
+    uint32_t run = 0;
+    for (uint32_t i = 0; i < VMALLOC_PAGES; i++) {
+        // Skip fully reserved words
+        if ((i & 31) == 0 && vmalloc_map[i >> 5] == 0xFFFFFFFF) {
+            run = 0;
+            i += 31;
+            continue;
+        }
+        if (vmap_test(i)) {
+            run = 0;
+        } else if (++run == n) {
+            return i + 1 - n;
+        }
+    }
+    return VMALLOC_PAGES;
+}
+
+/* Area containing virt_addr (its guard page excluded), or 0 */
+static vm_area_t *vmalloc_find(uint32_t virt_addr)
+{
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        vm_area_t *a = &vmalloc_areas[i];
+        if (a->start && virt_addr >= a->start &&
+            virt_addr - a->start < a->pages * PAGE_SIZE) {
+            return a;
+        }
+    }
+    return 0;
+}
+
+static vm_area_t *vmalloc_reserve(uint32_t size, int lazy)
+{
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0 || pages >= VMALLOC_PAGES) {
+        vmalloc_failures++;
+        return 0;
+    }
+
+    vm_area_t *a = 0;
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        if (!vmalloc_areas[i].start) {
+            a = &vmalloc_areas[i];
+            break;
+        }
+    }
+    uint32_t first = a ? vmap_find(pages + 1) : VMALLOC_PAGES;
+    if (first == VMALLOC_PAGES) {
+        vmalloc_failures++;
+        return 0;
+    }
+
+    vmap_set(first, pages + 1, 1);
+    vmalloc_reserved += pages + 1;
+    a->start     = VMALLOC_START + first * PAGE_SIZE;
+    a->pages     = pages;
+    a->populated = 0;
+    a->lazy      = (uint8_t)lazy;
+    vmalloc_allocs++;
+    return a;
+}
+
+void *vmalloc(uint32_t size)
+{
+    vm_area_t *a = vmalloc_reserve(size, 0);
+    if (!a) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < a->pages; i++) {
+        uint32_t phys = pmm_alloc_page();
+        if (!phys || map_page(phys, a->start + i * PAGE_SIZE, PAGE_PRESENT | PAGE_RW) != 0) {
+            if (phys) {
+                pmm_free_page(phys);
+            }
+            vfree((void *)a->start);
+            vmalloc_failures++;
+            return 0;
+        }
+        a->populated++;
+        vmalloc_populated++;
+    }
+    return (void *)a->start;
+}
+
+void *vmalloc_lazy(uint32_t size)
+{
+    vm_area_t *a = vmalloc_reserve(size, 1);
+    return a ? (void *)a->start : 0;
+}
+
+void vfree(void *addr)
+{
+    vm_area_t *a = vmalloc_find((uint32_t)addr);
+    if (!a || a->start != (uint32_t)addr) {
+        return; // Not the start of an area
+    }
+
+    // Frames first, then one batched unmap of the whole range
+    for (uint32_t i = 0; i < a->pages; i++) {
+        uint32_t *pte = paging_get_pte(a->start + i * PAGE_SIZE);
+        if (pte && (*pte & PAGE_PRESENT)) {
+            pmm_free_page(*pte & ~0xFFF);
+        }
+    }
+    unmap_range(a->start, a->pages);
+
+    vmap_set((a->start - VMALLOC_START) / PAGE_SIZE, a->pages + 1, 0);
+    vmalloc_reserved  -= a->pages + 1;
+    vmalloc_populated -= a->populated;
+    vmalloc_frees++;
+    a->start = 0;
+}
+
+int vmalloc_fault(uint32_t virt_addr)
+{
+    if (virt_addr < VMALLOC_START || virt_addr >= VMALLOC_END) {
+        return -1;
+    }
+    vm_area_t *a = vmalloc_find(virt_addr);
+    if (!a) {
+        return -1; // Unreserved space or a guard page
+    }
+
+    // Kernel memory is not swappable, but swapped pages can make room
+    uint32_t phys = pmm_alloc_zeroed_page();
+    while (phys == 0 && evict_one() == 0) {
+        phys = pmm_alloc_zeroed_page();
+    }
+    if (!phys) {
+        return -1;
+    }
+    if (map_page(phys, virt_addr & ~0xFFF, PAGE_PRESENT | PAGE_RW) != 0) {
+        pmm_free_page(phys);
+        return -1;
+    }
+    a->populated++;
+    vmalloc_populated++;
+    vmalloc_lazy_faults++;
+    return 0;
+}
+
+void vmalloc_print_stats(void)
+{
+    // Free space: holes between areas and the largest of them
+    uint32_t free_pages = 0, holes = 0, largest = 0, run = 0;
+    for (uint32_t i = 0; i <= VMALLOC_PAGES; i++) {
+        if (i < VMALLOC_PAGES && !vmap_test(i)) {
+            run++;
+            continue;
+        }
+        if (run) {
+            free_pages += run;
+            holes++;
+            if (run > largest) largest = run;
+            run = 0;
+        }
+    }
+
+    kprint("vmalloc: ");
+    kprint_hex(VMALLOC_START);
+    kprint(" - ");
+    kprint_hex(VMALLOC_END);
+    kprint(", ");
+    kprint_dec(vmalloc_allocs - vmalloc_frees);
+    kprint(" areas\n");
+
+    kprint("  reserved: ");
+    kprint_dec(vmalloc_reserved);
+    kprint(" / ");
+    kprint_dec(VMALLOC_PAGES);
+    kprint(" pages (guard pages included), ");
+    kprint_dec(vmalloc_populated);
+    kprint(" backed\n");
+
+    kprint("  free: ");
+    kprint_dec(free_pages);
+    kprint(" pages in ");
+    kprint_dec(holes);
+    kprint(" holes, largest ");
+    kprint_dec(largest);
+    kprint(", fragmentation ");
+    kprint_dec(free_pages ? 100 - largest * 100 / free_pages : 0);
+    kprint("%\n");
+
+    kprint("  allocs: ");
+    kprint_dec(vmalloc_allocs);
+    kprint(", frees: ");
+    kprint_dec(vmalloc_frees);
+    kprint(", failed: ");
+    kprint_dec(vmalloc_failures);
+    kprint(", lazy faults: ");
+    kprint_dec(vmalloc_lazy_faults);
+    kprint("\n");
+
+    for (int i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        vm_area_t *a = &vmalloc_areas[i];
+        if (!a->start) continue;
+        kprint("  ");
+        kprint_hex(a->start);
+        kprint(" - ");
+        kprint_hex(a->start + a->pages * PAGE_SIZE);
+        kprint(" ");
+        kprint_dec(a->pages);
+        kprint(" pages, ");
+        kprint_dec(a->populated);
+        kprint(a->lazy ? " backed (lazy)\n" : " backed\n");
+    }
+}
+
+void vmalloc_selftest(uint32_t pages)
+{
+    if (pages == 0) {
+        pages = 1;
+    }
+    uint32_t free_before = pmm_free_count();
+    uint32_t errors = 0;
+
+    // Lazy: write the even pages, read the odd ones (zero-filled)
+    uint8_t *lazy = (uint8_t *)vmalloc_lazy(pages * PAGE_SIZE);
+    if (!lazy) {
+        kprint("vmtest: out of address space\n");
+        return;
+    }
+    uint32_t faults_before = vmalloc_lazy_faults;
+    uint64_t start = bench_now();
+    for (uint32_t i = 0; i < pages; i += 2) {
+        lazy[i * PAGE_SIZE] = (uint8_t)(i + 1);
+    }
+    uint32_t touched = vmalloc_lazy_faults - faults_before;
+    for (uint32_t i = 1; i < pages; i += 2) {
+        if (lazy[i * PAGE_SIZE + 7] != 0) errors++;
+    }
+    uint64_t lazy_cycles = bench_now() - start;
+    for (uint32_t i = 0; i < pages; i += 2) {
+        if (lazy[i * PAGE_SIZE] != (uint8_t)(i + 1)) errors++;
+    }
+    if (touched != (pages + 1) / 2) errors++;
+
+    // Eager: every page backed up front
+    uint32_t *eager = (uint32_t *)vmalloc(pages * PAGE_SIZE);
+    if (eager) {
+        for (uint32_t i = 0; i < pages * (PAGE_SIZE / 4); i += PAGE_SIZE / 4) {
+            eager[i] = i;
+        }
+        for (uint32_t i = 0; i < pages * (PAGE_SIZE / 4); i += PAGE_SIZE / 4) {
+            if (eager[i] != i) errors++;
+        }
+    }
+
+    kprint("vmtest: ");
+    kprint_dec(pages);
+    kprint(" pages at ");
+    kprint_hex((uint32_t)lazy);
+    kprint(", ");
+    kprint_dec(touched);
+    kprint(" backed by the first pass, eager area ");
+    kprint(eager ? "ok" : "out of memory");
+    kprint(", ");
+    kprint_dec(errors);
+    kprint(" errors\n");
+    bench_print_rate("  lazy faults", vmalloc_lazy_faults - faults_before, lazy_cycles);
+
+    vfree(lazy);
+    if (eager) {
+        vfree(eager);
+    }
+    kprint("  frames leaked: ");
+    kprint_dec(free_before - pmm_free_count());
+    kprint("\n");
+}
@@ -0,0 +1,43 @@
+#ifndef VMALLOC_H
+#define VMALLOC_H
+
+#include "paging.h" // For types
+
+/*
+   Virtually contiguous kernel allocations.
+   Each area is a run of pages in [VMALLOC_START, VMALLOC_END) followed by
+   an unmapped guard page, backed by single PMM frames that need not be
+   physically contiguous. Lazy areas get their frames on first touch
+   through the page fault handler.
+*/
+
+#define VMALLOC_START 0xD0000000
+#define VMALLOC_END   0xE0000000
+#define VMALLOC_PAGES ((VMALLOC_END - VMALLOC_START) / PAGE_SIZE)
+
+/* Most areas live at once */
+#define VMALLOC_MAX_AREAS 64
+
+/* Allocate `size` bytes (rounded up to pages), every page backed now.
+   Contents are undefined. Returns 0 if out of address space or memory. */
+void *vmalloc(uint32_t size);
+
+/* Reserve `size` bytes; pages are backed with zeroed frames when first
+   touched. Returns 0 if out of address space. */
+void *vmalloc_lazy(uint32_t size);
+
+/* Unmap an area and return its frames to the PMM */
+void vfree(void *addr);
+
+/* Back the vmalloc page containing virt_addr after a not-present fault.
+   Returns 0 if handled, -1 if the address is outside every area (guard
+   pages included) or no frame could be found. */
+int vmalloc_fault(uint32_t virt_addr);
+
+/* Print areas, address space usage and fragmentation (shell: vmallocinfo) */
+void vmalloc_print_stats(void);
+
+/* Allocate, touch and free lazy and eager areas (shell: vmtest) */
+void vmalloc_selftest(uint32_t pages);
+
+#endif
@@ -0,0 +1,157 @@
+#include "wss.h"
+#include "evict.h"
+#include "vmalloc.h"
+
+extern void kprint(const char *str);
+extern void kprint_dec(unsigned int val);
+
+#define WSS_AGES (WSS_MAX_AGE + 1)
+
+static const struct {
+    const char *name;
+    uint32_t    start;
+    uint32_t    end;    // exclusive; 0 means 4GB
+} wss_regions[] = {
+    { "low",      0x00000000,      EVICT_TEST_BASE },   // kernel, split direct map
+    { "swaptest", EVICT_TEST_BASE, VMALLOC_START   },
+    { "vmalloc",  VMALLOC_START,   VMALLOC_END     },
+    { "high",     VMALLOC_END,     0               },
+};
+#define WSS_REGIONS (sizeof(wss_regions) / sizeof(wss_regions[0]))
+
+/* Cursor: next page to visit. Walking by address through
+   paging_get_pte() keeps the scanner independent of the table layout
+   (classic or PAE). */
+static uint32_t wss_va = 0;
+
+/* Histogram of the pass in progress, and of the last complete one */
+static uint32_t wss_hist[WSS_REGIONS][WSS_AGES];
+static uint32_t wss_last[WSS_REGIONS][WSS_AGES];
+
+/* Counters */
+static uint32_t wss_ticks      = 0;
+static uint32_t wss_pass_start = 0;   // tick the current pass began
+static uint32_t wss_pass_ticks = 0;   // length of the last complete pass
+static uint32_t wss_passes     = 0;
+static uint32_t wss_harvested  = 0;   // accessed bits cleared
+
+static uint32_t wss_region(uint32_t virt)
+{
+    for (uint32_t r = 0; r < WSS_REGIONS - 1; r++) {
+        if (virt < wss_regions[r].end) {
+            return r;
+        }
+    }
+    return WSS_REGIONS - 1;
+}
+
+static void wss_end_pass(void)
+{
+    for (uint32_t r = 0; r < WSS_REGIONS; r++) {
+        for (uint32_t a = 0; a < WSS_AGES; a++) {
+            wss_last[r][a] = wss_hist[r][a];
+            wss_hist[r][a] = 0;
+        }
+    }
+    wss_passes++;
+    wss_pass_ticks = wss_ticks - wss_pass_start;
+    wss_pass_start = wss_ticks;
+}
+
+void wss_tick(void)
+{
+    uint32_t budget = WSS_SCAN_BUDGET;
+    wss_ticks++;
+
+    while (budget > 0) {
+        uint32_t virt = wss_va;
+        uint32_t *pte = paging_get_pte(virt);
+        budget--;
+
+        // Only 4KB page tables carry per-page accessed bits: skip the
+        // rest of a missing or large table in one step
+        if (!pte) {
+            wss_va = (virt | (paging_table_span() - 1)) + 1;
+        } else {
+            wss_va = virt + PAGE_SIZE;
+            uint32_t e = *pte;
+            if (e & PAGE_PRESENT) {
+                uint32_t age = (e & PAGE_AGE_MASK) >> PAGE_AGE_SHIFT;
+                if (e & PAGE_ACCESSED) {
+                    // Sample and re-arm: keep the bit for the clock, flush
+                    // the TLB entry so the next access sets it again
+                    age = 0;
+                    e = (e & ~PAGE_ACCESSED) | PAGE_SOFT_ACCESSED;
+                    asm volatile("invlpg (%0)" :: "r"(virt) : "memory");
+                    wss_harvested++;
+                } else if (age < WSS_MAX_AGE) {
+                    age++;
+                }
+                *pte = (e & ~PAGE_AGE_MASK) | (age << PAGE_AGE_SHIFT);
+                wss_hist[wss_region(virt)][age]++;
+            }
+        }
+
+        // Wrapped past the top of the address space
+        if (wss_va == 0) {
+            wss_end_pass();
+        }
+    }
+}
+
+static void wss_print_kb(uint32_t pages)
+{
+    kprint_dec(pages * (PAGE_SIZE / 1024));
+    kprint(" KB");
+}
+
+void wss_print_stats(void)
+{
+    kprint("wss: ");
+    kprint_dec(wss_passes);
+    kprint(" passes, last took ");
+    kprint_dec(wss_pass_ticks * 10);
+    kprint(" ms (");
+    kprint_dec(WSS_SCAN_BUDGET);
+    kprint(" PTEs per tick), ");
+    kprint_dec(wss_harvested);
+    kprint(" accessed bits harvested\n");
+    if (wss_passes == 0) {
+        kprint("  no complete pass yet\n");
+        return;
+    }
+
+    // Cumulative: pages idle for less than N passes
+    uint32_t total[WSS_AGES] = { 0 };
+    kprint("region      age 0   age 1   age 2   age 3+  (pages)\n");
+    for (uint32_t r = 0; r < WSS_REGIONS; r++) {
+        int len = 0;
+        kprint(wss_regions[r].name);
+        while (wss_regions[r].name[len]) len++;
+        while (len++ < 10) kprint(" ");
+        for (uint32_t a = 0; a < WSS_AGES; a++) {
+            uint32_t n = wss_last[r][a];
+            total[a] += n;
+            kprint("  ");
+            uint32_t width = 1;
+            for (uint32_t t = n; t >= 10; t /= 10) width++;
+            while (width++ < 6) kprint(" ");
+            kprint_dec(n);
+        }
+        kprint("\n");
+    }
+
+    uint32_t mapped = 0;
+    for (uint32_t a = 0; a < WSS_AGES; a++) {
+        mapped += total[a];
+    }
+    kprint("working set: ");
+    wss_print_kb(total[0]);
+    kprint(" within 1 pass, ");
+    wss_print_kb(total[0] + total[1]);
+    kprint(" within 2, ");
+    wss_print_kb(total[0] + total[1] + total[2]);
+    kprint(" within 3, of ");
+    wss_print_kb(mapped);
+    kprint(" mapped in 4KB pages\n");
+}
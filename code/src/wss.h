@@ -0,0 +1,28 @@
+#ifndef WSS_H
+#define WSS_H
+
+#include "paging.h" // For types
+
+/*
+   Working-set estimation.
+   A scanner driven by the timer tick walks the 4KB page tables a little
+   at a time. Every present PTE it visits gets an idle age in its software
+   bits: 0 if the page was accessed since the previous visit, otherwise
+   one more (up to 3). A full pass over the address space yields an age
+   histogram per region; pages of age 0 are the working set over one pass.
+*/
+
+#define WSS_MAX_AGE 3
+
+/* PTEs examined per timer tick (directory slots without a table count
+   as one) */
+#define WSS_SCAN_BUDGET 256
+
+/* Advance the scan. Called from the timer interrupt. */
+void wss_tick(void);
+
+/* Print the last complete pass: per-region age histograms and the
+   working-set estimate (shell: wss) */
+void wss_print_stats(void);
+
+#endif